@@ -1,75 +1,543 @@
 #include "imgui.h"
 #include "raylib.h"
 #include "rlImGui.h"
+#include "numeric.hpp"
 
+#include <algorithm>
 #include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <fstream>
 #include <iomanip>
+#include <iostream>
+#include <list>
+#include <mutex>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
 
 // TODO: add keypad numbers to actions
 // TODO: fix key pressed/chord precedence (the chord is always last)
 
-class Parser {
+// Parse failure with the offset into the expression where it was detected
+struct ParseError : std::runtime_error {
+  size_t position;
+
+  ParseError(const char *what, size_t position)
+      : std::runtime_error(what), position(position) {}
+};
+
+// Scans a decimal literal at [first, last): digits with an optional fraction
+// and exponent ("12", ".5", "1.5e-3"). std::from_chars rounds correctly,
+// never allocates and ignores the locale. Signs are operators, so a literal
+// never starts with one.
+inline std::from_chars_result ScanNumber(const char *first, const char *last,
+                                         double &value) {
+  if (first == last || !(IsDigit(*first) || *first == '.'))
+    return {first, std::errc::invalid_argument};
+  return std::from_chars(first, last, value, std::chars_format::general);
+}
+
+// Flat postfix program produced by Parser::compile(). Running it is a single
+// pass over `code` with a stack sized at compile time, so evaluating the same
+// expression again neither re-parses the text nor allocates (for double).
+template <typename Number> struct Program {
+  enum Op : unsigned char { PUSH, ADD, SUB, MUL, DIV };
+
+  struct Instr {
+    Op op;
+    Number value; // only used by PUSH
+  };
+
+  std::vector<Instr> code;
+  mutable std::vector<Number> stack;
+
+  // Runs code[first..], which must leave exactly one value on the stack
+  Number run(size_t first = 0) const {
+    Number *top = stack.data() - 1;
+    for (size_t i = first; i < code.size(); ++i) {
+      const Instr &instr = code[i];
+      switch (instr.op) {
+      case PUSH:
+        *++top = instr.value;
+        break;
+      case ADD:
+        top[-1] += top[0];
+        --top;
+        break;
+      case SUB:
+        top[-1] -= top[0];
+        --top;
+        break;
+      case MUL:
+        top[-1] *= top[0];
+        --top;
+        break;
+      case DIV:
+        top[-1] /= top[0];
+        --top;
+        break;
+      }
+    }
+    return *top;
+  }
+};
+
+// Values of parenthesized groups seen before, keyed by their normalized text
+// (spaces the grammar allows are dropped) and evicted least recently used
+// once the entries exceed `budget` bytes. Callers pass each key's hash, so a
+// lookup never rehashes the text.
+template <typename Number> class SubexpressionCache {
+  struct Key {
+    std::string_view text;
+    size_t hash;
+    bool operator==(const Key &other) const {
+      return hash == other.hash && text == other.text;
+    }
+  };
+  struct KeyHash {
+    size_t operator()(const Key &key) const { return key.hash; }
+  };
+  struct Entry {
+    std::string key;
+    size_t hash;
+    Number value;
+  };
+
+  std::list<Entry> entries; // most recently used first
+  std::unordered_map<Key, typename std::list<Entry>::iterator, KeyHash> index;
+  size_t budget;
+  size_t used = 0;
+
+public:
+  size_t hits = 0;
+  size_t misses = 0;
+
+  SubexpressionCache(size_t budget) : budget(budget) {}
+
+  size_t memory() const { return used; }
+
+  bool lookup(std::string_view key, size_t hash, Number &value) {
+    auto it = index.find({key, hash});
+    if (it == index.end()) {
+      ++misses;
+      return false;
+    }
+    entries.splice(entries.begin(), entries, it->second);
+    value = it->second->value;
+    ++hits;
+    return true;
+  }
+
+  void insert(std::string_view key, size_t hash, Number value) {
+    if (index.count({key, hash}) || cost(key, value) > budget)
+      return;
+    used += cost(key, value);
+    entries.push_front({std::string(key), hash, std::move(value)});
+    index.emplace(Key{entries.front().key, hash}, entries.begin());
+
+    while (used > budget) {
+      used -= cost(entries.back().key, entries.back().value);
+      index.erase({entries.back().key, entries.back().hash});
+      entries.pop_back();
+    }
+  }
+
+private:
+  // Rough footprint of an entry including its list and hash nodes
+  static size_t cost(std::string_view key, const Number &value) {
+    size_t size = sizeof(Entry) + key.size() + 64;
+    if constexpr (std::is_same_v<Number, BigDecimal>)
+      size += value.memory();
+    return size;
+  }
+};
+
+template <typename Number> class Parser {
+  const char *begin;
   const char *str;
+  const char *end;
+  Program<Number> program;
+  size_t depth = 0;
+  SubexpressionCache<Number> *cache;
+
+  // Longer groups are not cached, so the keys copied into the cache add up
+  // to a bounded multiple of the input however deeply groups nest
+  static constexpr size_t MAX_KEY = 1024;
+  static constexpr uint64_t HASH_BASE = 0x100000001b3;
+
+  // A '(' of the input: where it opens and closes (0 if it never does) and
+  // where its key lies in normalized
+  struct Group {
+    size_t open;
+    size_t close;
+    size_t key_begin;
+    size_t key_end;
+  };
+  std::string normalized; // the input with skippable spaces dropped
+  std::vector<uint64_t> prefix_hash; // hash of normalized[0, i)
+  std::vector<uint64_t> powers;      // HASH_BASE^i
+  std::vector<Group> groups;         // in input order
+  size_t next_group = 0;
 
 public:
-  Parser(const std::string &s) : str(s.c_str()) {}
+  Parser(const std::string &s, SubexpressionCache<Number> *cache = nullptr)
+      : begin(s.c_str()), str(begin), end(begin + s.size()), cache(cache) {
+    if (cache)
+      index_groups();
+  }
 
-  double parse() {
-    double result = expr();
+  Program<Number> compile() {
+    expr();
     if (*str)
-      throw std::runtime_error("Unexpected input");
-    return result;
+      error("Unexpected input");
+    return std::move(program);
   }
 
+  Number parse() { return compile().run(); }
+
 private:
-  double expr() {
-    double result = term();
+  [[noreturn]] void error(const char *what) const {
+    throw ParseError(what, str - begin);
+  }
+
+  // Normalizes the input and finds every group's key in one pass, hashing
+  // prefixes so a group's hash takes O(1) however deeply it is nested. Only
+  // spaces in places where factor() skips them are dropped, so an invalid
+  // group can never share a key with a valid one.
+  void index_groups() {
+    std::vector<size_t> unclosed; // indices into groups
+    prefix_hash.push_back(0);
+    powers.push_back(1);
+    for (const char *p = begin; p < end; ++p) {
+      if (*p == ' ' && !normalized.empty()) {
+        char prev = normalized.back();
+        size_t size = normalized.size();
+        bool exponent_sign =
+            (prev == '+' || prev == '-') && size > 1 &&
+            (normalized[size - 2] == 'e' || normalized[size - 2] == 'E');
+        if (strchr("(+-*/", prev) && !exponent_sign)
+          continue;
+      }
+      if (*p == '(') {
+        unclosed.push_back(groups.size());
+        groups.push_back({(size_t)(p - begin), 0, normalized.size(), 0});
+      }
+      normalized += *p;
+      prefix_hash.push_back(prefix_hash.back() * HASH_BASE +
+                            (unsigned char)*p);
+      powers.push_back(powers.back() * HASH_BASE);
+      if (*p == ')' && !unclosed.empty()) {
+        Group &group = groups[unclosed.back()];
+        group.close = p + 1 - begin;
+        group.key_end = normalized.size();
+        unclosed.pop_back();
+      }
+    }
+  }
+
+  // The group opening at str if its value may be cached, else nullptr
+  const Group *cacheable_group() {
+    size_t open = str - begin;
+    while (next_group < groups.size() && groups[next_group].open < open)
+      ++next_group; // inside a group that was found in the cache
+    if (next_group == groups.size() || groups[next_group].open != open)
+      return nullptr;
+    const Group &group = groups[next_group++];
+    if (group.close == 0 || group.key_end - group.key_begin > MAX_KEY)
+      return nullptr;
+    return &group;
+  }
+
+  std::string_view key(const Group &group) const {
+    return std::string_view(normalized)
+        .substr(group.key_begin, group.key_end - group.key_begin);
+  }
+
+  size_t hash(const Group &group) const {
+    return prefix_hash[group.key_end] -
+           prefix_hash[group.key_begin] *
+               powers[group.key_end - group.key_begin];
+  }
+
+  void emit(typename Program<Number>::Op op, Number value = Number()) {
+    program.code.push_back({op, std::move(value)});
+    if (op == Program<Number>::PUSH) {
+      if (++depth > program.stack.size())
+        program.stack.resize(depth);
+    } else {
+      --depth;
+    }
+  }
+
+  void expr() {
+    term();
     while (*str == '+' || *str == '-') {
       char op = *str++;
-      double t = term();
-      if (op == '+')
-        result += t;
-      else
-        result -= t;
+      term();
+      emit(op == '+' ? Program<Number>::ADD : Program<Number>::SUB);
     }
-    return result;
   }
 
-  double term() {
-    double result = factor();
+  void term() {
+    factor();
     while (*str == '*' || *str == '/') {
       char op = *str++;
-      double f = factor();
-      if (op == '*')
-        result *= f;
-      else
-        result /= f;
+      factor();
+      emit(op == '*' ? Program<Number>::MUL : Program<Number>::DIV);
     }
-    return result;
   }
 
-  double factor() {
+  void factor() {
     while (isspace(*str))
       str++; // skip spaces
 
     if (*str == '(') {
+      const Group *group = cache ? cacheable_group() : nullptr;
+      Number value;
+      if (group && cache->lookup(key(*group), hash(*group), value)) {
+        str = begin + group->close;
+        emit(Program<Number>::PUSH, std::move(value));
+        return;
+      }
+
       str++;
-      double result = expr();
+      size_t first = program.code.size();
+      expr();
       if (*str != ')')
-        throw std::runtime_error("Expected ')'");
+        error("Expected ')'");
       str++;
-      return result;
+
+      // The group is constant: fold it to a single PUSH
+      value = program.run(first);
+      program.code.resize(first);
+      --depth;
+      emit(Program<Number>::PUSH, value);
+      if (group)
+        cache->insert(key(*group), hash(*group), std::move(value));
+      return;
     }
 
-    // parse number
-    const char *start = str;
-    while (isdigit(*str) || *str == '.')
-      str++;
-    if (start == str)
-      throw std::runtime_error("Expected number");
-    return std::stod(std::string(start, str));
+    Number value;
+    auto [ptr, ec] = ScanNumber(str, end, value);
+    if (ec == std::errc::invalid_argument)
+      error("Expected number");
+    if (ec == std::errc::result_out_of_range)
+      error("Number out of range");
+    str = ptr;
+    emit(Program<Number>::PUSH, std::move(value));
+  }
+};
+
+// Shared by the UI (one per backend); batch workers parse without it
+template <typename Number>
+SubexpressionCache<Number> subexpression_cache(1 << 20);
+
+// Evaluates expr, compiling it only when the text differs from the last call
+// (e.g. pressing % and then = on the same display string).
+template <typename Number> Number Evaluate(const std::string &expr) {
+  static std::string source;
+  static Program<Number> program;
+
+  if (program.code.empty() || expr != source) {
+    program = Parser<Number>(expr, &subexpression_cache<Number>).compile();
+    source = expr;
+  }
+  return program.run();
+}
+
+// Same formatting as the = key, so batch output matches the UI
+std::string FormatResult(double value) { return std::to_string(value); }
+template <typename Number> std::string FormatResult(const Number &value) {
+  return value.to_string();
+}
+
+// Evaluates the display while it is being typed. The operand and operator
+// stacks of the text seen so far are kept between keystrokes and reduced
+// eagerly, so appending a character is O(1) amortized and the preview only has
+// to fold the (at most two) operators still pending. Accepts exactly the same
+// input as Parser.
+template <typename Number> class LiveEvaluator {
+  std::string number; // literal currently being typed
+  std::vector<Number> operands;
+  std::vector<char> operators; // '+', '-', '*', '/' or '('
+  bool expect_operand = true;
+  bool failed = false;
+  std::string preview_text; // "= value" or "", valid until the text changes
+  bool preview_stale = true;
+
+public:
+  void reset() {
+    number.clear();
+    operands.clear();
+    operators.clear();
+    expect_operand = true;
+    failed = false;
+    preview_stale = true;
+  }
+
+  void assign(const std::string &text) {
+    reset();
+    for (char c : text)
+      append(c);
+  }
+
+  void append(char c) {
+    preview_stale = true;
+    if (failed)
+      return;
+
+    if (IsDigit(c) || c == '.' || continues_number(c)) {
+      if (expect_operand || !number.empty()) {
+        number += c;
+        expect_operand = false;
+      } else {
+        failed = true; // a digit right after ')'
+      }
+      return;
+    }
+
+    if (!number.empty()) {
+      Number value;
+      if (!scan(value)) {
+        failed = true;
+        return;
+      }
+      operands.push_back(std::move(value));
+      number.clear();
+    }
+
+    if (expect_operand) {
+      if (c == '(')
+        operators.push_back('(');
+      else if (!isspace(c))
+        failed = true;
+      return;
+    }
+
+    try {
+      switch (c) {
+      case '+':
+      case '-':
+        reduce(false);
+        operators.push_back(c);
+        expect_operand = true;
+        break;
+      case '*':
+      case '/':
+        reduce(true);
+        operators.push_back(c);
+        expect_operand = true;
+        break;
+      case ')':
+        reduce(false);
+        if (operators.empty())
+          failed = true;
+        else
+          operators.pop_back();
+        break;
+      default:
+        failed = true;
+      }
+    } catch (const std::exception &) {
+      failed = true; // division by zero or overflow in a decimal backend
+    }
+  }
+
+  // Value of the text so far, or false if pressing = would fail
+  bool preview(Number &result) const {
+    if (failed || expect_operand)
+      return false;
+
+    Number value;
+    size_t top = operands.size();
+    if (!number.empty()) {
+      if (!scan(value))
+        return false;
+    } else {
+      value = operands[--top];
+    }
+
+    for (size_t i = operators.size(); i-- > 0;) {
+      if (operators[i] == '(')
+        return false;
+      Number lhs = operands[--top];
+      try {
+        apply(operators[i], lhs, value);
+      } catch (const std::exception &) {
+        return false;
+      }
+      value = std::move(lhs);
+    }
+    result = std::move(value);
+    return true;
+  }
+
+  // The preview formatted for display, or "" if pressing = would fail. Kept
+  // until the next append() or reset(), so redrawing it every frame neither
+  // folds nor formats again.
+  const std::string &formatted_preview() {
+    if (preview_stale) {
+      Number value;
+      preview_text = preview(value) ? "= " + FormatResult(value) : "";
+      preview_stale = false;
+    }
+    return preview_text;
+  }
+
+private:
+  // Exponent markers and exponent signs only belong to a literal in progress
+  bool continues_number(char c) const {
+    if (number.empty())
+      return false;
+    if (c == 'e' || c == 'E')
+      return true;
+    char last = number.back();
+    return (c == '+' || c == '-') && (last == 'e' || last == 'E');
+  }
+
+  // Parser rejects a literal unless ScanNumber consumes all of it
+  bool scan(Number &value) const {
+    const char *last = number.data() + number.size();
+    auto [ptr, ec] = ScanNumber(number.data(), last, value);
+    return ec == std::errc() && ptr == last;
+  }
+
+  static void apply(char op, Number &lhs, const Number &rhs) {
+    switch (op) {
+    case '+':
+      lhs += rhs;
+      break;
+    case '-':
+      lhs -= rhs;
+      break;
+    case '*':
+      lhs *= rhs;
+      break;
+    default:
+      lhs /= rhs;
+    }
+  }
+
+  // Folds pending operators down to the nearest '(' (or only '*' and '/' when
+  // multiplicative_only), keeping the evaluation left-associative
+  void reduce(bool multiplicative_only) {
+    while (!operators.empty() && operators.back() != '(') {
+      char op = operators.back();
+      if (multiplicative_only && op != '*' && op != '/')
+        break;
+      operators.pop_back();
+      Number rhs = std::move(operands.back());
+      operands.pop_back();
+      apply(op, operands.back(), rhs);
+    }
   }
 };
 
@@ -96,31 +564,192 @@ void ToggleSign(std::string &expr) {
   }
 }
 
-void ApplyPercent(std::string &display) {
+template <typename Number> void ApplyPercent(std::string &display) {
   if (display.empty())
     return;
 
   try {
-    double value = Parser(display).parse(); // evaluate expression
-    value *= 100.0;                         // convert to percent
+    Number value = Evaluate<Number>(display); // evaluate expression
+    value *= Number(100);                     // convert to percent
+
+    if constexpr (std::is_same_v<Number, double>) {
+      // Convert back to string with trimming
+      std::ostringstream ss;
+      ss << std::fixed << std::setprecision(10) << value;
+      std::string str = ss.str();
+
+      // Trim trailing zeros
+      str.erase(str.find_last_not_of('0') + 1, std::string::npos);
+      if (str.back() == '.')
+        str.pop_back();
+
+      display = str;
+    } else {
+      // The decimal backends print exactly, without trailing zeros
+      display = value.to_string();
+    }
+  } catch (...) {
+    display = "Error"; // invalid expression
+  }
+}
 
-    // Convert back to string with trimming
-    std::ostringstream ss;
-    ss << std::fixed << std::setprecision(10) << value;
-    std::string str = ss.str();
+typedef enum NumberBackend {
+  DOUBLE = 0,
+  DECIMAL128,
+  BIG_DECIMAL,
+  BACKEND_COUNT,
+} NumberBackend;
+
+const char *BackendNames[] = {"double", "decimal128", "bigdecimal"};
+
+// Calls fn with a default-constructed number of the backend's type, so generic
+// lambdas can pick the matching Parser/LiveEvaluator instantiation
+template <typename F> decltype(auto) WithBackend(NumberBackend backend, F &&fn) {
+  switch (backend) {
+  case DECIMAL128:
+    return fn(Decimal128());
+  case BIG_DECIMAL:
+    return fn(BigDecimal());
+  default:
+    return fn(0.0);
+  }
+}
 
-    // Trim trailing zeros
-    str.erase(str.find_last_not_of('0') + 1, std::string::npos);
-    if (str.back() == '.')
-      str.pop_back();
+// Runs fn(begin, end) over [0, count) on `threads` workers. Ranges are dealt
+// out round-robin up front; a worker that drains its own queue steals from
+// the back of the others, so a run of long expressions doesn't leave cores
+// idle.
+template <typename F> void ParallelFor(size_t count, unsigned threads, F &&fn) {
+  constexpr size_t GRAIN = 256;
+
+  struct Queue {
+    std::mutex mutex;
+    std::deque<std::pair<size_t, size_t>> ranges;
+  };
+  std::vector<Queue> queues(threads);
+  for (size_t begin = 0, i = 0; begin < count; begin += GRAIN, ++i)
+    queues[i % threads].ranges.push_back(
+        {begin, std::min(count, begin + GRAIN)});
+
+  auto pop = [&queues, threads](unsigned self,
+                                std::pair<size_t, size_t> &range) {
+    for (unsigned k = 0; k < threads; ++k) {
+      Queue &queue = queues[(self + k) % threads];
+      std::lock_guard lock(queue.mutex);
+      if (queue.ranges.empty())
+        continue;
+      if (k == 0) {
+        range = queue.ranges.front();
+        queue.ranges.pop_front();
+      } else {
+        range = queue.ranges.back();
+        queue.ranges.pop_back();
+      }
+      return true;
+    }
+    return false;
+  };
+
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < threads; ++t) {
+    workers.emplace_back([&pop, &fn, t] {
+      std::pair<size_t, size_t> range;
+      while (pop(t, range))
+        fn(range.first, range.second);
+    });
+  }
+  for (std::thread &worker : workers)
+    worker.join();
+}
 
-    display = str;
-  } catch (...) {
-    display = "Error"; // invalid expression
+// Headless mode: one expression per input line, one result per output line
+// ("Error" for invalid input, like the % key). Input is processed in blocks so
+// memory stays bounded; throughput is reported on stderr.
+template <typename Number>
+int RunBatch(std::istream &in, std::ostream &out, unsigned threads) {
+  constexpr size_t BLOCK_LINES = 1 << 20;
+
+  std::vector<std::string> lines;
+  std::vector<std::string> results;
+  std::string line;
+  size_t total = 0;
+  auto start = std::chrono::steady_clock::now();
+
+  while (in) {
+    lines.clear();
+    while (lines.size() < BLOCK_LINES && std::getline(in, line)) {
+      if (!line.empty() && line.back() == '\r')
+        line.pop_back();
+      lines.push_back(std::move(line));
+    }
+
+    results.resize(lines.size());
+    ParallelFor(lines.size(), threads, [&lines, &results](size_t begin,
+                                                         size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        try {
+          results[i] = FormatResult(Parser<Number>(lines[i]).parse());
+        } catch (...) {
+          results[i] = "Error";
+        }
+      }
+    });
+
+    for (const std::string &result : results)
+      out << result << '\n';
+    total += lines.size();
   }
+  out.flush();
+
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  std::cerr << total << " expressions in " << seconds << "s ("
+            << (seconds > 0 ? total / seconds : 0) << " expr/s, " << threads
+            << " threads)\n";
+  return 0;
 }
 
-int main() {
+int main(int argc, char **argv) {
+  if (argc > 1 && strcmp(argv[1], "--batch") == 0) {
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    NumberBackend backend = DOUBLE;
+    const char *path = nullptr;
+    for (int i = 2; i < argc; ++i) {
+      if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+        threads = std::max(1, atoi(argv[++i]));
+      } else if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc) {
+        const char *name = argv[++i];
+        auto it = std::find_if(
+            std::begin(BackendNames), std::end(BackendNames),
+            [name](const char *n) { return strcmp(n, name) == 0; });
+        if (it == std::end(BackendNames)) {
+          std::cerr << "Unknown backend " << name << "\n";
+          return 1;
+        }
+        backend = (NumberBackend)(it - std::begin(BackendNames));
+      } else if (strcmp(argv[i], "--digits") == 0 && i + 1 < argc) {
+        BigDecimal::division_digits = std::max(0, atoi(argv[++i]));
+      } else {
+        path = argv[i];
+      }
+    }
+
+    std::ios::sync_with_stdio(false);
+    std::ifstream file;
+    if (path) {
+      file.open(path);
+      if (!file) {
+        std::cerr << "Could not open " << path << "\n";
+        return 1;
+      }
+    }
+    std::istream &in = path ? file : std::cin;
+    return WithBackend(backend, [&in, threads](auto zero) {
+      return RunBatch<decltype(zero)>(in, std::cout, threads);
+    });
+  }
+
   SetConfigFlags(FLAG_WINDOW_RESIZABLE);
   InitWindow(800, 600, "Calculator");
   SetWindowMinSize(640, 480);
@@ -133,6 +762,25 @@ int main() {
   ImGui::GetStyle().FontScaleMain = 2;
 
   std::string display;
+  NumberBackend backend = DOUBLE;
+  // Only the evaluator of the selected backend is kept up to date
+  std::tuple<LiveEvaluator<double>, LiveEvaluator<Decimal128>,
+             LiveEvaluator<BigDecimal>>
+      live;
+  std::string error; // why the last = failed, shown in place of the preview
+  auto append = [&display, &backend, &live, &error](char c) {
+    display += c;
+    WithBackend(backend, [&live, c](auto zero) {
+      std::get<LiveEvaluator<decltype(zero)>>(live).append(c);
+    });
+    error.clear();
+  };
+  auto refresh = [&display, &backend, &live, &error]() {
+    WithBackend(backend, [&live, &display](auto zero) {
+      std::get<LiveEvaluator<decltype(zero)>>(live).assign(display);
+    });
+    error.clear();
+  };
 
   while (!WindowShouldClose()) {
     BeginDrawing();
@@ -153,6 +801,23 @@ int main() {
                     ImVec2(avail.x, 0));
       ImGui::PopStyleVar();
 
+      const std::string &text =
+          WithBackend(backend, [&live](auto zero) -> const std::string & {
+            return std::get<LiveEvaluator<decltype(zero)>>(live)
+                .formatted_preview();
+          });
+      if (!text.empty()) {
+        ImGui::SetCursorPosX(ImGui::GetCursorPosX() + avail.x -
+                             ImGui::CalcTextSize(text.c_str()).x);
+        ImGui::TextDisabled("%s", text.c_str());
+      } else if (!error.empty()) {
+        ImGui::SetCursorPosX(ImGui::GetCursorPosX() + avail.x -
+                             ImGui::CalcTextSize(error.c_str()).x);
+        ImGui::TextDisabled("%s", error.c_str());
+      } else {
+        ImGui::TextDisabled(" ");
+      }
+
       for (int i = 0; i < 2; ++i) {
         ImGui::Spacing();
       }
@@ -166,120 +831,126 @@ int main() {
         ImGui::TableSetColumnIndex(0);
         if (ImGui::Button("%", ImVec2(-1, button_height)) ||
             ImGui::IsKeyChordPressed(ImGuiKey_LeftShift | ImGuiKey_5)) {
-          ApplyPercent(display);
+          WithBackend(backend, [&display](auto zero) {
+            ApplyPercent<decltype(zero)>(display);
+          });
+          refresh();
         }
 
         ImGui::TableSetColumnIndex(1);
         if (ImGui::Button("÷", ImVec2(-1, button_height)) ||
             ImGui::IsKeyPressed(ImGuiKey_Slash)) {
-          display += "/";
+          append('/');
         }
 
         ImGui::TableSetColumnIndex(2);
         if (ImGui::Button("x", ImVec2(-1, button_height)) ||
             ImGui::IsKeyChordPressed(ImGuiKey_LeftShift | ImGuiKey_8)) {
-          display += "*";
+          append('*');
         }
 
         ImGui::TableSetColumnIndex(3);
         if (ImGui::Button("-", ImVec2(-1, button_height)) ||
             ImGui::IsKeyPressed(ImGuiKey_Minus)) {
-          display += "-";
+          append('-');
         }
 
         ImGui::TableNextRow();
         ImGui::TableSetColumnIndex(0);
         if (ImGui::Button("7", ImVec2(-1, button_height)) ||
             ImGui::IsKeyPressed(ImGuiKey_7)) {
-          display += "7";
+          append('7');
         }
 
         ImGui::TableSetColumnIndex(1);
         if (ImGui::Button("8", ImVec2(-1, button_height)) ||
             (ImGui::IsKeyPressed(ImGuiKey_8) &&
              !ImGui::IsKeyPressed(ImGuiKey_LeftShift))) {
-          display += "8";
+          append('8');
         }
 
         ImGui::TableSetColumnIndex(2);
         if (ImGui::Button("9", ImVec2(-1, button_height)) ||
             ImGui::IsKeyPressed(ImGuiKey_9)) {
-          display += "9";
+          append('9');
         }
 
         ImGui::TableSetColumnIndex(3);
         if (ImGui::Button("+", ImVec2(-1, button_height)) ||
             ImGui::IsKeyChordPressed(ImGuiKey_LeftShift | ImGuiKey_Minus)) {
-          display += "+";
+          append('+');
         }
 
         ImGui::TableNextRow();
         ImGui::TableSetColumnIndex(0);
         if (ImGui::Button("4", ImVec2(-1, button_height)) ||
             ImGui::IsKeyPressed(ImGuiKey_4)) {
-          display += "4";
+          append('4');
         }
 
         ImGui::TableSetColumnIndex(1);
         if (ImGui::Button("5", ImVec2(-1, button_height)) ||
             (ImGui::IsKeyPressed(ImGuiKey_5) &&
              !ImGui::IsKeyPressed(ImGuiKey_LeftShift))) {
-          display += "5";
+          append('5');
         }
 
         ImGui::TableSetColumnIndex(2);
         if (ImGui::Button("6", ImVec2(-1, button_height)) ||
             ImGui::IsKeyPressed(ImGuiKey_6)) {
-          display += "6";
+          append('6');
         }
 
         ImGui::TableSetColumnIndex(3);
         if (ImGui::Button("C", ImVec2(-1, button_height)) ||
             ImGui::IsKeyPressed(ImGuiKey_C)) {
           display = "";
+          refresh();
         }
 
         ImGui::TableNextRow();
         ImGui::TableSetColumnIndex(0);
         if (ImGui::Button("1", ImVec2(-1, button_height)) ||
             ImGui::IsKeyPressed(ImGuiKey_1)) {
-          display += "1";
+          append('1');
         }
 
         ImGui::TableSetColumnIndex(1);
         if (ImGui::Button("2", ImVec2(-1, button_height)) ||
             ImGui::IsKeyPressed(ImGuiKey_2)) {
-          display += "2";
+          append('2');
         }
 
         ImGui::TableSetColumnIndex(2);
         if (ImGui::Button("3", ImVec2(-1, button_height)) ||
             ImGui::IsKeyPressed(ImGuiKey_3)) {
-          display += "3";
+          append('3');
         }
 
         ImGui::TableSetColumnIndex(3);
         if (ImGui::Button("AC", ImVec2(-1, button_height)) ||
             ImGui::IsKeyPressed(ImGuiKey_A)) {
           display = "";
+          refresh();
         }
 
         ImGui::TableNextRow();
         ImGui::TableSetColumnIndex(0);
         if (ImGui::Button("0", ImVec2(-1, button_height)) ||
             ImGui::IsKeyPressed(ImGuiKey_0)) {
-          display += "0";
+          append('0');
         }
 
         ImGui::TableSetColumnIndex(1);
         if (ImGui::Button("+/-", ImVec2(-1, button_height))) {
           ToggleSign(display);
+          refresh();
         }
 
         ImGui::TableSetColumnIndex(2);
         if (ImGui::Button(".", ImVec2(-1, button_height)) ||
             ImGui::IsKeyPressed(ImGuiKey_Period)) {
-          display += ".";
+          append('.');
         }
 
         ImGui::TableSetColumnIndex(3);
@@ -287,15 +958,47 @@ int main() {
             (ImGui::IsKeyPressed(ImGuiKey_Equal) &&
              !ImGui::IsKeyPressed(ImGuiKey_LeftShift)) ||
             ImGui::IsKeyPressed(ImGuiKey_Enter)) {
-          display = std::to_string(Parser(display).parse());
+          try {
+            WithBackend(backend, [&display](auto zero) {
+              display = FormatResult(Evaluate<decltype(zero)>(display));
+            });
+            refresh();
+          } catch (const ParseError &e) {
+            error = std::string(e.what()) + " at " +
+                    std::to_string(e.position + 1);
+          } catch (const std::exception &e) {
+            error = e.what(); // e.g. division by zero in a decimal backend
+          }
         }
 
         if (ImGui::IsKeyPressed(ImGuiKey_Backspace)) {
-          if (!display.empty())
+          if (!display.empty()) {
             display.pop_back();
+            refresh();
+          }
         }
       }
       ImGui::EndTable();
+
+      ImGui::SetNextItemWidth(ImGui::CalcTextSize("bigdecimal").x * 1.5f);
+      if (ImGui::BeginCombo("##backend", BackendNames[backend])) {
+        for (int i = 0; i < BACKEND_COUNT; ++i) {
+          bool isSelected = (backend == i);
+          if (ImGui::Selectable(BackendNames[i], isSelected)) {
+            backend = (NumberBackend)i;
+            refresh();
+          }
+          if (isSelected)
+            ImGui::SetItemDefaultFocus();
+        }
+        ImGui::EndCombo();
+      }
+      ImGui::SameLine();
+      WithBackend(backend, [](auto zero) {
+        auto &cache = subexpression_cache<decltype(zero)>;
+        ImGui::TextDisabled("Subexpression cache: %zu hits, %zu misses, %zu KiB",
+                            cache.hits, cache.misses, cache.memory() / 1024);
+      });
     }
     ImGui::End();
 
@@ -1,10 +1,38 @@
 #include "imgui.h"
 #include "raylib.h"
 #include "rlImGui.h"
+#include "utils.hpp"
+#include <algorithm>
+#include <cctype>
 #include <array>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
 #include <functional>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <mutex>
+#include <span>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
-using ConverterFunc = std::function<double(int, int, double)>;
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 constexpr double ERR = -1.0;
 
@@ -117,7 +145,7 @@ const char *TimeUnits[] = {"MILLISECOND", "SECOND", "MINUTE", "HOUR",
 const char *CurrencyUnits[] = {"USD", "EUR", "JPY", "GBP",
                                "CNY", "AUD", "CAD", "CHF"};
 
-const int UnitCounts[] = {LENGTH_UNITS_COUNT,      WEIGHT_UNITS_COUNT,
+constexpr int UnitCounts[] = {LENGTH_UNITS_COUNT,      WEIGHT_UNITS_COUNT,
                           TEMPERATURE_UNITS_COUNT, VOLUME_UNITS_COUNT,
                           AREA_UNITS_COUNT,        SPEED_UNITS_COUNT,
                           TIME_UNITS_COUNT,        CURRENCY_UNITS_COUNT};
@@ -126,351 +154,1103 @@ const char **UnitStrings[] = {LengthUnits, WeightUnits,  TemperatureUnits,
                               VolumeUnits, AreaUnits,    SpeedUnits,
                               TimeUnits,   CurrencyUnits};
 
-double ConvertLength(int fromUnit, int toUnit, double value) {
-  // Convert from source unit to meters
-  double inMeters = 0.0;
-  switch (fromUnit) {
-  case METER:
-    inMeters = value;
-    break;
-  case KILOMETER:
-    inMeters = value * 1000.0;
-    break;
-  case CENTIMETER:
-    inMeters = value / 100.0;
-    break;
-  case MILLIMETER:
-    inMeters = value / 1000.0;
-    break;
-  case INCH:
-    inMeters = value * 0.0254;
-    break;
-  case FOOT:
-    inMeters = value * 0.3048;
-    break;
-  case YARD:
-    inMeters = value * 0.9144;
-    break;
-  case MILE:
-    inMeters = value * 1609.34;
-    break;
-  default:
-    return ERR;
+// A composed from->to conversion: result = value * scale + offset
+struct Affine {
+  double scale = 1.0;
+  double offset = 0.0;
+};
+
+// A unit converts to the SI unit of its dimension (USD for currencies) as
+// base = value * scale + offset. Kept in long double so composing two units
+// rounds once, e.g. 100 C is exactly 212 F.
+struct UnitScale {
+  long double scale = 1.0L;
+  long double offset = 0.0L;
+};
+
+typedef enum Dimension {
+  DIM_LENGTH = 0,
+  DIM_MASS,
+  DIM_TIME,
+  DIM_TEMPERATURE,
+  DIMENSION_COUNT,
+} Dimension;
+
+const char *DimensionSymbols[] = {"m", "kg", "s", "K"};
+
+// Exponent of each base dimension, e.g. speed is {1, 0, -1, 0}
+using DimensionVector = std::array<int, DIMENSION_COUNT>;
+
+struct UnitDefinition {
+  const char *symbol;
+  DimensionVector dimension;
+  UnitScale toSI; // to the SI unit of the same dimension
+};
+
+// Units understood by the composite parser. Adding a unit is one line here.
+constexpr UnitDefinition UnitRegistry[] = {
+    // length
+    {"m", {1, 0, 0, 0}, {1.0L}},
+    {"km", {1, 0, 0, 0}, {1000.0L}},
+    {"cm", {1, 0, 0, 0}, {0.01L}},
+    {"mm", {1, 0, 0, 0}, {0.001L}},
+    {"um", {1, 0, 0, 0}, {1e-6L}},
+    {"nm", {1, 0, 0, 0}, {1e-9L}},
+    {"in", {1, 0, 0, 0}, {0.0254L}},
+    {"ft", {1, 0, 0, 0}, {0.3048L}},
+    {"yd", {1, 0, 0, 0}, {0.9144L}},
+    {"mi", {1, 0, 0, 0}, {1609.34L}},
+    {"nmi", {1, 0, 0, 0}, {1852.0L}},
+    // mass
+    {"kg", {0, 1, 0, 0}, {1.0L}},
+    {"g", {0, 1, 0, 0}, {0.001L}},
+    {"mg", {0, 1, 0, 0}, {1e-6L}},
+    {"t", {0, 1, 0, 0}, {1000.0L}},
+    {"lb", {0, 1, 0, 0}, {0.453592L}},
+    {"oz", {0, 1, 0, 0}, {0.0283495L}},
+    // time
+    {"s", {0, 0, 1, 0}, {1.0L}},
+    {"ms", {0, 0, 1, 0}, {0.001L}},
+    {"us", {0, 0, 1, 0}, {1e-6L}},
+    {"ns", {0, 0, 1, 0}, {1e-9L}},
+    {"min", {0, 0, 1, 0}, {60.0L}},
+    {"h", {0, 0, 1, 0}, {3600.0L}},
+    {"d", {0, 0, 1, 0}, {86400.0L}},
+    {"wk", {0, 0, 1, 0}, {604800.0L}},
+    {"mo", {0, 0, 1, 0}, {2629800.0L}},
+    {"yr", {0, 0, 1, 0}, {31557600.0L}},
+    // temperature (degC and degF have offsets, so they can't be combined)
+    {"K", {0, 0, 0, 1}, {1.0L}},
+    {"degC", {0, 0, 0, 1}, {1.0L, 273.15L}},
+    {"degF", {0, 0, 0, 1}, {5.0L / 9.0L, 273.15L - 32.0L * 5.0L / 9.0L}},
+    // volume and area
+    {"L", {3, 0, 0, 0}, {0.001L}},
+    {"mL", {3, 0, 0, 0}, {1e-6L}},
+    {"gal", {3, 0, 0, 0}, {0.00378541L}},
+    {"pt", {3, 0, 0, 0}, {0.000473176L}},
+    {"qt", {3, 0, 0, 0}, {0.000946353L}},
+    {"cup", {3, 0, 0, 0}, {0.00024L}},
+    {"ha", {2, 0, 0, 0}, {10000.0L}},
+    {"acre", {2, 0, 0, 0}, {4046.86L}},
+    // speed
+    {"kn", {1, 0, -1, 0}, {0.514444L}},
+    {"mph", {1, 0, -1, 0}, {0.44704L}},
+    // derived SI units
+    {"N", {1, 1, -2, 0}, {1.0L}},
+    {"J", {2, 1, -2, 0}, {1.0L}},
+    {"W", {2, 1, -3, 0}, {1.0L}},
+    {"Pa", {-1, 1, -2, 0}, {1.0L}},
+    {"Hz", {0, 0, -1, 0}, {1.0L}},
+};
+
+constexpr int MAX_UNITS = 8;
+
+// Registry symbol of each tab unit, in *ConversionUnits order
+constexpr const char *LengthSymbols[] = {"m",  "km", "cm", "mm",
+                                         "in", "ft", "yd", "mi"};
+constexpr const char *WeightSymbols[] = {"kg", "g", "mg", "lb", "oz"};
+constexpr const char *TemperatureSymbols[] = {"degC", "degF", "K"};
+constexpr const char *VolumeSymbols[] = {"L",  "mL", "m^3", "gal",
+                                         "pt", "qt", "cup"};
+constexpr const char *AreaSymbols[] = {"m^2", "km^2", "ft^2", "acre", "ha"};
+constexpr const char *SpeedSymbols[] = {"m/s", "km/h", "mph", "kn"};
+constexpr const char *TimeSymbols[] = {"ms", "s",  "min", "h",
+                                       "d",  "wk", "mo",  "yr"};
+
+constexpr const char *const *UnitSymbols[] = {
+    LengthSymbols, WeightSymbols, TemperatureSymbols, VolumeSymbols,
+    AreaSymbols,   SpeedSymbols,  TimeSymbols};
+
+static_assert(std::size(LengthSymbols) == LENGTH_UNITS_COUNT &&
+              std::size(WeightSymbols) == WEIGHT_UNITS_COUNT &&
+              std::size(TemperatureSymbols) == TEMPERATURE_UNITS_COUNT &&
+              std::size(VolumeSymbols) == VOLUME_UNITS_COUNT &&
+              std::size(AreaSymbols) == AREA_UNITS_COUNT &&
+              std::size(SpeedSymbols) == SPEED_UNITS_COUNT &&
+              std::size(TimeSymbols) == TIME_UNITS_COUNT &&
+              std::size(UnitSymbols) == CURRENCY);
+
+// Example static exchange rates in units per USD, the only currency factors
+constexpr long double DefaultRates[] = {
+    1.0L,        1.0L / 0.85L, 1.0L / 110.0L, 1.0L / 0.75L,
+    1.0L / 6.5L, 1.0L / 1.35L, 1.0L / 1.25L,  1.0L / 0.92L};
+static_assert(std::size(DefaultRates) == CURRENCY_UNITS_COUNT);
+
+// Scale of "sym", "sym^N" or "a/b" to SI. A symbol missing from the
+// registry throws, which fails the build when ToBase is computed.
+constexpr UnitScale RegistryScale(std::string_view symbol) {
+  size_t slash = symbol.find('/');
+  if (slash != std::string_view::npos)
+    return {RegistryScale(symbol.substr(0, slash)).scale /
+            RegistryScale(symbol.substr(slash + 1)).scale};
+  int power = 1;
+  size_t caret = symbol.find('^');
+  if (caret != std::string_view::npos) {
+    power = symbol[caret + 1] - '0';
+    symbol = symbol.substr(0, caret);
+  }
+  for (const UnitDefinition &unit : UnitRegistry) {
+    if (symbol != unit.symbol)
+      continue;
+    UnitScale scale = unit.toSI;
+    for (int i = 1; i < power; ++i)
+      scale.scale *= unit.toSI.scale;
+    return scale;
   }
+  throw "unit missing from UnitRegistry";
+}
 
-  // Convert from meters to target unit
-  switch (toUnit) {
-  case METER:
-    return inMeters;
-  case KILOMETER:
-    return inMeters / 1000.0;
-  case CENTIMETER:
-    return inMeters * 100.0;
-  case MILLIMETER:
-    return inMeters * 1000.0;
-  case INCH:
-    return inMeters / 0.0254;
-  case FOOT:
-    return inMeters / 0.3048;
-  case YARD:
-    return inMeters / 0.9144;
-  case MILE:
-    return inMeters / 1609.34;
-  default:
-    return ERR;
+using UnitScaleTable =
+    std::array<std::array<UnitScale, MAX_UNITS>, CONVERSION_TYPE_COUNT>;
+
+constexpr UnitScaleTable BuildToBase() {
+  UnitScaleTable table{};
+  for (int type = 0; type < CURRENCY; ++type)
+    for (int unit = 0; unit < UnitCounts[type]; ++unit)
+      table[type][unit] = RegistryScale(UnitSymbols[type][unit]);
+  for (int unit = 0; unit < CURRENCY_UNITS_COUNT; ++unit)
+    table[CURRENCY][unit] = {DefaultRates[unit]};
+  return table;
+}
+
+constexpr UnitScaleTable ToBase = BuildToBase();
+
+using AffineMatrix = std::array<std::array<Affine, MAX_UNITS>, MAX_UNITS>;
+
+// Composes from->base with base->to so every conversion is one multiply-add
+constexpr Affine ComposeUnit(const UnitScale &f, const UnitScale &t) {
+  return {(double)(f.scale / t.scale),
+          (double)((f.offset - t.offset) / t.scale)};
+}
+
+constexpr AffineMatrix ComposeUnits(const UnitScale *units, int count) {
+  AffineMatrix matrix{};
+  for (int from = 0; from < count; ++from)
+    for (int to = 0; to < count; ++to)
+      matrix[from][to] =
+          from == to ? Affine{1.0, 0.0} : ComposeUnit(units[from], units[to]);
+  return matrix;
+}
+
+constexpr std::array<AffineMatrix, CONVERSION_TYPE_COUNT> BuildConversions() {
+  std::array<AffineMatrix, CONVERSION_TYPE_COUNT> table{};
+  for (int type = 0; type < CONVERSION_TYPE_COUNT; ++type)
+    table[type] = ComposeUnits(ToBase[type].data(), UnitCounts[type]);
+  return table;
+}
+
+constexpr std::array<AffineMatrix, CONVERSION_TYPE_COUNT> Conversions =
+    BuildConversions();
+
+// Index of name in names, or -1
+int FindName(const char **names, int count, const char *name) {
+  for (int i = 0; i < count; ++i)
+    if (strcmp(names[i], name) == 0)
+      return i;
+  return -1;
+}
+
+constexpr const char *RATES_PATH = "assets/rates.txt";
+
+// Exchange rates can change at runtime, so currency conversions go through
+// an atomic pointer: a reload builds a new table and swaps it in, readers
+// never lock and always see a whole table. A replaced table may still be in
+// use by a reader, so it is retired rather than freed; reloads are rare and a
+// table is ~1KB, so retired tables are simply kept until exit.
+std::atomic<const AffineMatrix *> CurrencyConversions{&Conversions[CURRENCY]};
+std::mutex RetiredRatesMutex;
+std::vector<std::unique_ptr<const AffineMatrix>> RetiredRates;
+
+void PublishRates(std::unique_ptr<const AffineMatrix> table) {
+  const AffineMatrix *old =
+      CurrencyConversions.exchange(table.release(), std::memory_order_acq_rel);
+  if (old != &Conversions[CURRENCY]) {
+    std::lock_guard lock(RetiredRatesMutex);
+    RetiredRates.emplace_back(old);
   }
 }
 
-double ConvertWeight(int fromUnit, int toUnit, double value) {
-  // Convert to kilograms
-  double inKg = 0.0;
-  switch (fromUnit) {
-  case KILOGRAM:
-    inKg = value;
-    break;
-  case GRAM:
-    inKg = value / 1000.0;
-    break;
-  case MILLIGRAM:
-    inKg = value / 1e6;
-    break;
-  case POUND:
-    inKg = value * 0.453592;
-    break;
-  case OUNCE:
-    inKg = value * 0.0283495;
-    break;
-  default:
-    return ERR;
+// Reads "CODE RATE" lines (units per USD, # starts a comment). Currencies
+// missing from the file keep their built-in rate; returns false and leaves the
+// published table alone if the file can't be read or has a bad line.
+bool LoadRates(const char *path) {
+  FILE *file = fopen(path, "r");
+  if (!file)
+    return false;
+
+  UnitScale units[CURRENCY_UNITS_COUNT];
+  std::copy_n(ToBase[CURRENCY].begin(), CURRENCY_UNITS_COUNT, units);
+
+  bool ok = true;
+  char line[256];
+  while (ok && fgets(line, sizeof(line), file)) {
+    char code[16];
+    double rate;
+    char *comment = strchr(line, '#');
+    if (comment)
+      *comment = '\0';
+    int fields = sscanf(line, "%15s %lf", code, &rate);
+    if (fields <= 0)
+      continue; // blank or comment-only line
+    int unit = FindName(CurrencyUnits, CURRENCY_UNITS_COUNT, code);
+    if (fields != 2 || unit < 0 || !(rate > 0)) {
+      std::cerr << path << ": invalid rate line: " << line;
+      ok = false;
+    } else {
+      units[unit] = {1.0L / rate};
+    }
   }
+  fclose(file);
 
-  // Convert from kilograms
-  switch (toUnit) {
-  case KILOGRAM:
-    return inKg;
-  case GRAM:
-    return inKg * 1000.0;
-  case MILLIGRAM:
-    return inKg * 1e6;
-  case POUND:
-    return inKg / 0.453592;
-  case OUNCE:
-    return inKg / 0.0283495;
-  default:
-    return ERR;
+  if (ok)
+    PublishRates(std::make_unique<const AffineMatrix>(
+        ComposeUnits(units, CURRENCY_UNITS_COUNT)));
+  return ok;
+}
+
+// Reloads the rates whenever the file's modification time changes
+void WatchRates(std::stop_token stop, const char *path) {
+  std::filesystem::file_time_type loaded{};
+  std::mutex mutex;
+  std::condition_variable_any wake;
+  while (!stop.stop_requested()) {
+    std::error_code ec;
+    auto modified = std::filesystem::last_write_time(path, ec);
+    if (!ec && modified != loaded) {
+      LoadRates(path); // a bad file is reported once, then waits for a fix
+      loaded = modified;
+    }
+
+    std::unique_lock lock(mutex);
+    wake.wait_for(lock, stop, std::chrono::seconds(1), [] { return false; });
   }
 }
 
-double ConvertTemperature(int fromUnit, int toUnit, double value) {
-  double celsius = 0.0;
-
-  // First convert to Celsius
-  switch (fromUnit) {
-  case CELSIUS:
-    celsius = value;
-    break;
-  case FAHRENHEIT:
-    celsius = (value - 32.0) * 5.0 / 9.0;
-    break;
-  case KELVIN:
-    celsius = value - 273.15;
-    break;
-  default:
+const Affine &Conversion(ConversionType type, int fromUnit, int toUnit) {
+  if (type == CURRENCY)
+    return (*CurrencyConversions.load(
+        std::memory_order_acquire))[fromUnit][toUnit];
+  return Conversions[type][fromUnit][toUnit];
+}
+
+// see *ConversionUnits enums for unit indices
+double Convert(ConversionType type, int fromUnit, int toUnit, double value) {
+  if (type < 0 || type >= CONVERSION_TYPE_COUNT || fromUnit < 0 ||
+      fromUnit >= UnitCounts[type] || toUnit < 0 ||
+      toUnit >= UnitCounts[type]) {
     return ERR;
   }
 
-  // Then convert to target
-  switch (toUnit) {
-  case CELSIUS:
-    return celsius;
-  case FAHRENHEIT:
-    return (celsius * 9.0 / 5.0) + 32.0;
-  case KELVIN:
-    return celsius + 273.15;
-  default:
-    return ERR;
+  const Affine &a = Conversion(type, fromUnit, toUnit);
+  return value * a.scale + a.offset;
+}
+
+// Bulk kernels all compute value * scale + offset without FMA, so every
+// path rounds exactly like the scalar Convert()
+static void ConvertScalar(const Affine &a, const double *in, double *out,
+                          size_t count) {
+  for (size_t i = 0; i < count; ++i)
+    out[i] = in[i] * a.scale + a.offset;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2"))) static void
+ConvertSSE2(const Affine &a, const double *in, double *out, size_t count) {
+  const __m128d scale = _mm_set1_pd(a.scale);
+  const __m128d offset = _mm_set1_pd(a.offset);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128d x0 = _mm_loadu_pd(in + i);
+    __m128d x1 = _mm_loadu_pd(in + i + 2);
+    _mm_storeu_pd(out + i, _mm_add_pd(_mm_mul_pd(x0, scale), offset));
+    _mm_storeu_pd(out + i + 2, _mm_add_pd(_mm_mul_pd(x1, scale), offset));
   }
+  ConvertScalar(a, in + i, out + i, count - i);
 }
 
-double ConvertVolume(int fromUnit, int toUnit, double value) {
-  // Convert to liters
-  double inLiters = 0.0;
-  switch (fromUnit) {
-  case LITER:
-    inLiters = value;
-    break;
-  case MILLILITER:
-    inLiters = value / 1000.0;
-    break;
-  case CUBIC_METER:
-    inLiters = value * 1000.0;
-    break;
-  case GALLON:
-    inLiters = value * 3.78541;
-    break; // US gallon
-  case PINT:
-    inLiters = value * 0.473176;
-    break; // US pint
-  case QUART:
-    inLiters = value * 0.946353;
-    break; // US quart
-  case CUP:
-    inLiters = value * 0.24;
-    break; // approx
-  default:
-    return ERR;
+__attribute__((target("avx2"))) static void
+ConvertAVX2(const Affine &a, const double *in, double *out, size_t count) {
+  const __m256d scale = _mm256_set1_pd(a.scale);
+  const __m256d offset = _mm256_set1_pd(a.offset);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256d x0 = _mm256_loadu_pd(in + i);
+    __m256d x1 = _mm256_loadu_pd(in + i + 4);
+    _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_mul_pd(x0, scale), offset));
+    _mm256_storeu_pd(out + i + 4,
+                     _mm256_add_pd(_mm256_mul_pd(x1, scale), offset));
   }
+  ConvertScalar(a, in + i, out + i, count - i);
+}
+#endif
 
-  // Convert from liters
-  switch (toUnit) {
-  case LITER:
-    return inLiters;
-  case MILLILITER:
-    return inLiters * 1000.0;
-  case CUBIC_METER:
-    return inLiters / 1000.0;
-  case GALLON:
-    return inLiters / 3.78541;
-  case PINT:
-    return inLiters / 0.473176;
-  case QUART:
-    return inLiters / 0.946353;
-  case CUP:
-    return inLiters / 0.24;
-  default:
-    return ERR;
+using BulkKernel = void (*)(const Affine &, const double *, double *, size_t);
+
+// Picks the widest kernel the running CPU supports
+static BulkKernel SelectBulkKernel() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return ConvertAVX2;
+  if (__builtin_cpu_supports("sse2"))
+    return ConvertSSE2;
+#endif
+  return ConvertScalar;
+}
+
+// Converts in[i] into out[i] for min(in.size(), out.size()) values, returns
+// false (leaving out untouched) for an invalid type or unit
+bool Convert(ConversionType type, int fromUnit, int toUnit,
+             std::span<const double> in, std::span<double> out) {
+  if (type < 0 || type >= CONVERSION_TYPE_COUNT || fromUnit < 0 ||
+      fromUnit >= UnitCounts[type] || toUnit < 0 ||
+      toUnit >= UnitCounts[type]) {
+    return false;
   }
+
+  static const BulkKernel kernel = SelectBulkKernel();
+  kernel(Conversion(type, fromUnit, toUnit), in.data(), out.data(),
+         std::min(in.size(), out.size()));
+  return true;
 }
 
-double ConvertArea(int fromUnit, int toUnit, double value) {
-  // Convert to square meters
-  double inSqMeters = 0.0;
-  switch (fromUnit) {
-  case SQUARE_METER:
-    inSqMeters = value;
-    break;
-  case SQUARE_KILOMETER:
-    inSqMeters = value * 1e6;
-    break;
-  case SQUARE_FOOT:
-    inSqMeters = value * 0.092903;
-    break;
-  case ACRE:
-    inSqMeters = value * 4046.86;
-    break;
-  case HECTARE:
-    inSqMeters = value * 10000.0;
-    break;
-  default:
-    return ERR;
+struct CompositeUnit {
+  DimensionVector dimension{};
+  UnitScale toSI;
+};
+
+// Parses a product/quotient of registry units with optional integer powers
+// up to 16 in magnitude, e.g. "km/h" or "kg*m/s^2" (left to right, so
+// "J/kg/K" is J/(kg*K)).
+// Returns false and sets error for unknown units or bad syntax.
+bool ParseUnit(std::string_view text, CompositeUnit &unit, std::string &error) {
+  constexpr int MAX_POWER = 16;
+  constexpr int MAX_DIMENSION = 1000; // keeps the sums far from overflow
+
+  unit = {};
+  size_t i = 0;
+  int terms = 0;
+  bool affine = false; // an offset unit appeared with a power other than 1
+  auto skipSpaces = [&text, &i] {
+    while (i < text.size() && text[i] == ' ')
+      ++i;
+  };
+
+  int sign = 1; // +1 after '*' (and for the first unit), -1 after '/'
+  while (true) {
+    skipSpaces();
+    size_t start = i;
+    while (i < text.size() &&
+           (isalpha((unsigned char)text[i]) || text[i] == '_'))
+      ++i;
+    std::string_view symbol = text.substr(start, i - start);
+    if (symbol.empty()) {
+      error = start < text.size()
+                  ? "Unexpected '" + std::string(1, text[start]) + "'"
+                  : "Missing unit";
+      return false;
+    }
+    const UnitDefinition *definition = nullptr;
+    for (const UnitDefinition &candidate : UnitRegistry)
+      if (symbol == candidate.symbol)
+        definition = &candidate;
+    if (!definition) {
+      error = "Unknown unit '" + std::string(symbol) + "'";
+      return false;
+    }
+
+    int power = 1;
+    skipSpaces();
+    if (i < text.size() && text[i] == '^') {
+      ++i;
+      skipSpaces();
+      auto [ptr, ec] = std::from_chars(text.data() + i,
+                                       text.data() + text.size(), power);
+      if (ec != std::errc() || power == 0 || power > MAX_POWER ||
+          power < -MAX_POWER) {
+        error = "Invalid power for '" + std::string(symbol) + "'";
+        return false;
+      }
+      i = ptr - text.data();
+    }
+
+    power *= sign;
+    for (int d = 0; d < DIMENSION_COUNT; ++d) {
+      unit.dimension[d] += definition->dimension[d] * power;
+      if (std::abs(unit.dimension[d]) > MAX_DIMENSION) {
+        error = "Invalid power for '" + std::string(symbol) + "'";
+        return false;
+      }
+    }
+    long double factor = 1.0L, base = definition->toSI.scale;
+    for (int n = std::abs(power); n > 0; n >>= 1, base *= base)
+      if (n & 1)
+        factor *= base;
+    if (power > 0)
+      unit.toSI.scale *= factor;
+    else
+      unit.toSI.scale /= factor;
+    if (definition->toSI.offset != 0.0L) {
+      affine = affine || power != 1;
+      unit.toSI.offset = definition->toSI.offset;
+    }
+    ++terms;
+
+    skipSpaces();
+    if (i == text.size())
+      break;
+    if (text[i] != '*' && text[i] != '/') {
+      error = "Unexpected '" + std::string(1, text[i]) + "'";
+      return false;
+    }
+    sign = text[i++] == '*' ? 1 : -1;
   }
 
-  // Convert from square meters
-  switch (toUnit) {
-  case SQUARE_METER:
-    return inSqMeters;
-  case SQUARE_KILOMETER:
-    return inSqMeters / 1e6;
-  case SQUARE_FOOT:
-    return inSqMeters / 0.092903;
-  case ACRE:
-    return inSqMeters / 4046.86;
-  case HECTARE:
-    return inSqMeters / 10000.0;
-  default:
-    return ERR;
+  if (unit.toSI.offset != 0.0L && (affine || terms > 1)) {
+    error = "degC and degF can only be converted on their own";
+    return false;
   }
+  return true;
 }
 
-double ConvertSpeed(int fromUnit, int toUnit, double value) {
-  // Convert to meters per second
-  double inMps = 0.0;
-  switch (fromUnit) {
-  case METER_PER_SECOND:
-    inMps = value;
-    break;
-  case KILOMETER_PER_HOUR:
-    inMps = value / 3.6;
-    break;
-  case MILE_PER_HOUR:
-    inMps = value * 0.44704;
-    break;
-  case KNOT:
-    inMps = value * 0.514444;
-    break;
-  default:
-    return ERR;
+// Formats a dimension vector as SI base units, e.g. "m*s^-1"
+std::string FormatDimension(const DimensionVector &dimension) {
+  std::string text;
+  for (int d = 0; d < DIMENSION_COUNT; ++d) {
+    if (dimension[d] == 0)
+      continue;
+    if (!text.empty())
+      text += '*';
+    text += DimensionSymbols[d];
+    if (dimension[d] != 1)
+      text += '^' + std::to_string(dimension[d]);
   }
+  return text.empty() ? "1" : text;
+}
 
-  // Convert from meters per second
-  switch (toUnit) {
-  case METER_PER_SECOND:
-    return inMps;
-  case KILOMETER_PER_HOUR:
-    return inMps * 3.6;
-  case MILE_PER_HOUR:
-    return inMps / 0.44704;
-  case KNOT:
-    return inMps / 0.514444;
-  default:
-    return ERR;
+struct ResolvedConversion {
+  bool ok = false;
+  Affine affine;
+  std::string error;
+};
+
+struct UnitPairHash {
+  using is_transparent = void;
+  size_t operator()(std::pair<std::string_view, std::string_view> key) const {
+    std::hash<std::string_view> hash;
+    return hash(key.first) * 31 + hash(key.second);
   }
+};
+
+struct UnitPairEqual {
+  using is_transparent = void;
+  bool operator()(std::pair<std::string_view, std::string_view> a,
+                  std::pair<std::string_view, std::string_view> b) const {
+    return a == b;
+  }
+};
+
+// Resolves "from -> to" once per pair (including failures, so a typo isn't
+// re-parsed every frame); after that a lookup is one hash probe. The result
+// stays valid until the next call. Not thread-safe, it is only used by the UI.
+const ResolvedConversion &ResolveConversion(std::string_view from,
+                                            std::string_view to) {
+  constexpr size_t MAX_CACHED = 4096;
+  static std::unordered_map<std::pair<std::string, std::string>,
+                            ResolvedConversion, UnitPairHash, UnitPairEqual>
+      cache;
+
+  auto it = cache.find(std::pair{from, to});
+  if (it != cache.end())
+    return it->second;
+
+  if (cache.size() >= MAX_CACHED)
+    cache.clear();
+
+  ResolvedConversion resolved;
+  CompositeUnit source, target;
+  if (!ParseUnit(from, source, resolved.error)) {
+    resolved.error = "From: " + resolved.error;
+  } else if (!ParseUnit(to, target, resolved.error)) {
+    resolved.error = "To: " + resolved.error;
+  } else if (source.dimension != target.dimension) {
+    resolved.error = "Incompatible units: " +
+                     FormatDimension(source.dimension) + " vs " +
+                     FormatDimension(target.dimension);
+  } else {
+    resolved.ok = true;
+    resolved.affine = ComposeUnit(source.toSI, target.toSI);
+  }
+  return cache
+      .emplace(std::pair{std::string(from), std::string(to)},
+               std::move(resolved))
+      .first->second;
 }
 
-double ConvertTime(int fromUnit, int toUnit, double value) {
-  // Convert to seconds
-  double inSeconds = 0.0;
-  switch (fromUnit) {
-  case MILLISECOND:
-    inSeconds = value / 1000.0;
-    break;
-  case SECOND:
-    inSeconds = value;
-    break;
-  case MINUTE:
-    inSeconds = value * 60.0;
-    break;
-  case HOUR:
-    inSeconds = value * 3600.0;
-    break;
-  case DAY:
-    inSeconds = value * 86400.0;
-    break;
-  case WEEK:
-    inSeconds = value * 604800.0;
-    break;
-  case MONTH:
-    inSeconds = value * 2629800.0;
-    break; // ~30.44 days
-  case YEAR:
-    inSeconds = value * 31557600.0;
-    break; // 365.25 days
-  default:
-    return ERR;
+// Case-insensitive lookup over a fixed list of unit names and their optional
+// symbols. A query is split into words that must all occur in the name or
+// symbol ("mile hour" and "mph" both find MILE_PER_HOUR). Candidates come
+// from the rarest trigram of the query; a query with only one- or two-letter
+// words checks every name.
+class UnitSearchIndex {
+public:
+  UnitSearchIndex(const char **names, int count,
+                  const char *const *symbols = nullptr)
+      : names(names) {
+    for (int id = 0; id < count; ++id) {
+      std::string name = Lowercase(names[id]);
+      if (symbols)
+        name += ' ' + Lowercase(symbols[id]);
+      for (size_t i = 0; i + 3 <= name.size(); ++i) {
+        std::vector<int> &ids = trigrams[Trigram(name.data() + i)];
+        if (ids.empty() || ids.back() != id)
+          ids.push_back(id);
+      }
+      lowered.push_back(std::move(name));
+    }
   }
 
-  // Convert from seconds
-  switch (toUnit) {
-  case MILLISECOND:
-    return inSeconds * 1000.0;
-  case SECOND:
-    return inSeconds;
-  case MINUTE:
-    return inSeconds / 60.0;
-  case HOUR:
-    return inSeconds / 3600.0;
-  case DAY:
-    return inSeconds / 86400.0;
-  case WEEK:
-    return inSeconds / 604800.0;
-  case MONTH:
-    return inSeconds / 2629800.0;
-  case YEAR:
-    return inSeconds / 31557600.0;
-  default:
-    return ERR;
+  const char *name(int id) const { return names[id]; }
+
+  // Ids that may match all words, every id if no word has a trigram
+  std::vector<int> candidates(const std::vector<std::string> &words) const {
+    const std::vector<int> *rarest = nullptr;
+    for (const std::string &word : words) {
+      for (size_t i = 0; i + 3 <= word.size(); ++i) {
+        auto it = trigrams.find(Trigram(word.data() + i));
+        if (it == trigrams.end())
+          return {};
+        if (!rarest || it->second.size() < rarest->size())
+          rarest = &it->second;
+      }
+    }
+    if (rarest)
+      return *rarest;
+
+    std::vector<int> ids(lowered.size());
+    std::iota(ids.begin(), ids.end(), 0);
+    return ids;
+  }
+
+  bool matches(int id, const std::vector<std::string> &words) const {
+    for (const std::string &word : words)
+      if (lowered[id].find(word) == std::string::npos)
+        return false;
+    return true;
+  }
+
+  static std::string Lowercase(std::string_view text) {
+    std::string lower(text);
+    for (char &c : lower)
+      c = (char)tolower((unsigned char)c);
+    return lower;
+  }
+
+private:
+  static uint32_t Trigram(const char *p) {
+    return (uint32_t)(unsigned char)p[0] << 16 |
+           (uint32_t)(unsigned char)p[1] << 8 | (unsigned char)p[2];
+  }
+
+  const char **names;
+  std::vector<std::string> lowered;
+  std::unordered_map<uint32_t, std::vector<int>> trigrams;
+};
+
+// Type-ahead state of a unit combo. Candidates are verified a slice at a time
+// so even a huge index never takes more than the budget out of a frame;
+// matches found so far are shown while the rest are checked next frame.
+class UnitFilter {
+public:
+  std::string query;
+
+  void restart(const UnitSearchIndex &searchIndex) {
+    index = &searchIndex;
+    words.clear();
+    std::string lower = UnitSearchIndex::Lowercase(query);
+    for (size_t i = 0; i < lower.size();) {
+      size_t end = lower.find_first_of(" _", i);
+      if (end == std::string::npos)
+        end = lower.size();
+      if (end > i)
+        words.push_back(lower.substr(i, end - i));
+      i = end + 1;
+    }
+    candidates = index->candidates(words);
+    next = 0;
+    found.clear();
+  }
+
+  void step(std::chrono::microseconds budget) {
+    auto deadline = std::chrono::steady_clock::now() + budget;
+    while (next < candidates.size()) {
+      int id = candidates[next++];
+      if (index->matches(id, words))
+        found.push_back(id);
+      if (next % 64 == 0 && std::chrono::steady_clock::now() >= deadline)
+        break;
+    }
+  }
+
+  bool done() const { return next == candidates.size(); }
+  const std::vector<int> &matches() const { return found; }
+
+private:
+  const UnitSearchIndex *index = nullptr;
+  std::vector<std::string> words;
+  std::vector<int> candidates;
+  size_t next = 0;
+  std::vector<int> found;
+};
+
+constexpr auto FILTER_BUDGET = std::chrono::microseconds(500);
+
+// Combo with a filter box on top; only the visible rows are submitted
+void UnitCombo(const char *label, const UnitSearchIndex &index, int &selected,
+               UnitFilter &filter) {
+  if (!ImGui::BeginCombo(label, index.name(selected)))
+    return;
+
+  if (ImGui::IsWindowAppearing()) {
+    filter.query.clear();
+    filter.restart(index);
+    ImGui::SetKeyboardFocusHere();
+  }
+  if (InputTextString("##filter", &filter.query))
+    filter.restart(index);
+  filter.step(FILTER_BUDGET);
+
+  const std::vector<int> &matches = filter.matches();
+  ImGuiListClipper clipper;
+  clipper.Begin((int)matches.size());
+  while (clipper.Step()) {
+    for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; ++row) {
+      int id = matches[row];
+      bool isSelected = (selected == id);
+      if (ImGui::Selectable(index.name(id), isSelected))
+        selected = id;
+      if (isSelected)
+        ImGui::SetItemDefaultFocus();
+    }
   }
+  clipper.End();
+  if (!filter.done())
+    ImGui::TextDisabled("Searching...");
+
+  ImGui::EndCombo();
 }
 
-double ConvertCurrency(int fromUnit, int toUnit, double value) {
-  // Example static exchange rates relative to USD
-  static const double exchangeRates[CURRENCY_UNITS_COUNT] = {
-      1.0,   // USD
-      0.85,  // EUR
-      110.0, // JPY
-      0.75,  // GBP
-      6.5,   // CNY
-      1.35,  // AUD
-      1.25,  // CAD
-      0.92   // CHF
-  };
+struct CsvJob {
+  ConversionType type;
+  int fromUnit;
+  int toUnit;
+  std::vector<bool> columns; // columns[i] is set if column i is converted
+};
 
-  if (fromUnit < 0 || fromUnit >= CURRENCY_UNITS_COUNT || toUnit < 0 ||
-      toUnit >= CURRENCY_UNITS_COUNT) {
-    return ERR;
+// Converts the selected columns of [begin, end), which holds whole lines.
+// Numbers are parsed and printed straight from/into the buffers; fields that
+// are not plain numbers (headers, quoted text, blanks) are copied unchanged.
+void ConvertCsvLines(const CsvJob &job, const char *begin, const char *end,
+                     std::string &out) {
+  out.clear();
+  out.reserve((end - begin) + (end - begin) / 4);
+
+  size_t column = 0;
+  const char *p = begin;
+  while (p < end) {
+    const char *field = p;
+    if (*p == '"') { // skip over commas inside quotes ("" is an escaped quote)
+      for (++p; p < end; ++p) {
+        if (*p == '"') {
+          if (p + 1 < end && p[1] == '"')
+            ++p;
+          else
+            break;
+        }
+      }
+    }
+    while (p < end && *p != ',' && *p != '\n')
+      ++p;
+
+    const char *fieldEnd = p;
+    if (fieldEnd > field && fieldEnd[-1] == '\r')
+      --fieldEnd;
+
+    bool converted = false;
+    if (column < job.columns.size() && job.columns[column]) {
+      double value;
+      auto [ptr, ec] = std::from_chars(field, fieldEnd, value);
+      if (ec == std::errc() && ptr == fieldEnd && fieldEnd > field) {
+        char number[32];
+        auto result = std::to_chars(
+            number, number + sizeof(number),
+            Convert(job.type, job.fromUnit, job.toUnit, value));
+        out.append(number, result.ptr);
+        out.append(fieldEnd, p); // keep a trailing \r
+        converted = true;
+      }
+    }
+    if (!converted)
+      out.append(field, p);
+
+    if (p < end) {
+      column = *p == '\n' ? 0 : column + 1;
+      out += *p++;
+    }
+  }
+}
+
+// Finds where the records of [data, data + size) end: a record ends at a
+// newline outside double quotes, so quoted fields may span lines. Each of
+// the ascending offsets in splits is moved to the first record end at or
+// after it (or to size if there is none); returns the end of the last whole
+// record, 0 if there is none.
+size_t FindRecordEnds(const char *data, size_t size,
+                      std::vector<size_t> &splits) {
+  const char *p = data, *end = data + size;
+  size_t last = 0, next = 0;
+  while (p < end) {
+    const char *quote = (const char *)memchr(p, '"', end - p);
+    const char *plain = quote ? quote : end; // [p, plain) is outside quotes
+    for (; next < splits.size(); ++next) {
+      const char *from = std::max(p, data + splits[next]);
+      if (from >= plain)
+        break;
+      const char *newline = (const char *)memchr(from, '\n', plain - from);
+      if (!newline)
+        break;
+      splits[next] = newline + 1 - data;
+    }
+    std::string_view run(p, plain - p);
+    if (size_t newline = run.rfind('\n'); newline != run.npos)
+      last = (p - data) + newline + 1;
+    if (!quote)
+      break;
+    // A "" escape closes the field and reopens it, which changes nothing
+    const char *close = (const char *)memchr(quote + 1, '"', end - quote - 1);
+    if (!close)
+      break;
+    p = close + 1;
+  }
+  for (; next < splits.size(); ++next)
+    splits[next] = size;
+  return last;
+}
+
+// Headless mode: streams in through fixed-size chunks, splits every chunk at
+// record boundaries into one piece per thread and writes the pieces in
+// order, so memory stays bounded by the chunk size regardless of the file
+// size. A record may span chunks, up to MAX_RECORD bytes.
+int RunCsv(const CsvJob &job, FILE *in, FILE *out, unsigned threads) {
+  constexpr size_t CHUNK = 16 << 20;
+  // Longest record carried over; past it a quote was most likely never
+  // closed, and carrying on would read the rest of the file into memory
+  constexpr size_t MAX_RECORD = 4 * CHUNK;
+
+  std::vector<char> buffer(CHUNK);
+  std::vector<std::string> pieces(threads);
+  std::vector<size_t> splits(threads - 1);
+  size_t carry = 0; // bytes of an incomplete record kept from the last chunk
+  size_t total = 0, lines = 0;
+  auto start = std::chrono::steady_clock::now();
+
+  while (true) {
+    if (carry == buffer.size()) { // a single record longer than the buffer
+      if (buffer.size() >= MAX_RECORD) {
+        fflush(out);
+        std::cerr << "Line " << lines + 1 << ": record longer than "
+                  << (MAX_RECORD >> 20) << " MiB (unclosed quote?)\n";
+        return 1;
+      }
+      buffer.resize(buffer.size() * 2);
+    }
+    size_t read = fread(buffer.data() + carry, 1, buffer.size() - carry, in);
+    size_t size = carry + read;
+    if (size == 0)
+      break;
+
+    const char *data = buffer.data();
+    for (unsigned t = 0; t + 1 < threads; ++t)
+      splits[t] = size * (t + 1) / threads;
+    size_t complete = FindRecordEnds(data, size, splits);
+    if (read == 0) { // at EOF the last record may lack a newline
+      complete = size;
+    } else if (complete == 0) {
+      carry = size;
+      continue;
+    }
+
+    std::vector<std::thread> workers;
+    const char *pieceBegin = data;
+    for (unsigned t = 0; t < threads; ++t) {
+      const char *pieceEnd = data + complete;
+      if (t + 1 < threads)
+        pieceEnd = data + std::min(splits[t], complete);
+      workers.emplace_back(ConvertCsvLines, std::cref(job), pieceBegin,
+                           pieceEnd, std::ref(pieces[t]));
+      pieceBegin = pieceEnd;
+    }
+    for (std::thread &worker : workers)
+      worker.join();
+    for (const std::string &piece : pieces)
+      fwrite(piece.data(), 1, piece.size(), out);
+
+    total += complete;
+    lines += std::count(data, data + complete, '\n');
+    carry = size - complete;
+    memmove(buffer.data(), data + complete, carry);
+    if (read == 0)
+      break;
   }
+  fflush(out);
+
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  std::cerr << total << " bytes in " << seconds << "s ("
+            << (seconds > 0 ? total / seconds / 1e6 : 0) << " MB/s, "
+            << threads << " threads)\n";
+  return ferror(in) || ferror(out) ? 1 : 0;
+}
 
-  // Convert from source currency to USD
-  double inUSD = value / exchangeRates[fromUnit];
+// Stress mode: writer threads keep swapping in new exchange rate tables
+// while reader threads convert at full rate through both the scalar and the
+// bulk path. Every table scales currency i by (i + 1) times its own factor,
+// so any whole table converts 3 from f to t into 3 * (f + 1) / (t + 1);
+// anything else means a reader saw a torn or freed table.
+int RunRatesStress(unsigned readers, unsigned swaps) {
+  constexpr unsigned WRITERS = 2;
+  constexpr size_t BULK = 256;
 
-  // Convert from USD to target currency
-  return inUSD * exchangeRates[toUnit];
+  std::atomic<unsigned> writing{WRITERS};
+  std::atomic<uint64_t> conversions{0}, mismatches{0};
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (unsigned w = 0; w < WRITERS; ++w)
+    threads.emplace_back([&writing, w, swaps] {
+      UnitScale units[CURRENCY_UNITS_COUNT];
+      for (unsigned s = 0; s < swaps; ++s) {
+        long double factor = 1.0L + (s * WRITERS + w) % 1000 / 7.0L;
+        for (int i = 0; i < CURRENCY_UNITS_COUNT; ++i)
+          units[i] = {factor * (i + 1)};
+        PublishRates(std::make_unique<const AffineMatrix>(
+            ComposeUnits(units, CURRENCY_UNITS_COUNT)));
+      }
+      --writing;
+    });
+  for (unsigned r = 0; r < readers; ++r)
+    threads.emplace_back([&writing, &conversions, &mismatches] {
+      std::vector<double> in(BULK, 3.0), out(BULK);
+      uint64_t count = 0, bad = 0;
+      auto check = [&bad](double value, int from, int to) {
+        double expected = 3.0 * (from + 1) / (to + 1);
+        if (!(std::fabs(value - expected) <= 1e-12 * expected))
+          ++bad;
+      };
+      do {
+        for (int from = 0; from < CURRENCY_UNITS_COUNT; ++from) {
+          for (int to = 0; to < CURRENCY_UNITS_COUNT; ++to) {
+            check(Convert(CURRENCY, from, to, 3.0), from, to);
+            Convert(CURRENCY, from, to, in, out);
+            check(out[0], from, to);
+            check(out[BULK - 1], from, to);
+            count += 1 + BULK;
+          }
+        }
+      } while (writing > 0);
+      conversions += count;
+      mismatches += bad;
+    });
+  for (std::thread &thread : threads)
+    thread.join();
+
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  std::cerr << WRITERS * swaps << " swaps, " << conversions
+            << " conversions in " << seconds << "s ("
+            << (seconds > 0 ? conversions / seconds / 1e6 : 0) << " M/s, "
+            << readers << " readers), " << mismatches << " mismatches\n";
+  return mismatches > 0 ? 1 : 0;
 }
 
-// see *ConversionUnits enums for unit indices
-double Convert(ConversionType type, int fromUnit, int toUnit, double value) {
-  static const std::array<ConverterFunc, CONVERSION_TYPE_COUNT> converters = {
-      ConvertLength, ConvertWeight, ConvertTemperature, ConvertVolume,
-      ConvertArea,   ConvertSpeed,  ConvertTime,        ConvertCurrency};
+// Runs fn repeatedly for at least a quarter of a second; returns the
+// average seconds per run
+template <typename F> double TimePerRun(F &&fn) {
+  auto start = std::chrono::steady_clock::now();
+  std::chrono::duration<double> elapsed{};
+  long runs = 0;
+  while (elapsed.count() < 0.25) {
+    fn();
+    ++runs;
+    elapsed = std::chrono::steady_clock::now() - start;
+  }
+  return elapsed.count() / runs;
+}
 
-  if (type < 0 || type >= CONVERSION_TYPE_COUNT) {
-    return ERR;
+// Benchmark mode: single conversions of random unit pairs through the
+// composed tables, against the way they were done before them (a
+// std::function per type converting to the base unit and out of it again,
+// as the old switch cascades did), then the throughput of each bulk kernel
+// this CPU supports on a column that fits in cache and on one that doesn't
+// (input plus output bytes per second)
+int RunBench() {
+  constexpr size_t CALLS = 4096;
+  constexpr size_t SIZES[] = {4 << 10, 16 << 20};
+
+  struct Call {
+    ConversionType type;
+    int from, to;
+    double value;
+  };
+  std::vector<Call> calls(CALLS);
+  uint32_t seed = 1;
+  for (Call &call : calls) {
+    // xorshift32
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    call.type = (ConversionType)(seed % CONVERSION_TYPE_COUNT);
+    call.from = (int)(seed >> 8) % UnitCounts[call.type];
+    call.to = (int)(seed >> 16) % UnitCounts[call.type];
+    call.value = (double)(seed % 1000);
   }
+  std::function<double(int, int, double)> twoStep[CONVERSION_TYPE_COUNT];
+  for (int type = 0; type < CONVERSION_TYPE_COUNT; ++type)
+    twoStep[type] = [type](int from, int to, double value) {
+      const UnitScale &f = ToBase[type][from], &t = ToBase[type][to];
+      double base = value * (double)f.scale + (double)f.offset;
+      return (base - (double)t.offset) / (double)t.scale;
+    };
+  volatile double sink = 0; // keeps the calls from being optimized away
+  double before = TimePerRun([&] {
+    double sum = 0;
+    for (const Call &call : calls)
+      sum += twoStep[call.type](call.from, call.to, call.value);
+    sink = sink + sum;
+  });
+  double after = TimePerRun([&] {
+    double sum = 0;
+    for (const Call &call : calls)
+      sum += Convert(call.type, call.from, call.to, call.value);
+    sink = sink + sum;
+  });
+  std::cout << "single, two steps through std::function: "
+            << CALLS / before / 1e6 << "M calls/s\n"
+            << "single, composed table: " << CALLS / after / 1e6
+            << "M calls/s\n";
 
-  return converters[type](fromUnit, toUnit, value);
+  struct Kernel {
+    const char *name;
+    BulkKernel kernel;
+  };
+  std::vector<Kernel> kernels = {{"scalar", ConvertScalar}};
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2"))
+    kernels.push_back({"sse2", ConvertSSE2});
+  if (__builtin_cpu_supports("avx2"))
+    kernels.push_back({"avx2", ConvertAVX2});
+#endif
+
+  const Affine &affine = Conversions[TEMPERATURE][FAHRENHEIT][CELSIUS];
+  for (size_t size : SIZES) {
+    std::vector<double> in(size), out(size);
+    for (size_t i = 0; i < size; ++i)
+      in[i] = (double)(i % 1000) - 500.0;
+    for (const Kernel &kernel : kernels) {
+      double seconds = TimePerRun(
+          [&] { kernel.kernel(affine, in.data(), out.data(), size); });
+      std::cout << "bulk " << kernel.name << ", " << size << " values: "
+                << 2 * size * sizeof(double) / seconds / 1e9 << " GB/s\n";
+    }
+  }
+  return 0;
 }
 
-int main() {
+int main(int argc, char **argv) {
+  if (argc > 1 && strcmp(argv[1], "--bench") == 0)
+    return RunBench();
+
+  if (argc > 1 && strcmp(argv[1], "--stress-rates") == 0) {
+    unsigned readers = std::max(1u, std::thread::hardware_concurrency());
+    unsigned swaps = 20000; // per writer; every swap retires a ~1KB table
+    for (int i = 2; i + 1 < argc; i += 2) {
+      if (strcmp(argv[i], "--threads") == 0)
+        readers = std::max(1, atoi(argv[i + 1]));
+      else if (strcmp(argv[i], "--swaps") == 0)
+        swaps = std::max(1, atoi(argv[i + 1]));
+    }
+    return RunRatesStress(readers, swaps);
+  }
+
+  if (argc > 1 && strcmp(argv[1], "--csv") == 0) {
+    if (argc < 6) {
+      std::cerr << "Usage: converter --csv TYPE FROM TO COLUMNS [--threads N] "
+                   "[input] [output]\n"
+                   "Fields in double quotes may contain commas and line "
+                   "breaks.\n";
+      return 1;
+    }
+
+    CsvJob job;
+    int type = FindName(ConversionTypes, CONVERSION_TYPE_COUNT, argv[2]);
+    if (type < 0) {
+      std::cerr << "Unknown conversion type " << argv[2] << "\n";
+      return 1;
+    }
+    job.type = (ConversionType)type;
+    job.fromUnit = FindName(UnitStrings[type], UnitCounts[type], argv[3]);
+    job.toUnit = FindName(UnitStrings[type], UnitCounts[type], argv[4]);
+    if (job.fromUnit < 0 || job.toUnit < 0) {
+      std::cerr << "Unknown " << argv[2] << " unit "
+                << (job.fromUnit < 0 ? argv[3] : argv[4]) << "\n";
+      return 1;
+    }
+    // Zero-based column indices, e.g. "1,3"
+    for (const char *p = argv[5]; *p;) {
+      char *next;
+      long column = strtol(p, &next, 10);
+      if (next == p || column < 0) {
+        std::cerr << "Invalid column list " << argv[5] << "\n";
+        return 1;
+      }
+      if ((size_t)column >= job.columns.size())
+        job.columns.resize(column + 1);
+      job.columns[column] = true;
+      p = *next == ',' ? next + 1 : next;
+    }
+
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    const char *paths[2] = {nullptr, nullptr};
+    int pathCount = 0;
+    for (int i = 6; i < argc; ++i) {
+      if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        threads = std::max(1, atoi(argv[++i]));
+      else if (pathCount < 2)
+        paths[pathCount++] = argv[i];
+    }
+
+    FILE *in = paths[0] ? fopen(paths[0], "rb") : stdin;
+    if (!in) {
+      std::cerr << "Could not open " << paths[0] << "\n";
+      return 1;
+    }
+    FILE *out = paths[1] ? fopen(paths[1], "wb") : stdout;
+    if (!out) {
+      std::cerr << "Could not open " << paths[1] << "\n";
+      return 1;
+    }
+    if (job.type == CURRENCY)
+      LoadRates(RATES_PATH); // rates are fixed for the whole run
+    int status = RunCsv(job, in, out, threads);
+    if (paths[0])
+      fclose(in);
+    if (paths[1] && fclose(out) != 0)
+      status = 1;
+    return status;
+  }
+
   SetConfigFlags(FLAG_WINDOW_RESIZABLE);
   InitWindow(800, 600, "Unit Converter");
   SetWindowMinSize(640, 480);
@@ -482,9 +1262,19 @@ int main() {
 
   ImGui::GetStyle().FontScaleMain = 2;
 
+  std::jthread ratesWatcher(WatchRates, RATES_PATH);
+
   static int selectedFrom[CONVERSION_TYPE_COUNT] = {0};
   static int selectedTo[CONVERSION_TYPE_COUNT] = {0};
   static double value[CONVERSION_TYPE_COUNT] = {0.0};
+  std::vector<UnitSearchIndex> unitIndexes;
+  for (int i = 0; i < CONVERSION_TYPE_COUNT; ++i)
+    unitIndexes.emplace_back(UnitStrings[i], UnitCounts[i],
+                             i < CURRENCY ? UnitSymbols[i] : nullptr);
+  UnitFilter unitFilter; // only one combo can be open at a time
+  std::string compositeFrom = "km/h";
+  std::string compositeTo = "m/s";
+  double compositeValue = 0.0;
 
   while (!WindowShouldClose()) {
     BeginDrawing();
@@ -504,30 +1294,12 @@ int main() {
             // From combo
             ImGui::Text("From:");
             ImGui::SameLine();
-            if (ImGui::BeginCombo("##from", UnitStrings[i][selectedFrom[i]])) {
-              for (int j = 0; j < UnitCounts[i]; ++j) {
-                bool isSelected = (selectedFrom[i] == j);
-                if (ImGui::Selectable(UnitStrings[i][j], isSelected))
-                  selectedFrom[i] = j;
-                if (isSelected)
-                  ImGui::SetItemDefaultFocus();
-              }
-              ImGui::EndCombo();
-            }
+            UnitCombo("##from", unitIndexes[i], selectedFrom[i], unitFilter);
 
             // To combo
             ImGui::Text("To:");
             ImGui::SameLine();
-            if (ImGui::BeginCombo("##to", UnitStrings[i][selectedTo[i]])) {
-              for (int j = 0; j < UnitCounts[i]; ++j) {
-                bool isSelected = (selectedTo[i] == j);
-                if (ImGui::Selectable(UnitStrings[i][j], isSelected))
-                  selectedTo[i] = j;
-                if (isSelected)
-                  ImGui::SetItemDefaultFocus();
-              }
-              ImGui::EndCombo();
-            }
+            UnitCombo("##to", unitIndexes[i], selectedTo[i], unitFilter);
 
             // Value input
             ImGui::InputDouble("Value", &value[i]);
@@ -541,6 +1313,26 @@ int main() {
             ImGui::EndTabItem();
           }
         }
+        if (ImGui::BeginTabItem("COMPOSITE")) {
+          ImGui::Text("From:");
+          ImGui::SameLine();
+          InputTextString("##from", &compositeFrom);
+          ImGui::Text("To:");
+          ImGui::SameLine();
+          InputTextString("##to", &compositeTo);
+          ImGui::InputDouble("Value", &compositeValue);
+
+          const ResolvedConversion &resolved =
+              ResolveConversion(compositeFrom, compositeTo);
+          if (resolved.ok)
+            ImGui::LabelText("Result", "%.6g",
+                             compositeValue * resolved.affine.scale +
+                                 resolved.affine.offset);
+          else
+            ImGui::LabelText("Result", "%s", resolved.error.c_str());
+
+          ImGui::EndTabItem();
+        }
         ImGui::EndTabBar();
       }
       ImGui::End();
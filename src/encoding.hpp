@@ -0,0 +1,493 @@
+#pragma once
+
+#include "piece_table.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// Documents are edited as UTF-8; files in other encodings are converted to
+// it when opened and back when saved
+typedef enum Encoding {
+  ENCODING_UTF8 = 0,
+  ENCODING_UTF8_BOM,
+  ENCODING_UTF16LE,
+  ENCODING_UTF16BE,
+  ENCODING_LATIN1,
+  ENCODING_COUNT,
+} Encoding;
+
+inline const char *EncodingNames[] = {"UTF-8", "UTF-8 with BOM", "UTF-16 LE",
+                                      "UTF-16 BE", "Latin-1"};
+
+// Stands in for anything that can't be decoded
+constexpr uint32_t REPLACEMENT_CHARACTER = 0xFFFD;
+
+inline std::string_view ByteOrderMark(Encoding encoding) {
+  switch (encoding) {
+  case ENCODING_UTF8_BOM:
+    return "\xEF\xBB\xBF";
+  case ENCODING_UTF16LE:
+    return "\xFF\xFE";
+  case ENCODING_UTF16BE:
+    return "\xFE\xFF";
+  default:
+    return {};
+  }
+}
+
+inline void AppendUtf8(std::string &out, uint32_t c) {
+  if (c < 0x80) {
+    out += (char)c;
+  } else if (c < 0x800) {
+    out += (char)(0xC0 | c >> 6);
+    out += (char)(0x80 | (c & 0x3F));
+  } else if (c < 0x10000) {
+    out += (char)(0xE0 | c >> 12);
+    out += (char)(0x80 | (c >> 6 & 0x3F));
+    out += (char)(0x80 | (c & 0x3F));
+  } else {
+    out += (char)(0xF0 | c >> 18);
+    out += (char)(0x80 | (c >> 12 & 0x3F));
+    out += (char)(0x80 | (c >> 6 & 0x3F));
+    out += (char)(0x80 | (c & 0x3F));
+  }
+}
+
+// Decodes the UTF-8 character at the start of [data, data + size) into c and
+// returns its length. A malformed one (overlong, a surrogate, past U+10FFFF
+// or a stray byte) decodes to REPLACEMENT_CHARACTER with length 1; one cut
+// off by the end of the data returns 0.
+inline size_t DecodeUtf8(const char *data, size_t size, uint32_t &c) {
+  const unsigned char *s = (const unsigned char *)data;
+  size_t length;
+  uint32_t min;
+  if (s[0] < 0x80) {
+    c = s[0];
+    return 1;
+  } else if (s[0] >= 0xC2 && s[0] <= 0xDF) {
+    length = 2;
+    c = s[0] & 0x1F;
+    min = 0x80;
+  } else if (s[0] >= 0xE0 && s[0] <= 0xEF) {
+    length = 3;
+    c = s[0] & 0x0F;
+    min = 0x800;
+  } else if (s[0] >= 0xF0 && s[0] <= 0xF4) {
+    length = 4;
+    c = s[0] & 0x07;
+    min = 0x10000;
+  } else {
+    c = REPLACEMENT_CHARACTER;
+    return 1;
+  }
+  for (size_t i = 1; i < length; ++i) {
+    if (i == size)
+      return 0;
+    if ((s[i] & 0xC0) != 0x80) {
+      c = REPLACEMENT_CHARACTER;
+      return 1;
+    }
+    c = c << 6 | (s[i] & 0x3F);
+  }
+  if (c < min || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF)) {
+    c = REPLACEMENT_CHARACTER;
+    return 1;
+  }
+  return length;
+}
+
+// ASCII scanning kernels: the sign bits of 16 or 32 bytes are tested at once,
+// so ASCII text, by far the most common, is skipped at memory speed
+inline size_t AsciiPrefixScalar(const char *data, size_t size) {
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    memcpy(&word, data + i, 8);
+    if (word & 0x8080808080808080ull)
+      break;
+  }
+  while (i < size && (unsigned char)data[i] < 0x80)
+    ++i;
+  return i;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2"))) inline size_t
+AsciiPrefixSSE2(const char *data, size_t size) {
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    __m128i bytes = _mm_loadu_si128((const __m128i *)(data + i));
+    if (_mm_movemask_epi8(bytes))
+      break;
+  }
+  return i + AsciiPrefixScalar(data + i, size - i);
+}
+
+__attribute__((target("avx2"))) inline size_t
+AsciiPrefixAVX2(const char *data, size_t size) {
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    __m256i bytes = _mm256_loadu_si256((const __m256i *)(data + i));
+    if (_mm256_movemask_epi8(bytes))
+      break;
+  }
+  return i + AsciiPrefixScalar(data + i, size - i);
+}
+#endif
+
+using AsciiPrefixKernel = size_t (*)(const char *, size_t);
+
+inline AsciiPrefixKernel SelectAsciiPrefix() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return AsciiPrefixAVX2;
+  if (__builtin_cpu_supports("sse2"))
+    return AsciiPrefixSSE2;
+#endif
+  return AsciiPrefixScalar;
+}
+
+// Length of the run of ASCII bytes at the start of [data, data + size)
+inline size_t AsciiPrefix(const char *data, size_t size) {
+  static const AsciiPrefixKernel kernel = SelectAsciiPrefix();
+  return kernel(data, size);
+}
+
+// UTF-16 narrowing kernels: copies UTF-16 code units to out as bytes for as
+// long as they are ASCII; returns how many were copied
+inline size_t NarrowAsciiScalar(const char *in, size_t units, bool bigEndian,
+                                char *out) {
+  const unsigned char *s = (const unsigned char *)in;
+  size_t i = 0;
+  for (; i < units; ++i) {
+    unsigned high = s[2 * i + !bigEndian], low = s[2 * i + bigEndian];
+    if (high != 0 || low >= 0x80)
+      break;
+    out[i] = (char)low;
+  }
+  return i;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2"))) inline size_t
+NarrowAsciiSSE2(const char *in, size_t units, bool bigEndian, char *out) {
+  const __m128i nonAscii = _mm_set1_epi16((short)0xFF80);
+  size_t i = 0;
+  for (; i + 8 <= units; i += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(in + 2 * i));
+    if (bigEndian)
+      v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+    __m128i ascii = _mm_cmpeq_epi16(_mm_and_si128(v, nonAscii),
+                                    _mm_setzero_si128());
+    if (_mm_movemask_epi8(ascii) != 0xFFFF)
+      break;
+    _mm_storel_epi64((__m128i *)(out + i), _mm_packus_epi16(v, v));
+  }
+  return i + NarrowAsciiScalar(in + 2 * i, units - i, bigEndian, out + i);
+}
+#endif
+
+using NarrowAsciiKernel = size_t (*)(const char *, size_t, bool, char *);
+
+inline NarrowAsciiKernel SelectNarrowAscii() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2"))
+    return NarrowAsciiSSE2;
+#endif
+  return NarrowAsciiScalar;
+}
+
+inline size_t NarrowAscii(const char *in, size_t units, bool bigEndian,
+                          char *out) {
+  static const NarrowAsciiKernel kernel = SelectNarrowAscii();
+  return kernel(in, units, bigEndian, out);
+}
+
+// True if [data, data + size) is well-formed UTF-8. ASCII runs are skipped
+// by the kernel, the rest is decoded character by character. truncated
+// allows the data to end partway through a character.
+inline bool IsValidUtf8(const char *data, size_t size, bool truncated) {
+  size_t i = 0;
+  while (i < size) {
+    i += AsciiPrefix(data + i, size - i);
+    if (i == size)
+      break;
+    uint32_t c;
+    size_t length = DecodeUtf8(data + i, size - i, c);
+    if (length == 0)
+      return truncated;
+    if (c == REPLACEMENT_CHARACTER && length == 1)
+      return false;
+    i += length;
+  }
+  return true;
+}
+
+// Guesses the encoding of a file from its first DETECT_BYTES, so even huge
+// files open at once. A byte order mark decides (bom is set to its length);
+// otherwise text with NULs in every other byte is taken as UTF-16, text
+// that is valid UTF-8 as UTF-8, and anything else as Latin-1.
+constexpr size_t DETECT_BYTES = 16 << 20;
+
+inline Encoding DetectEncoding(const char *data, size_t size, size_t &bom) {
+  std::string_view start(data, std::min<size_t>(size, 3));
+  for (Encoding encoding :
+       {ENCODING_UTF8_BOM, ENCODING_UTF16LE, ENCODING_UTF16BE}) {
+    if (start.starts_with(ByteOrderMark(encoding))) {
+      bom = ByteOrderMark(encoding).size();
+      return encoding;
+    }
+  }
+  bom = 0;
+
+  // ASCII-range text in UTF-16 has a NUL in every high byte
+  size_t sample = std::min<size_t>(size, 4096) & ~(size_t)1;
+  size_t evenNuls = 0, oddNuls = 0;
+  for (size_t i = 0; i < sample; i += 2) {
+    evenNuls += data[i] == 0;
+    oddNuls += data[i + 1] == 0;
+  }
+  size_t units = sample / 2;
+  if (units > 0 && oddNuls > units / 2 && evenNuls <= units / 16)
+    return ENCODING_UTF16LE;
+  if (units > 0 && evenNuls > units / 2 && oddNuls <= units / 16)
+    return ENCODING_UTF16BE;
+
+  size_t checked = std::min(size, DETECT_BYTES);
+  return IsValidUtf8(data, checked, checked < size) ? ENCODING_UTF8
+                                                    : ENCODING_LATIN1;
+}
+
+// Converts text in encoding to UTF-8, fed in chunks of any size: a
+// character cut off at the end of one chunk is completed by the next.
+// Undecodable input becomes REPLACEMENT_CHARACTER; UTF-8 passes through
+// as is.
+class Decoder {
+public:
+  explicit Decoder(Encoding encoding) : encoding(encoding) {}
+
+  // Appends chunk, decoded, to out
+  void write(std::string_view chunk, std::string &out) {
+    switch (encoding) {
+    case ENCODING_UTF16LE:
+    case ENCODING_UTF16BE:
+      writeUtf16(chunk, out);
+      break;
+    case ENCODING_LATIN1:
+      writeLatin1(chunk, out);
+      break;
+    default:
+      out.append(chunk);
+    }
+  }
+
+  // Flushes a character left incomplete at the end of the input
+  void finish(std::string &out) {
+    if (pending || high)
+      AppendUtf8(out, REPLACEMENT_CHARACTER);
+    pending = false;
+    high = 0;
+  }
+
+private:
+  Encoding encoding;
+  bool pending = false; // a code unit's first byte is in pendingByte
+  unsigned char pendingByte = 0;
+  uint32_t high = 0; // high surrogate waiting for its low half
+
+  void writeLatin1(std::string_view chunk, std::string &out) {
+    size_t i = 0;
+    while (i < chunk.size()) {
+      size_t ascii = AsciiPrefix(chunk.data() + i, chunk.size() - i);
+      out.append(chunk.data() + i, ascii);
+      i += ascii;
+      for (; i < chunk.size() && (unsigned char)chunk[i] >= 0x80; ++i)
+        AppendUtf8(out, (unsigned char)chunk[i]);
+    }
+  }
+
+  void writeUtf16(std::string_view chunk, std::string &out) {
+    bool bigEndian = encoding == ENCODING_UTF16BE;
+    const unsigned char *s = (const unsigned char *)chunk.data();
+    size_t i = 0;
+    if (pending && !chunk.empty()) {
+      unit(bigEndian ? pendingByte << 8 | s[0] : s[0] << 8 | pendingByte,
+           out);
+      pending = false;
+      i = 1;
+    }
+    char narrow[256];
+    while (i + 2 <= chunk.size()) {
+      uint32_t u = bigEndian ? s[i] << 8 | s[i + 1] : s[i + 1] << 8 | s[i];
+      if (u >= 0x80 || high) {
+        unit(u, out);
+        i += 2;
+        continue;
+      }
+      size_t units = std::min(sizeof(narrow), (chunk.size() - i) / 2);
+      size_t ascii = NarrowAscii(chunk.data() + i, units, bigEndian, narrow);
+      out.append(narrow, ascii);
+      i += 2 * ascii;
+    }
+    if (i < chunk.size()) {
+      pending = true;
+      pendingByte = s[i];
+    }
+  }
+
+  void unit(uint32_t u, std::string &out) {
+    if (high) {
+      if (u >= 0xDC00 && u <= 0xDFFF) {
+        AppendUtf8(out, 0x10000 + ((high - 0xD800) << 10) + (u - 0xDC00));
+        high = 0;
+        return;
+      }
+      AppendUtf8(out, REPLACEMENT_CHARACTER);
+      high = 0;
+    }
+    if (u >= 0xD800 && u <= 0xDBFF)
+      high = u;
+    else if (u >= 0xDC00 && u <= 0xDFFF)
+      AppendUtf8(out, REPLACEMENT_CHARACTER);
+    else
+      AppendUtf8(out, u);
+  }
+};
+
+// Converts UTF-8 text to encoding, fed in pieces of any size, starting with
+// the encoding's byte order mark. A character split between pieces is
+// completed by the next one; malformed UTF-8 becomes REPLACEMENT_CHARACTER,
+// and characters Latin-1 can't hold become '?'.
+class Encoder {
+public:
+  explicit Encoder(Encoding encoding) : encoding(encoding) {}
+
+  // Appends piece, encoded, to out
+  void write(std::string_view piece, std::string &out) {
+    if (!started) {
+      out.append(ByteOrderMark(encoding));
+      started = true;
+    }
+    if (encoding == ENCODING_UTF8 || encoding == ENCODING_UTF8_BOM) {
+      out.append(piece);
+      return;
+    }
+    size_t i = 0;
+    // Completes a character split off the end of the last piece
+    while (carried > 0 && i < piece.size()) {
+      carry[carried++] = piece[i++];
+      uint32_t c;
+      size_t length;
+      // A malformed start is replaced and the bytes after it retried
+      while (carried > 0 && (length = DecodeUtf8(carry, carried, c)) > 0) {
+        put(c, out);
+        carried -= length;
+        memmove(carry, carry + length, carried);
+      }
+    }
+    while (i < piece.size()) {
+      size_t ascii = AsciiPrefix(piece.data() + i, piece.size() - i);
+      if (encoding == ENCODING_LATIN1) {
+        out.append(piece.data() + i, ascii);
+      } else { // widened in place, the high byte is zero
+        size_t at = out.size();
+        out.resize(at + 2 * ascii);
+        bool bigEndian = encoding == ENCODING_UTF16BE;
+        for (size_t k = 0; k < ascii; ++k) {
+          out[at + 2 * k + bigEndian] = piece[i + k];
+          out[at + 2 * k + !bigEndian] = 0;
+        }
+      }
+      i += ascii;
+      if (i == piece.size())
+        break;
+      uint32_t c;
+      size_t length = DecodeUtf8(piece.data() + i, piece.size() - i, c);
+      if (length == 0) {
+        carried = piece.size() - i;
+        memcpy(carry, piece.data() + i, carried);
+        break;
+      }
+      put(c, out);
+      i += length;
+    }
+  }
+
+  // Flushes a character left incomplete at the end of the text
+  void finish(std::string &out) {
+    if (!started)
+      write({}, out);
+    if (carried > 0)
+      put(REPLACEMENT_CHARACTER, out);
+    carried = 0;
+  }
+
+private:
+  Encoding encoding;
+  bool started = false;
+  char carry[4];
+  size_t carried = 0;
+
+  void put(uint32_t c, std::string &out) {
+    switch (encoding) {
+    case ENCODING_LATIN1:
+      out += c <= 0xFF ? (char)c : '?';
+      break;
+    case ENCODING_UTF16LE:
+    case ENCODING_UTF16BE:
+      if (c >= 0x10000) {
+        c -= 0x10000;
+        putUnit(0xD800 + (c >> 10), out);
+        putUnit(0xDC00 + (c & 0x3FF), out);
+      } else {
+        putUnit(c, out);
+      }
+      break;
+    default:
+      AppendUtf8(out, c);
+    }
+  }
+
+  void putUnit(uint32_t u, std::string &out) {
+    char bytes[2] = {(char)(u & 0xFF), (char)(u >> 8)};
+    if (encoding == ENCODING_UTF16BE)
+      std::swap(bytes[0], bytes[1]);
+    out.append(bytes, 2);
+  }
+};
+
+// Appends file, from offset on, converted to UTF-8 to the end of table a
+// chunk at a time. The converted text only exists in the table's add blocks,
+// never as one string, and the OS is told to drop the pages already
+// converted as it goes.
+inline void DecodeFile(const MappedFile &file, size_t offset,
+                       Encoding encoding, PieceTable &table) {
+  constexpr size_t CHUNK = 1 << 20;
+  constexpr size_t RELEASE = 64 << 20;
+  std::string out;
+  Decoder decoder(encoding);
+  size_t released = offset;
+  for (size_t pos = offset; pos < file.size(); pos += CHUNK) {
+    size_t length = std::min(CHUNK, file.size() - pos);
+    out.clear();
+    decoder.write(std::string_view(file.data() + pos, length), out);
+    table.insert(table.size(), out);
+    if (pos + length - released >= RELEASE) {
+      file.release(released, pos + length - released);
+      released = pos + length;
+    }
+  }
+  out.clear();
+  decoder.finish(out);
+  table.insert(table.size(), out);
+}
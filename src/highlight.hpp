@@ -0,0 +1,508 @@
+#pragma once
+
+#include "piece_table.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+typedef enum Language {
+  LANGUAGE_NONE = 0,
+  LANGUAGE_CPP,
+  LANGUAGE_JSON,
+  LANGUAGE_LOG,
+  LANGUAGE_COUNT,
+} Language;
+
+inline const char *LanguageNames[] = {"Plain text", "C++", "JSON", "Log"};
+
+typedef enum TokenKind {
+  TOKEN_TEXT = 0,
+  TOKEN_KEYWORD,
+  TOKEN_TYPE,
+  TOKEN_NUMBER,
+  TOKEN_STRING,
+  TOKEN_COMMENT,
+  TOKEN_PREPROCESSOR,
+  TOKEN_KEY, // JSON object keys
+  TOKEN_TIMESTAMP,
+  TOKEN_ERROR,
+  TOKEN_WARNING,
+  TOKEN_INFO,
+  TOKEN_DEBUG,
+  TOKEN_KIND_COUNT,
+} TokenKind;
+
+// Picks the language from a file name's extension
+inline Language LanguageOf(std::string_view path) {
+  size_t dot = path.rfind('.');
+  if (dot == std::string_view::npos)
+    return LANGUAGE_NONE;
+  std::string ext(path.substr(dot + 1));
+  for (char &c : ext)
+    c = (char)tolower((unsigned char)c);
+  for (const char *cpp : {"c", "cc", "cpp", "cxx", "h", "hh", "hpp", "hxx"})
+    if (ext == cpp)
+      return LANGUAGE_CPP;
+  if (ext == "json")
+    return LANGUAGE_JSON;
+  if (ext == "log")
+    return LANGUAGE_LOG;
+  return LANGUAGE_NONE;
+}
+
+struct TokenSpan {
+  uint32_t begin, end; // bytes of the line
+  TokenKind kind;
+};
+
+// Lexer state at a line start; one byte so the per-line cache stays small
+using LexState = uint8_t;
+
+// Lexers: each styles one line (without its '\n') starting in state and
+// returns the state the next line starts in. Spans cover the line in order;
+// unstyled bytes are left out.
+namespace lexers {
+
+inline bool IsIdentStart(char c) {
+  return isalpha((unsigned char)c) || c == '_';
+}
+
+inline bool IsIdent(char c) { return isalnum((unsigned char)c) || c == '_'; }
+
+inline void Add(std::vector<TokenSpan> *spans, size_t begin, size_t end,
+                TokenKind kind) {
+  if (spans && begin < end)
+    spans->push_back({(uint32_t)begin, (uint32_t)end, kind});
+}
+
+// Digits, hex, exponents, suffixes and ' separators
+inline size_t NumberEnd(std::string_view line, size_t i) {
+  while (i < line.size() &&
+         (IsIdent(line[i]) || line[i] == '.' || line[i] == '\'' ||
+          ((line[i] == '+' || line[i] == '-') &&
+           (line[i - 1] | 0x20) == 'e')))
+    ++i;
+  return i;
+}
+
+// End of a quoted string or char starting at i; escaped is set if the line
+// ends inside it on a backslash, continuing it onto the next line
+inline size_t QuotedEnd(std::string_view line, size_t i, char quote,
+                        bool &escaped) {
+  escaped = false;
+  for (++i; i < line.size(); ++i) {
+    if (line[i] == '\\') {
+      if (i + 1 == line.size()) {
+        escaped = true;
+        return line.size();
+      }
+      ++i;
+    } else if (line[i] == quote) {
+      return i + 1;
+    }
+  }
+  return line.size();
+}
+
+inline bool IsWord(std::string_view word, const char *const *list,
+                   size_t count) {
+  return std::binary_search(list, list + count, word,
+                            [](std::string_view a, std::string_view b) {
+                              return a < b;
+                            });
+}
+
+// Sorted for binary search
+constexpr const char *CppKeywords[] = {
+    "alignas",      "alignof",     "asm",          "break",
+    "case",         "catch",       "class",        "co_await",
+    "co_return",    "co_yield",    "concept",      "const",
+    "const_cast",   "consteval",   "constexpr",    "constinit",
+    "continue",     "decltype",    "default",      "delete",
+    "do",           "dynamic_cast", "else",        "enum",
+    "explicit",     "export",      "extern",       "false",
+    "final",        "for",         "friend",       "goto",
+    "if",           "inline",      "mutable",      "namespace",
+    "new",          "noexcept",    "nullptr",      "operator",
+    "override",     "private",     "protected",    "public",
+    "register",     "reinterpret_cast", "requires", "return",
+    "sizeof",       "static",      "static_assert", "static_cast",
+    "struct",       "switch",      "template",     "this",
+    "thread_local", "throw",       "true",         "try",
+    "typedef",      "typeid",      "typename",     "union",
+    "using",        "virtual",     "volatile",     "while"};
+
+constexpr const char *CppTypes[] = {
+    "auto",     "bool",     "char",     "char16_t", "char32_t", "char8_t",
+    "double",   "float",    "int",      "int16_t",  "int32_t",  "int64_t",
+    "int8_t",   "long",     "ptrdiff_t", "short",   "signed",   "size_t",
+    "uint16_t", "uint32_t", "uint64_t", "uint8_t",  "unsigned", "void",
+    "wchar_t"};
+
+enum CppState : LexState {
+  CPP_NORMAL = 0,
+  CPP_BLOCK_COMMENT,
+  CPP_LINE_COMMENT, // a // comment continued by a trailing backslash
+  CPP_STRING,       // a string continued by a trailing backslash
+  CPP_RAW_STRING,
+  CPP_DIRECTIVE, // a preprocessor line continued by a trailing backslash
+};
+
+inline LexState LexCpp(LexState state, std::string_view line,
+                       std::vector<TokenSpan> *spans) {
+  size_t i = 0;
+  bool continued = !line.empty() && line.back() == '\\';
+  switch (state) {
+  case CPP_BLOCK_COMMENT: {
+    size_t end = line.find("*/");
+    if (end == std::string_view::npos) {
+      Add(spans, 0, line.size(), TOKEN_COMMENT);
+      return CPP_BLOCK_COMMENT;
+    }
+    Add(spans, 0, end + 2, TOKEN_COMMENT);
+    i = end + 2;
+    break;
+  }
+  case CPP_LINE_COMMENT:
+    Add(spans, 0, line.size(), TOKEN_COMMENT);
+    return continued ? CPP_LINE_COMMENT : CPP_NORMAL;
+  case CPP_STRING: {
+    bool escaped;
+    i = QuotedEnd(line, (size_t)-1, '"', escaped);
+    Add(spans, 0, i, TOKEN_STRING);
+    if (escaped)
+      return CPP_STRING;
+    break;
+  }
+  case CPP_RAW_STRING: {
+    // The delimiter isn't kept, so any )delim" ends the string
+    size_t end = line.find(")");
+    while (end != std::string_view::npos) {
+      size_t quote = line.find('"', end);
+      if (quote != std::string_view::npos && quote - end <= 17)
+        break;
+      end = line.find(')', end + 1);
+    }
+    if (end == std::string_view::npos) {
+      Add(spans, 0, line.size(), TOKEN_STRING);
+      return CPP_RAW_STRING;
+    }
+    i = line.find('"', end) + 1;
+    Add(spans, 0, i, TOKEN_STRING);
+    break;
+  }
+  case CPP_DIRECTIVE:
+    Add(spans, 0, line.size(), TOKEN_PREPROCESSOR);
+    return continued ? CPP_DIRECTIVE : CPP_NORMAL;
+  }
+
+  size_t first = line.find_first_not_of(" \t");
+  if (i == 0 && first != std::string_view::npos && line[first] == '#') {
+    // Directives are styled whole, up to a trailing comment
+    size_t comment = line.find("//");
+    Add(spans, first, std::min(comment, line.size()), TOKEN_PREPROCESSOR);
+    if (comment != std::string_view::npos) {
+      Add(spans, comment, line.size(), TOKEN_COMMENT);
+      return continued ? CPP_LINE_COMMENT : CPP_NORMAL;
+    }
+    return continued ? CPP_DIRECTIVE : CPP_NORMAL;
+  }
+
+  while (i < line.size()) {
+    char c = line[i];
+    if (c == '/' && i + 1 < line.size() && line[i + 1] == '/') {
+      Add(spans, i, line.size(), TOKEN_COMMENT);
+      return continued ? CPP_LINE_COMMENT : CPP_NORMAL;
+    }
+    if (c == '/' && i + 1 < line.size() && line[i + 1] == '*') {
+      size_t end = line.find("*/", i + 2);
+      if (end == std::string_view::npos) {
+        Add(spans, i, line.size(), TOKEN_COMMENT);
+        return CPP_BLOCK_COMMENT;
+      }
+      Add(spans, i, end + 2, TOKEN_COMMENT);
+      i = end + 2;
+    } else if (c == 'R' && i + 1 < line.size() && line[i + 1] == '"' &&
+               (i == 0 || !IsIdent(line[i - 1]))) {
+      size_t open = line.find('(', i + 2);
+      if (open == std::string_view::npos)
+        open = line.size();
+      std::string close = ")" + std::string(line.substr(i + 2, open - i - 2)) +
+                          "\"";
+      size_t end = line.find(close, open);
+      if (end == std::string_view::npos) {
+        Add(spans, i, line.size(), TOKEN_STRING);
+        return CPP_RAW_STRING;
+      }
+      Add(spans, i, end + close.size(), TOKEN_STRING);
+      i = end + close.size();
+    } else if (c == '"' || c == '\'') {
+      bool escaped;
+      size_t end = QuotedEnd(line, i, c, escaped);
+      Add(spans, i, end, TOKEN_STRING);
+      if (escaped && c == '"')
+        return CPP_STRING;
+      i = end;
+    } else if (isdigit((unsigned char)c) ||
+               (c == '.' && i + 1 < line.size() &&
+                isdigit((unsigned char)line[i + 1]))) {
+      size_t end = NumberEnd(line, i + 1);
+      Add(spans, i, end, TOKEN_NUMBER);
+      i = end;
+    } else if (IsIdentStart(c)) {
+      size_t end = i + 1;
+      while (end < line.size() && IsIdent(line[end]))
+        ++end;
+      std::string_view word = line.substr(i, end - i);
+      if (IsWord(word, CppKeywords, std::size(CppKeywords)))
+        Add(spans, i, end, TOKEN_KEYWORD);
+      else if (IsWord(word, CppTypes, std::size(CppTypes)))
+        Add(spans, i, end, TOKEN_TYPE);
+      i = end;
+    } else {
+      ++i;
+    }
+  }
+  return CPP_NORMAL;
+}
+
+// JSON strings can't span lines, so there is no state to carry
+inline LexState LexJson(LexState, std::string_view line,
+                        std::vector<TokenSpan> *spans) {
+  if (!spans)
+    return 0;
+  size_t i = 0;
+  while (i < line.size()) {
+    char c = line[i];
+    if (c == '"') {
+      bool escaped;
+      size_t end = QuotedEnd(line, i, '"', escaped);
+      size_t next = line.find_first_not_of(" \t\r", end);
+      bool key = next != std::string_view::npos && line[next] == ':';
+      Add(spans, i, end, key ? TOKEN_KEY : TOKEN_STRING);
+      i = end;
+    } else if (c == '-' || isdigit((unsigned char)c)) {
+      size_t end = NumberEnd(line, i + 1);
+      Add(spans, i, end, TOKEN_NUMBER);
+      i = end;
+    } else if (isalpha((unsigned char)c)) {
+      size_t end = i + 1;
+      while (end < line.size() && isalpha((unsigned char)line[end]))
+        ++end;
+      std::string_view word = line.substr(i, end - i);
+      bool literal = word == "true" || word == "false" || word == "null";
+      Add(spans, i, end, literal ? TOKEN_KEYWORD : TOKEN_ERROR);
+      i = end;
+    } else {
+      ++i;
+    }
+  }
+  return 0;
+}
+
+// The state is the level of the current entry, so indented continuation
+// lines (stack traces and the like) keep the color of their entry
+inline LexState LexLog(LexState state, std::string_view line,
+                       std::vector<TokenSpan> *spans) {
+  if (!line.empty() && (line[0] == ' ' || line[0] == '\t')) {
+    if (state != TOKEN_TEXT)
+      Add(spans, 0, line.size(), (TokenKind)state);
+    return state;
+  }
+
+  size_t i = 0;
+  // Leading timestamp: digits and separators, optionally bracketed
+  size_t stamp = line.find_first_not_of("0123456789-:.,/TZ+[] ");
+  if (stamp == std::string_view::npos)
+    stamp = line.size();
+  while (stamp > 0 && !isdigit((unsigned char)line[stamp - 1]) &&
+         line[stamp - 1] != ']')
+    --stamp;
+  if (stamp >= 6) {
+    Add(spans, 0, stamp, TOKEN_TIMESTAMP);
+    i = stamp;
+  }
+
+  LexState level = TOKEN_TEXT;
+  while (i < line.size()) {
+    char c = line[i];
+    if (c == '"') {
+      bool escaped;
+      size_t end = QuotedEnd(line, i, '"', escaped);
+      Add(spans, i, end, TOKEN_STRING);
+      i = end;
+    } else if (isalpha((unsigned char)c)) {
+      size_t end = i + 1;
+      while (end < line.size() && IsIdent(line[end]))
+        ++end;
+      std::string word(line.substr(i, end - i));
+      for (char &w : word)
+        w = (char)toupper((unsigned char)w);
+      TokenKind kind = TOKEN_TEXT;
+      if (word == "ERROR" || word == "ERR" || word == "FATAL" ||
+          word == "CRITICAL" || word == "SEVERE" || word == "EXCEPTION")
+        kind = TOKEN_ERROR;
+      else if (word == "WARN" || word == "WARNING")
+        kind = TOKEN_WARNING;
+      else if (word == "INFO" || word == "NOTICE")
+        kind = TOKEN_INFO;
+      else if (word == "DEBUG" || word == "TRACE" || word == "VERBOSE")
+        kind = TOKEN_DEBUG;
+      if (kind != TOKEN_TEXT) {
+        Add(spans, i, end, kind);
+        if (level == TOKEN_TEXT)
+          level = kind;
+      }
+      i = end;
+    } else if (isdigit((unsigned char)c) && (i == 0 || !IsIdent(line[i - 1]))) {
+      size_t end = NumberEnd(line, i + 1);
+      Add(spans, i, end, TOKEN_NUMBER);
+      i = end;
+    } else {
+      ++i;
+    }
+  }
+  return level;
+}
+
+} // namespace lexers
+
+inline LexState LexLine(Language language, LexState state,
+                        std::string_view line, std::vector<TokenSpan> *spans) {
+  switch (language) {
+  case LANGUAGE_CPP:
+    return lexers::LexCpp(state, line, spans);
+  case LANGUAGE_JSON:
+    return lexers::LexJson(state, line, spans);
+  case LANGUAGE_LOG:
+    return lexers::LexLog(state, line, spans);
+  default:
+    return 0;
+  }
+}
+
+// Caches the lexer state at the start of every line lexed so far, so
+// drawing any line only needs that line lexed. Edits re-lex from the edited
+// line onwards until the states line up with the cached ones again, and
+// lexing runs on a time budget: a line whose state isn't known yet is drawn
+// from the nearest guess and corrected once lexing gets there.
+class Highlighter {
+public:
+  // Longest line prefix lexed, same as the editor draws at most
+  static constexpr size_t MAX_LINE = 16 * 1024;
+
+  Language language() const { return lang; }
+
+  void setLanguage(Language language) {
+    lang = language;
+    reset();
+  }
+
+  // Forgets every state, e.g. after the whole document changed
+  void reset() {
+    states.assign(1, 0);
+    valid = trusted = 1;
+    editEnd = 0;
+  }
+
+  // An edit changed lines first to last (as numbered after it) and the line
+  // count from oldLines to newLines. Cached states up to first stay right,
+  // the ones after it move with their lines and become guesses until
+  // re-lexing confirms them.
+  void edited(size_t first, size_t last, size_t oldLines, size_t newLines) {
+    if (first >= states.size())
+      return;
+    long delta = (long)newLines - (long)oldLines;
+    auto shift = [first, delta](size_t index) {
+      if (index <= first + 1)
+        return index;
+      return (size_t)std::max((long)first + 1, (long)index + delta);
+    };
+    size_t after = first + 1; // first state that may change
+    if (delta > 0)
+      states.insert(states.begin() + after, delta, 0);
+    else if (delta < 0 && after < states.size())
+      states.erase(states.begin() + after,
+                   states.begin() + std::min(states.size(), after - delta));
+    trusted = shift(trusted);
+    editEnd = std::max(shift(editEnd), last + 1);
+    valid = std::min(valid, after);
+    trusted = std::max(trusted, valid);
+  }
+
+  // State line starts in: exact if lexing got that far, else a guess
+  LexState stateAt(size_t line) const {
+    return line < states.size() ? states[line] : 0;
+  }
+
+  // Lexes lines of table until those up to lastLine have exact states or
+  // budget runs out; meant to be called once per frame
+  void update(const PieceTable &table, size_t lastLine,
+              std::chrono::microseconds budget) {
+    if (lang == LANGUAGE_NONE || valid > lastLine)
+      return;
+    auto deadline = std::chrono::steady_clock::now() + budget;
+    size_t lines = table.lineCount();
+    size_t line = valid - 1;
+    size_t pos = table.lineStart(line);
+    std::string block;
+    size_t blockStart = 0;
+    for (size_t count = 0; line < lines && valid <= lastLine; ++count) {
+      if (count % 64 == 0 && std::chrono::steady_clock::now() > deadline)
+        break;
+      // Lines are read through a block buffer rather than one by one
+      size_t blockEnd = blockStart + block.size();
+      if (pos < blockStart ||
+          (pos + MAX_LINE > blockEnd && blockEnd < table.size())) {
+        blockStart = pos;
+        block = table.text(pos, BLOCK);
+      }
+      std::string_view rest(block.data() + (pos - blockStart),
+                            block.size() - (pos - blockStart));
+      size_t length = std::min(rest.find('\n'), rest.size());
+      std::string_view text = rest.substr(0, std::min(length, MAX_LINE));
+      if (!text.empty() && text.back() == '\r')
+        text.remove_suffix(1);
+      LexState next = LexLine(lang, states[line], text, nullptr);
+      // Past a line longer than the block, the index finds the next one
+      pos = length < rest.size() ? pos + length + 1
+                                 : table.lineStart(line + 1);
+      ++line;
+      store(line, next);
+    }
+  }
+
+private:
+  static constexpr size_t BLOCK = 256 * 1024;
+
+  Language lang = LANGUAGE_NONE;
+  std::vector<LexState> states{0}; // state at the start of each line
+  size_t valid = 1; // states before this line are exact
+  // Past an edit, states from editEnd to trusted were exact before it:
+  // once lexing reproduces one of them, all of them are again
+  size_t trusted = 1;
+  size_t editEnd = 0;
+
+  void store(size_t line, LexState state) {
+    if (line < states.size()) {
+      bool converged = line >= editEnd && line < trusted &&
+                       states[line] == state;
+      states[line] = state;
+      valid = converged ? trusted : line + 1;
+      // A state rewritten here no longer matches what it was before the
+      // edit, so agreeing with it later proves nothing
+      if (!converged)
+        editEnd = std::max(editEnd, line + 1);
+    } else {
+      states.push_back(state);
+      valid = line + 1;
+    }
+    trusted = std::max(trusted, valid);
+  }
+};
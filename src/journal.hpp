@@ -0,0 +1,350 @@
+#pragma once
+
+#include "piece_table.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <vector>
+
+// Undo/redo history kept as a journal of edits rather than copies of the
+// document. An entry replaces a range (or, for a replace-all, a list of
+// ranges) and keeps the text it removed and the text it inserted in an arena
+// of blocks filled in order. Dropping the oldest entries frees blocks from
+// the front, dropping undone ones rewinds the tail, and the history is
+// trimmed from the oldest end to stay within its memory limit.
+class EditJournal {
+public:
+  static constexpr size_t DEFAULT_LIMIT = 64 << 20;
+
+  explicit EditJournal(size_t limit = DEFAULT_LIMIT) : limit(limit) {}
+
+  // Bytes the history may use; older entries are dropped to stay below it
+  void setLimit(size_t bytes) {
+    limit = bytes;
+    trim();
+  }
+
+  // Arena blocks plus entry bookkeeping
+  size_t memoryUsed() const {
+    return arenaBytes + entries.size() * sizeof(Entry) + rangeBytes;
+  }
+
+  size_t size() const { return entries.size(); }
+  bool canUndo() const { return current > 0; }
+  bool canRedo() const { return current < entries.size(); }
+
+  void clear() {
+    entries.clear();
+    current = 0;
+    blocks.clear();
+    arenaBytes = rangeBytes = 0;
+    tail = 0;
+  }
+
+  // The next edit starts a new entry even if it continues the last one
+  void seal() {
+    if (!entries.empty())
+      entries.back().open = false;
+  }
+
+  // Records that [pos, pos + count) of table is about to be replaced by
+  // inserted. Typing, Backspace or Delete right where the previous edit left
+  // off extends its entry instead of adding one.
+  void record(const PieceTable &table, size_t pos, size_t count,
+              std::string_view inserted) {
+    dropRedo();
+    if (count + inserted.size() > limit) { // could never be kept
+      clear();
+      return;
+    }
+    if (!entries.empty() && extend(table, pos, count, inserted)) {
+      trim();
+      return;
+    }
+    seal();
+    Entry entry;
+    entry.pos = pos;
+    entry.removed = copyRemoved(table, pos, count);
+    entry.removedLength = count;
+    entry.inserted = store(inserted);
+    entry.insertedLength = inserted.size();
+    entry.open = isKeystroke(count, inserted);
+    entries.push_back(std::move(entry));
+    current = entries.size();
+    trim();
+  }
+
+  // Records that each of ranges (sorted, not overlapping) of table is about
+  // to be replaced by replacement, as a single entry
+  void recordAll(const PieceTable &table, std::span<const TextRange> ranges,
+                 std::string_view replacement) {
+    if (ranges.empty())
+      return;
+    dropRedo();
+    size_t removed = 0;
+    for (const TextRange &range : ranges)
+      removed += range.end - range.begin;
+    if (removed + replacement.size() + ranges.size() * sizeof(TextRange) >
+        limit) {
+      clear();
+      return;
+    }
+    seal();
+    Entry entry;
+    entry.ranges.assign(ranges.begin(), ranges.end());
+    char *out = reserve(removed);
+    for (const TextRange &range : ranges)
+      out = copyText(table, range.begin, range.end - range.begin, out);
+    entry.removed = tail - removed;
+    entry.removedLength = removed;
+    entry.inserted = store(replacement);
+    entry.insertedLength = replacement.size();
+    rangeBytes += entry.ranges.capacity() * sizeof(TextRange);
+    entries.push_back(std::move(entry));
+    current = entries.size();
+    trim();
+  }
+
+  // Reverts the last edit in table; changed is set to the span of the
+  // document it touched, ending where the text put back ends. False if there
+  // is nothing to undo.
+  bool undo(PieceTable &table, TextRange &changed) {
+    if (!canUndo())
+      return false;
+    seal();
+    const Entry &entry = entries[--current];
+    std::string_view removed = text(entry.removed, entry.removedLength);
+    if (entry.ranges.empty()) {
+      table.erase(entry.pos, entry.insertedLength);
+      table.insert(entry.pos, removed);
+      changed = {entry.pos, entry.pos + entry.removedLength};
+      return true;
+    }
+    // Where the replacements ended up, and what each of them replaced
+    std::vector<TextRange> replaced;
+    std::vector<std::string_view> originals;
+    replaced.reserve(entry.ranges.size());
+    originals.reserve(entry.ranges.size());
+    size_t shift = 0, offset = 0; // bytes added so far, into removed
+    for (const TextRange &range : entry.ranges) {
+      size_t length = range.end - range.begin;
+      size_t begin = range.begin + shift;
+      replaced.push_back({begin, begin + entry.insertedLength});
+      originals.push_back(removed.substr(offset, length));
+      offset += length;
+      shift += entry.insertedLength - length; // may wrap, adds up right
+    }
+    table.replaceEach(replaced, originals);
+    changed = {entry.ranges.front().begin, entry.ranges.back().end};
+    return true;
+  }
+
+  // Repeats the last undone edit in table; changed is set to the span of
+  // the document it touched, ending where the text inserted ends. False if
+  // there is nothing to redo.
+  bool redo(PieceTable &table, TextRange &changed) {
+    if (!canRedo())
+      return false;
+    const Entry &entry = entries[current++];
+    std::string_view inserted = text(entry.inserted, entry.insertedLength);
+    if (entry.ranges.empty()) {
+      table.erase(entry.pos, entry.removedLength);
+      table.insert(entry.pos, inserted);
+      changed = {entry.pos, entry.pos + entry.insertedLength};
+      return true;
+    }
+    table.replaceAll(entry.ranges, inserted);
+    // Unsigned wraparound makes this right when the text shrank too
+    changed = {entry.ranges.front().begin,
+               entry.ranges.back().end +
+                   entry.ranges.size() * entry.insertedLength -
+                   entry.removedLength};
+    return true;
+  }
+
+private:
+  // Edits of up to this many bytes count as keystrokes and can be merged
+  static constexpr size_t KEYSTROKE = 8;
+  static constexpr size_t BLOCK_SIZE = 64 * 1024;
+  static constexpr size_t MIN_BLOCK = 256;
+
+  // Replaces [pos, pos + removedLength) with the inserted text, or the
+  // ranges with it if there are any. Payloads are offsets into the arena.
+  struct Entry {
+    size_t pos = 0;
+    uint64_t removed = 0, inserted = 0;
+    size_t removedLength = 0, insertedLength = 0;
+    std::vector<TextRange> ranges;
+    bool open = false; // may still be extended by the next keystroke
+  };
+
+  struct Block {
+    std::unique_ptr<char[]> data;
+    uint64_t start; // arena offset of data[0]
+    size_t size;
+  };
+
+  size_t limit;
+  std::deque<Entry> entries;
+  size_t current = 0; // entries before this one are applied
+  std::deque<Block> blocks;
+  uint64_t tail = 0; // arena offset of the next free byte
+  size_t arenaBytes = 0, rangeBytes = 0;
+
+  static bool isKeystroke(size_t count, std::string_view inserted) {
+    if (count > 0 && !inserted.empty())
+      return inserted.size() <= KEYSTROKE; // typed over a selection
+    return count + inserted.size() <= KEYSTROKE &&
+           inserted.find('\n') == std::string_view::npos;
+  }
+
+  // Merges a keystroke into the last entry when it continues it
+  bool extend(const PieceTable &table, size_t pos, size_t count,
+              std::string_view inserted) {
+    Entry &last = entries.back();
+    if (!last.open || !last.ranges.empty() || count > KEYSTROKE ||
+        (count > 0 && !inserted.empty()) || !isKeystroke(0, inserted))
+      return false;
+    char *out;
+    if (count == 0) { // typing on at the end of the inserted text
+      if (pos != last.pos + last.insertedLength ||
+          last.inserted + last.insertedLength != tail)
+        return false;
+      last.inserted = grow(last.inserted, last.insertedLength,
+                           inserted.size(), out);
+      memcpy(out, inserted.data(), inserted.size());
+      last.insertedLength += inserted.size();
+      return true;
+    }
+    bool forward = pos == last.pos;         // Delete
+    bool backward = pos + count == last.pos; // Backspace
+    if (last.insertedLength > 0 ||
+        last.removed + last.removedLength != tail || !(forward || backward))
+      return false;
+    last.removed = grow(last.removed, last.removedLength, count, out);
+    if (backward) { // the removed text grows at the front
+      out -= last.removedLength;
+      memmove(out + count, out, last.removedLength);
+      last.pos = pos;
+    }
+    copyText(table, pos, count, out);
+    last.removedLength += count;
+    last.inserted = tail;
+    return true;
+  }
+
+  // Appends bytes to the arena; returns their offset
+  uint64_t store(std::string_view bytes) {
+    char *out = reserve(bytes.size());
+    if (!bytes.empty())
+      memcpy(out, bytes.data(), bytes.size());
+    return tail - bytes.size();
+  }
+
+  // Copies [pos, pos + count) of table into the arena; returns its offset
+  uint64_t copyRemoved(const PieceTable &table, size_t pos, size_t count) {
+    copyText(table, pos, count, reserve(count));
+    return tail - count;
+  }
+
+  static char *copyText(const PieceTable &table, size_t pos, size_t count,
+                        char *out) {
+    table.forEachChunk(pos, count, [&out](const char *data, size_t length) {
+      memcpy(out, data, length);
+      out += length;
+    });
+    return out;
+  }
+
+  // Makes room for extra bytes after the payload at offset, which must end
+  // at the tail. A payload whose block is full moves to a new one, so it
+  // stays contiguous. Returns its offset; out is set to the room made.
+  uint64_t grow(uint64_t offset, size_t length, size_t extra, char *&out) {
+    const Block &last = blocks.back();
+    if (tail + extra <= last.start + last.size) {
+      out = reserve(extra);
+      return offset;
+    }
+    std::string_view payload = text(offset, length);
+    char *moved = reserve(length + extra); // the old block stays alive
+    if (length > 0)
+      memcpy(moved, payload.data(), length);
+    out = moved + length;
+    return tail - length - extra;
+  }
+
+  char *reserve(size_t count) {
+    if (blocks.empty() ||
+        tail + count > blocks.back().start + blocks.back().size) {
+      // Small limits get small blocks, so one block can't exceed them
+      size_t size = std::max(std::clamp(limit / 16, MIN_BLOCK, BLOCK_SIZE),
+                             count);
+      blocks.push_back({std::unique_ptr<char[]>(new char[size]), tail, size});
+      arenaBytes += size;
+    }
+    char *out = blocks.back().data.get() + (tail - blocks.back().start);
+    tail += count;
+    return out;
+  }
+
+  std::string_view text(uint64_t offset, size_t length) const {
+    auto block = std::upper_bound(blocks.begin(), blocks.end(), offset,
+                                  [](uint64_t at, const Block &b) {
+                                    return at < b.start;
+                                  });
+    if (length == 0 || block == blocks.begin())
+      return {};
+    --block;
+    return {block->data.get() + (offset - block->start), length};
+  }
+
+  // Forgets the undone entries and the arena space behind them
+  void dropRedo() {
+    if (current == entries.size())
+      return;
+    while (entries.size() > current) {
+      rangeBytes -= entries.back().ranges.capacity() * sizeof(TextRange);
+      entries.pop_back();
+    }
+    tail = entries.empty() ? (blocks.empty() ? 0 : blocks.front().start)
+                           : end(entries.back());
+    while (!blocks.empty() && blocks.back().start >= tail &&
+           blocks.size() > 1) {
+      arenaBytes -= blocks.back().size;
+      blocks.pop_back();
+    }
+  }
+
+  static uint64_t end(const Entry &entry) {
+    return std::max(entry.removed + entry.removedLength,
+                    entry.inserted + entry.insertedLength);
+  }
+
+  // Drops the oldest entries until the history fits its limit. Undone
+  // entries can only go together with everything after them.
+  void trim() {
+    while (!entries.empty() && memoryUsed() > limit) {
+      if (current == 0) {
+        clear();
+        return;
+      }
+      rangeBytes -= entries.front().ranges.capacity() * sizeof(TextRange);
+      entries.pop_front();
+      --current;
+      uint64_t used = entries.empty() ? tail
+                                      : std::min(entries.front().removed,
+                                                 entries.front().inserted);
+      while (blocks.size() > 1 &&
+             blocks.front().start + blocks.front().size <= used) {
+        arenaBytes -= blocks.front().size;
+        blocks.pop_front();
+      }
+    }
+  }
+};
@@ -1,3 +1,8 @@
+#include "encoding.hpp"
+#include "highlight.hpp"
+#include "journal.hpp"
+#include "piece_table.hpp"
+#include "search.hpp"
 #include "utils.hpp"
 
 #include "imgui.h"
@@ -5,10 +10,24 @@
 #include "rlImGui.h"
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cfloat>
 #include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
 #include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <span>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 
 std::string GetCurrentDateTime() {
   auto now = std::chrono::system_clock::now();
@@ -26,7 +45,1275 @@ std::string GetCurrentDateTime() {
   return oss.str();
 }
 
-int main() {
+bool IsContinuationByte(char c) { return ((unsigned char)c & 0xC0) == 0x80; }
+
+// Advances of the characters drawn so far in the current font, so a line is
+// measured with a lookup per character instead of a CalcTextSize call
+class GlyphAdvances {
+public:
+  // Forgets every advance if the font or its size changed; true if so
+  bool update() {
+    ImFont *current = ImGui::GetFont();
+    float currentSize = ImGui::GetFontSize();
+    if (current == font && currentSize == size)
+      return false;
+    font = current;
+    size = currentSize;
+    ascii.fill(-1.0f);
+    others.clear();
+    return true;
+  }
+
+  // Advance of the character at text[i]; i is moved past it
+  float next(std::string_view text, size_t &i) {
+    unsigned char c = text[i];
+    if (c < 0x80) {
+      float &advance = ascii[c];
+      if (advance < 0)
+        advance = measure(text.substr(i, 1));
+      ++i;
+      return advance;
+    }
+    // Keyed by the character's bytes; no need to decode them
+    size_t end = i + 1;
+    while (end < text.size() && end - i < 4 && IsContinuationByte(text[end]))
+      ++end;
+    uint32_t key = 0;
+    memcpy(&key, text.data() + i, end - i);
+    auto [found, added] = others.try_emplace(key, 0.0f);
+    if (added)
+      found->second = measure(text.substr(i, end - i));
+    i = end;
+    return found->second;
+  }
+
+  float width(std::string_view text) {
+    float total = 0.0f;
+    for (size_t i = 0; i < text.size();)
+      total += next(text, i);
+    return total;
+  }
+
+private:
+  const ImFont *font = nullptr;
+  float size = 0.0f;
+  std::array<float, 128> ascii;
+  std::unordered_map<uint32_t, float> others;
+
+  // Unrounded, unlike CalcTextSize, so advances add up to what's drawn
+  float measure(std::string_view c) const {
+    return font->CalcTextSizeA(size, FLT_MAX, 0.0f, c.data(),
+                               c.data() + c.size())
+        .x;
+  }
+};
+
+// Colors of each TokenKind on the dark background; TOKEN_TEXT uses the
+// style's text color instead
+const ImU32 TokenColors[TOKEN_KIND_COUNT] = {
+    IM_COL32(212, 212, 212, 255), // text
+    IM_COL32(86, 156, 214, 255),  // keyword
+    IM_COL32(78, 201, 176, 255),  // type
+    IM_COL32(181, 206, 168, 255), // number
+    IM_COL32(206, 145, 120, 255), // string
+    IM_COL32(106, 153, 85, 255),  // comment
+    IM_COL32(197, 134, 192, 255), // preprocessor
+    IM_COL32(156, 220, 254, 255), // key
+    IM_COL32(128, 140, 160, 255), // timestamp
+    IM_COL32(244, 71, 71, 255),   // error
+    IM_COL32(220, 180, 60, 255),  // warning
+    IM_COL32(96, 180, 230, 255),  // info
+    IM_COL32(140, 140, 140, 255), // debug
+};
+
+// Multiline editor drawn straight from a PieceTable. Only the lines inside
+// the visible area are read from the buffer each frame, so the cost of a
+// frame or a keystroke doesn't depend on the document size.
+class TextEditor {
+public:
+  PieceTable buffer;
+  EditJournal journal; // undo history
+  // Ranges drawn highlighted, e.g. search matches; sorted, not overlapping
+  std::span<const TextRange> highlights;
+
+  void setText(std::string text) {
+    buffer.assign(std::move(text));
+    journal.clear();
+    reset();
+  }
+
+  // Opens file, which must be UTF-8, less its first skip bytes
+  void open(std::shared_ptr<const MappedFile> file, size_t skip = 0) {
+    buffer.assign(std::move(file), skip);
+    journal.clear();
+    reset();
+  }
+
+  // Opens file, less its first skip bytes, converted from encoding to UTF-8
+  void decode(const MappedFile &file, size_t skip, Encoding encoding) {
+    buffer.clear();
+    DecodeFile(file, skip, encoding, buffer);
+    journal.clear();
+    reset();
+  }
+
+  Language language() const { return highlighter.language(); }
+  void setLanguage(Language language) { highlighter.setLanguage(language); }
+
+  bool hasSelection() const { return cursor != anchor; }
+  size_t selectionStart() const { return std::min(cursor, anchor); }
+  size_t selectionEnd() const { return std::max(cursor, anchor); }
+
+  std::string selectedText() const {
+    return buffer.text(selectionStart(), selectionEnd() - selectionStart());
+  }
+
+  // Replaces the selection (if any) with text
+  void insert(std::string_view text) {
+    size_t start = selectionStart();
+    replace(start, selectionEnd() - start, text);
+    moveTo(start + text.size(), false);
+  }
+
+  void eraseSelection() {
+    if (!hasSelection())
+      return;
+    size_t start = selectionStart();
+    replace(start, selectionEnd() - start, {});
+    moveTo(start, false);
+  }
+
+  void undo() {
+    size_t lines = buffer.lineCount();
+    TextRange changed;
+    if (journal.undo(buffer, changed)) {
+      edited(buffer.lineOf(changed.begin), buffer.lineOf(changed.end), lines);
+      moveTo(changed.end, false);
+    }
+  }
+
+  void redo() {
+    size_t lines = buffer.lineCount();
+    TextRange changed;
+    if (journal.redo(buffer, changed)) {
+      edited(buffer.lineOf(changed.begin), buffer.lineOf(changed.end), lines);
+      moveTo(changed.end, false);
+    }
+  }
+
+  void selectAll() {
+    anchor = 0;
+    cursor = buffer.size();
+  }
+
+  // Selects [begin, end) and scrolls it into view
+  void select(size_t begin, size_t end) {
+    moveTo(begin, false);
+    moveTo(end, true);
+  }
+
+  // Replaces every one of ranges with text in a single buffer rebuild
+  void replaceAll(std::span<const TextRange> ranges, std::string_view text) {
+    if (ranges.empty())
+      return;
+    size_t lines = buffer.lineCount();
+    size_t lastLine = buffer.lineOf(ranges.back().end);
+    journal.recordAll(buffer, ranges, text);
+    buffer.replaceAll(ranges, text);
+    // Lines after the last range only moved, by the change in line count
+    edited(buffer.lineOf(ranges.front().begin),
+           lastLine + buffer.lineCount() - lines, lines);
+    moveTo(cursor, false);
+  }
+
+  // line is 0-based and clamped to the document
+  void goToLine(size_t line) {
+    moveTo(buffer.lineStart(std::min(line, buffer.lineCount() - 1)), false);
+  }
+
+  size_t cursorLine() const { return buffer.lineOf(cursor); }
+
+  // Characters (not bytes) between the start of the line and the cursor
+  size_t cursorColumn() const {
+    if (column == NO_COLUMN) {
+      size_t start = buffer.lineStart(cursorLine());
+      column = 0;
+      buffer.forEachChunk(start, cursor - start,
+                          [this](const char *data, size_t length) {
+                            column += CountCodePoints(data, length);
+                          });
+    }
+    return column;
+  }
+
+  void copy() const {
+    if (hasSelection())
+      ImGui::SetClipboardText(selectedText().c_str());
+  }
+
+  void cut() {
+    copy();
+    eraseSelection();
+  }
+
+  void paste() {
+    const char *clipboard = ImGui::GetClipboardText();
+    if (clipboard)
+      insert(clipboard);
+  }
+
+  bool wrapping() const { return wrap; }
+
+  void setWrapping(bool enabled) {
+    wrap = enabled;
+    layouts.clear();
+    scrollToCursor = true;
+  }
+
+  void draw(const char *id, ImVec2 size) {
+    ImGui::BeginChild(id, size, ImGuiChildFlags_Borders,
+                      (wrap ? 0 : ImGuiWindowFlags_HorizontalScrollbar) |
+                          ImGuiWindowFlags_NoNavInputs);
+    ImVec2 origin = ImGui::GetCursorScreenPos();
+    ImVec2 visible = ImGui::GetContentRegionAvail();
+    float lineHeight = ImGui::GetTextLineHeight();
+    float spaceWidth = ImGui::CalcTextSize(" ").x;
+    buffer.updateIndex();
+
+    // Layouts are measured in the current font and, wrapped, to the width
+    // of the view; the cache only needs to hold a few screens of lines
+    float width = std::max(visible.x - spaceWidth, spaceWidth);
+    if (glyphs.update() || layouts.size() > MAX_LAYOUTS ||
+        (wrap && width != wrapWidth))
+      layouts.clear();
+    wrapWidth = width;
+
+    bool focused = ImGui::IsWindowFocused();
+    if (focused)
+      handleKeyboard((size_t)std::max(1.0f, visible.y / lineHeight));
+    layoutVisible(lineHeight, visible.y);
+    handleMouse(origin, lineHeight);
+
+    size_t lines = buffer.lineCount();
+    size_t selStart = selectionStart(), selEnd = selectionEnd();
+    ImDrawList *drawList = ImGui::GetWindowDrawList();
+    ImU32 textColor = ImGui::GetColorU32(ImGuiCol_Text);
+    ImU32 selectionColor = ImGui::GetColorU32(ImGuiCol_TextSelectedBg);
+    ImU32 highlightColor = ImGui::GetColorU32(ImGuiCol_TextSelectedBg, 0.4f);
+
+    highlighter.update(buffer, visibleLines.back().line + 1, HIGHLIGHT_BUDGET);
+    std::vector<TokenSpan> spans;
+    for (const VisibleLine &visibleLine : visibleLines) {
+      size_t line = visibleLine.line;
+      size_t start = buffer.lineStart(line);
+      size_t end = buffer.lineEnd(line);
+      const LineLayout &layout = layoutOf(line);
+      ImVec2 pos(origin.x, origin.y + visibleLine.y);
+      // Line-relative [from, to), filled past the end if it covers the
+      // newline
+      auto fill = [&](size_t from, size_t to, ImU32 color) {
+        size_t length = layout.text.size();
+        fillRange(pos, lineHeight, spaceWidth, layout,
+                  std::min(from - std::min(from, start), length),
+                  std::min(to - start, length), to > end, color);
+      };
+
+      auto highlight = std::partition_point(
+          highlights.begin(), highlights.end(),
+          [start](const TextRange &range) { return range.end <= start; });
+      for (; highlight != highlights.end() && highlight->begin <= end;
+           ++highlight)
+        fill(highlight->begin, highlight->end, highlightColor);
+      if (selStart <= end && selEnd > start)
+        fill(selStart, selEnd, selectionColor);
+      drawText(pos, lineHeight, layout, highlighter.stateAt(line), spans);
+      contentWidth = std::max(contentWidth, layout.width);
+    }
+
+    size_t cursorLine = buffer.lineOf(cursor);
+    const LineLayout &cursorLayout = layoutOf(cursorLine);
+    size_t cursorOffset = cursor - buffer.lineStart(cursorLine);
+    size_t cursorRow = rowOf(cursorLayout, cursorOffset);
+    float cursorX = xIn(cursorLayout, cursorOffset);
+    auto drawn = std::find_if(
+        visibleLines.begin(), visibleLines.end(),
+        [cursorLine](const VisibleLine &v) { return v.line == cursorLine; });
+    if (focused && drawn != visibleLines.end()) {
+      ImVec2 top(origin.x + cursorX,
+                 origin.y + drawn->y + cursorRow * lineHeight);
+      drawList->AddLine(top, ImVec2(top.x, top.y + lineHeight), textColor);
+    }
+
+    // Content size drives the scrollbars. Wrapped lines take a varying
+    // number of rows, so then the scroll position counts lines instead and
+    // the last line can be scrolled up to the top.
+    if (wrap)
+      ImGui::Dummy(ImVec2(0.0f, (lines - 1) * lineHeight + visible.y));
+    else
+      ImGui::Dummy(ImVec2(contentWidth + spaceWidth, lines * lineHeight));
+
+    if (scrollToCursor) {
+      scrollToCursor = false;
+      float cursorY = cursorLine * lineHeight;
+      if (wrap)
+        scrollToRow(cursorLine, cursorRow, (size_t)(visible.y / lineHeight));
+      else if (cursorY < ImGui::GetScrollY())
+        ImGui::SetScrollY(cursorY);
+      else if (cursorY + lineHeight > ImGui::GetScrollY() + visible.y)
+        ImGui::SetScrollY(cursorY + lineHeight - visible.y);
+      if (cursorX < ImGui::GetScrollX())
+        ImGui::SetScrollX(cursorX);
+      else if (cursorX + spaceWidth > ImGui::GetScrollX() + visible.x)
+        ImGui::SetScrollX(cursorX + spaceWidth - visible.x);
+    }
+    ImGui::EndChild();
+  }
+
+private:
+  // Longest line prefix that is drawn and measured
+  static constexpr size_t MAX_LINE_BYTES = 16 * 1024;
+
+  static constexpr size_t NO_COLUMN = SIZE_MAX;
+
+  // Time a frame may spend lexing lines ahead of the visible ones
+  static constexpr std::chrono::microseconds HIGHLIGHT_BUDGET{500};
+  // Line layouts kept before the cache is cleared
+  static constexpr size_t MAX_LAYOUTS = 4096;
+
+  // A line as drawn: its text and, when wrapping, where its rows start
+  struct LineLayout {
+    std::string text;
+    std::vector<uint32_t> rows; // offset of each row, rows[0] is 0
+    float width = 0.0f;         // of the whole line, unwrapped
+  };
+
+  // A line in view and the y (in content space) its first row is drawn at
+  struct VisibleLine {
+    size_t line;
+    float y;
+  };
+
+  size_t cursor = 0;
+  size_t anchor = 0;        // other end of the selection
+  float preferredX = -1.0f; // column kept while moving up and down
+  bool scrollToCursor = false;
+  bool dragging = false;
+  float contentWidth = 0.0f; // widest line drawn so far
+  bool wrap = false;
+  float wrapWidth = 0.0f;
+  mutable GlyphAdvances glyphs;
+  // Layouts of lines measured lately, so a frame only lays out lines that
+  // scrolled into view or changed
+  mutable std::unordered_map<size_t, LineLayout> layouts;
+  std::vector<VisibleLine> visibleLines; // this frame's, top to bottom
+  Highlighter highlighter;
+  // cursorColumn() result, valid until the cursor moves
+  mutable size_t column = NO_COLUMN;
+
+  // Every edit goes through here, so it lands in the journal
+  void replace(size_t pos, size_t count, std::string_view text) {
+    if (count == 0 && text.empty())
+      return;
+    size_t lines = buffer.lineCount();
+    journal.record(buffer, pos, count, text);
+    buffer.erase(pos, count);
+    buffer.insert(pos, text);
+    edited(buffer.lineOf(pos), buffer.lineOf(pos + text.size()), lines);
+  }
+
+  // Lines first to last (as numbered now) were just rewritten, and the
+  // document had oldLines lines. Their cached layouts go, the ones of the
+  // lines after them move along.
+  void edited(size_t first, size_t last, size_t oldLines) {
+    size_t lines = buffer.lineCount();
+    highlighter.edited(first, last, oldLines, lines);
+    size_t oldLast = last + oldLines - lines;
+    std::unordered_map<size_t, LineLayout> moved;
+    for (auto &[line, layout] : layouts) {
+      if (line < first)
+        moved.emplace(line, std::move(layout));
+      else if (line > oldLast)
+        moved.emplace(line + lines - oldLines, std::move(layout));
+    }
+    layouts = std::move(moved);
+  }
+
+  void reset() {
+    cursor = anchor = 0;
+    column = NO_COLUMN;
+    preferredX = -1.0f;
+    contentWidth = 0.0f;
+    scrollToCursor = true;
+    highlighter.reset();
+    layouts.clear();
+  }
+
+  // Draws a line colored by its tokens, its rows one under the other;
+  // state is the lexer state the line starts in
+  void drawText(ImVec2 pos, float lineHeight, const LineLayout &layout,
+                LexState state, std::vector<TokenSpan> &spans) const {
+    ImDrawList *drawList = ImGui::GetWindowDrawList();
+    ImU32 textColor = ImGui::GetColorU32(ImGuiCol_Text);
+    const std::string &text = layout.text;
+    spans.clear();
+    LexLine(highlighter.language(), state, text, &spans);
+    size_t begin = 0, row = 0;
+    float x = pos.x;
+    auto drawUpTo = [&](size_t end, ImU32 color) {
+      while (begin < end) {
+        size_t rowEnd =
+            row + 1 < layout.rows.size() ? layout.rows[row + 1] : text.size();
+        if (begin == rowEnd) {
+          ++row;
+          x = pos.x;
+          pos.y += lineHeight;
+          continue;
+        }
+        size_t stop = std::min(end, rowEnd);
+        drawList->AddText(ImVec2(x, pos.y), color, text.data() + begin,
+                          text.data() + stop);
+        x += widthOf(text, begin, stop);
+        begin = stop;
+      }
+    };
+    for (const TokenSpan &span : spans) {
+      drawUpTo(span.begin, textColor);
+      drawUpTo(span.end, TokenColors[span.kind]);
+    }
+    drawUpTo(text.size(), textColor);
+  }
+
+  // Fills [from, to) of a line row by row; pastEnd fills on over the
+  // newline too
+  void fillRange(ImVec2 pos, float lineHeight, float spaceWidth,
+                 const LineLayout &layout, size_t from, size_t to,
+                 bool pastEnd, ImU32 color) const {
+    ImDrawList *drawList = ImGui::GetWindowDrawList();
+    const std::string &text = layout.text;
+    for (size_t row = rowOf(layout, from); row < layout.rows.size(); ++row) {
+      size_t rowStart = layout.rows[row];
+      bool lastRow = row + 1 == layout.rows.size();
+      size_t rowEnd = lastRow ? text.size() : layout.rows[row + 1];
+      float x0 = widthOf(text, rowStart, std::max(from, rowStart));
+      float x1 = widthOf(text, rowStart, std::min(to, rowEnd));
+      if (pastEnd && lastRow)
+        x1 += spaceWidth;
+      float y = pos.y + row * lineHeight;
+      drawList->AddRectFilled(ImVec2(pos.x + x0, y),
+                              ImVec2(pos.x + x1, y + lineHeight), color);
+      if (to < rowEnd || (to == rowEnd && !pastEnd))
+        break;
+    }
+  }
+
+  void moveTo(size_t pos, bool select) {
+    cursor = std::min(pos, buffer.size());
+    column = NO_COLUMN;
+    if (!select)
+      anchor = cursor;
+    preferredX = -1.0f;
+    scrollToCursor = true;
+  }
+
+  size_t prevChar(size_t pos) const {
+    if (pos == 0)
+      return 0;
+    do
+      --pos;
+    while (pos > 0 && IsContinuationByte(buffer.at(pos)));
+    return pos;
+  }
+
+  size_t nextChar(size_t pos) const {
+    if (pos >= buffer.size())
+      return buffer.size();
+    do
+      ++pos;
+    while (pos < buffer.size() && IsContinuationByte(buffer.at(pos)));
+    return pos;
+  }
+
+  std::string lineText(size_t start, size_t end) const {
+    std::string text =
+        buffer.text(start, std::min(end - start, MAX_LINE_BYTES));
+    if (!text.empty() && text.back() == '\r')
+      text.pop_back();
+    return text;
+  }
+
+  float widthOf(const std::string &text, size_t from, size_t to) const {
+    return glyphs.width(std::string_view(text).substr(from, to - from));
+  }
+
+  // Measures line, and wraps it when wrapping is on: rows break after the
+  // last blank that fits, or mid-word if there is none
+  const LineLayout &layoutOf(size_t line) const {
+    auto found = layouts.find(line);
+    if (found != layouts.end())
+      return found->second;
+    LineLayout &layout = layouts[line];
+    const std::string &text = layout.text =
+        lineText(buffer.lineStart(line), buffer.lineEnd(line));
+    layout.rows.assign(1, 0);
+    size_t rowStart = 0, blank = 0; // offset after the last blank
+    float x = 0.0f, blankX = 0.0f;
+    for (size_t i = 0; i < text.size();) {
+      size_t at = i;
+      float advance = glyphs.next(text, i);
+      if (wrap && x + advance > wrapWidth && at > rowStart) {
+        rowStart = blank > rowStart ? blank : at;
+        x = rowStart == at ? 0.0f : x - blankX;
+        layout.rows.push_back((uint32_t)rowStart);
+      }
+      x += advance;
+      layout.width += advance;
+      if (text[at] == ' ' || text[at] == '\t') {
+        blank = i;
+        blankX = x;
+      }
+    }
+    return layout;
+  }
+
+  size_t rowCount(size_t line) const {
+    return wrap ? layoutOf(line).rows.size() : 1;
+  }
+
+  // Row of layout that offset is drawn on
+  static size_t rowOf(const LineLayout &layout, size_t offset) {
+    return std::upper_bound(layout.rows.begin() + 1, layout.rows.end(),
+                            offset) -
+           layout.rows.begin() - 1;
+  }
+
+  // x of offset relative to the start of its row
+  float xIn(const LineLayout &layout, size_t offset) const {
+    size_t row = rowOf(layout, offset);
+    return widthOf(layout.text, layout.rows[row],
+                   std::min(offset, layout.text.size()));
+  }
+
+  float xOf(size_t pos) const {
+    size_t line = buffer.lineOf(pos);
+    return xIn(layoutOf(line), pos - buffer.lineStart(line));
+  }
+
+  // Offset of the character boundary in row of line closest to x. The end
+  // of a wrapped row is the start of the next one, so that isn't returned.
+  size_t posAt(size_t line, size_t row, float x) const {
+    const LineLayout &layout = layoutOf(line);
+    const std::string &text = layout.text;
+    row = std::min(row, layout.rows.size() - 1);
+    bool lastRow = row + 1 == layout.rows.size();
+    size_t end = lastRow ? text.size() : layout.rows[row + 1];
+    size_t pos = layout.rows[row];
+    float left = 0.0f;
+    while (pos < end) {
+      size_t next = pos;
+      float right = left + glyphs.next(text, next);
+      if (x < (left + right) / 2)
+        break;
+      pos = next;
+      left = right;
+    }
+    if (pos == end && !lastRow && pos > layout.rows[row])
+      do
+        --pos;
+      while (pos > 0 && IsContinuationByte(text[pos]));
+    return buffer.lineStart(line) + pos;
+  }
+
+  // Moves by rows, which are lines unless wrapping
+  void moveVertically(long rows, bool select) {
+    float x = preferredX >= 0 ? preferredX : xOf(cursor);
+    size_t line = buffer.lineOf(cursor);
+    size_t lines = buffer.lineCount();
+    long row = rows;
+    if (!wrap) {
+      line = std::clamp((long)line + rows, 0L, (long)lines - 1);
+      row = 0;
+    } else {
+      row += rowOf(layoutOf(line), cursor - buffer.lineStart(line));
+      while (row < 0 && line > 0)
+        row += rowCount(--line);
+      while (row >= (long)rowCount(line) && line + 1 < lines)
+        row -= rowCount(line++);
+      row = std::clamp(row, 0L, (long)rowCount(line) - 1);
+    }
+    moveTo(posAt(line, row, x), select);
+    preferredX = x;
+  }
+
+  // Lines from the one at the top of the view down to its bottom. The top
+  // line is picked by the scroll position alone, so this costs the same
+  // wherever the view is.
+  void layoutVisible(float lineHeight, float height) {
+    visibleLines.clear();
+    size_t lines = buffer.lineCount();
+    float bottom = ImGui::GetScrollY() + height;
+    size_t line = std::min((size_t)(ImGui::GetScrollY() / lineHeight),
+                           lines - 1);
+    float y = line * lineHeight;
+    do {
+      visibleLines.push_back({line, y});
+      y += rowCount(line) * lineHeight;
+    } while (++line < lines && y < bottom);
+  }
+
+  // Scrolls a wrapped view as little as it takes to show row of line
+  void scrollToRow(size_t line, size_t row, size_t viewRows) {
+    float lineHeight = ImGui::GetTextLineHeight();
+    size_t top = (size_t)(ImGui::GetScrollY() / lineHeight);
+    if (line <= top) {
+      if (line < top || row > 0)
+        ImGui::SetScrollY(line * lineHeight);
+      return;
+    }
+    size_t below = row + 1; // rows from the top line down to row
+    for (size_t i = top; i < line && below <= viewRows; ++i)
+      below += rowCount(i);
+    if (below <= viewRows)
+      return;
+    top = line;
+    below = row + 1;
+    while (top > 0 && below + rowCount(top - 1) <= viewRows)
+      below += rowCount(--top);
+    ImGui::SetScrollY(top * lineHeight);
+  }
+
+  void handleKeyboard(size_t pageLines) {
+    ImGuiIO &io = ImGui::GetIO();
+    bool shift = io.KeyShift;
+
+    if (io.KeyCtrl) {
+      if (ImGui::IsKeyPressed(ImGuiKey_A))
+        selectAll();
+      if (ImGui::IsKeyPressed(ImGuiKey_C))
+        copy();
+      if (ImGui::IsKeyPressed(ImGuiKey_X))
+        cut();
+      if (ImGui::IsKeyPressed(ImGuiKey_V))
+        paste();
+      if (ImGui::IsKeyPressed(ImGuiKey_Z))
+        shift ? redo() : undo();
+      if (ImGui::IsKeyPressed(ImGuiKey_Y))
+        redo();
+    }
+
+    if (ImGui::IsKeyPressed(ImGuiKey_LeftArrow)) {
+      if (hasSelection() && !shift)
+        moveTo(selectionStart(), false);
+      else
+        moveTo(prevChar(cursor), shift);
+    }
+    if (ImGui::IsKeyPressed(ImGuiKey_RightArrow)) {
+      if (hasSelection() && !shift)
+        moveTo(selectionEnd(), false);
+      else
+        moveTo(nextChar(cursor), shift);
+    }
+    if (ImGui::IsKeyPressed(ImGuiKey_UpArrow))
+      moveVertically(-1, shift);
+    if (ImGui::IsKeyPressed(ImGuiKey_DownArrow))
+      moveVertically(1, shift);
+    if (ImGui::IsKeyPressed(ImGuiKey_PageUp))
+      moveVertically(-(long)pageLines, shift);
+    if (ImGui::IsKeyPressed(ImGuiKey_PageDown))
+      moveVertically((long)pageLines, shift);
+    if (ImGui::IsKeyPressed(ImGuiKey_Home))
+      moveTo(io.KeyCtrl ? 0 : buffer.lineStart(buffer.lineOf(cursor)), shift);
+    if (ImGui::IsKeyPressed(ImGuiKey_End))
+      moveTo(io.KeyCtrl ? buffer.size() : buffer.lineEnd(buffer.lineOf(cursor)),
+             shift);
+
+    if (ImGui::IsKeyPressed(ImGuiKey_Backspace)) {
+      if (!hasSelection())
+        anchor = prevChar(cursor);
+      eraseSelection();
+    }
+    if (ImGui::IsKeyPressed(ImGuiKey_Delete)) {
+      if (!hasSelection())
+        anchor = nextChar(cursor);
+      eraseSelection();
+    }
+    if (ImGui::IsKeyPressed(ImGuiKey_Enter) ||
+        ImGui::IsKeyPressed(ImGuiKey_KeypadEnter))
+      insert("\n");
+    if (ImGui::IsKeyPressed(ImGuiKey_Tab))
+      insert("\t");
+
+    // Typed characters; with Ctrl held they are shortcuts instead (AltGr
+    // reports Ctrl+Alt and still types)
+    if (!io.KeyCtrl || io.KeyAlt) {
+      std::string typed;
+      for (ImWchar c : io.InputQueueCharacters)
+        if (c >= 32 && c != 127)
+          AppendUtf8(typed, c);
+      if (!typed.empty())
+        insert(typed);
+    }
+  }
+
+  void handleMouse(ImVec2 origin, float lineHeight) {
+    bool hovered = ImGui::IsWindowHovered();
+    if (hovered)
+      ImGui::SetMouseCursor(ImGuiMouseCursor_TextInput);
+    if (hovered && ImGui::IsMouseClicked(ImGuiMouseButton_Left))
+      dragging = true;
+    else if (!ImGui::IsMouseDown(ImGuiMouseButton_Left))
+      dragging = false;
+    if (!dragging)
+      return;
+
+    // Rows above or below the view are taken to be a line each
+    ImVec2 mouse = ImGui::GetMousePos();
+    float y = mouse.y - origin.y;
+    size_t line = 0, row = 0;
+    const VisibleLine &top = visibleLines.front();
+    const VisibleLine &bottom = visibleLines.back();
+    float bottomEnd = bottom.y + rowCount(bottom.line) * lineHeight;
+    if (y < top.y) {
+      size_t above = (size_t)std::ceil((top.y - y) / lineHeight);
+      line = top.line > above ? top.line - above : 0;
+    } else if (y >= bottomEnd) {
+      line = std::min(bottom.line + 1 + (size_t)((y - bottomEnd) / lineHeight),
+                      buffer.lineCount() - 1);
+      row = line == bottom.line ? rowCount(line) - 1 : 0;
+    } else {
+      auto hit = std::prev(std::upper_bound(
+          visibleLines.begin(), visibleLines.end(), y,
+          [](float at, const VisibleLine &v) { return at < v.y; }));
+      line = hit->line;
+      row = (size_t)((y - hit->y) / lineHeight);
+    }
+    bool select = !ImGui::IsMouseClicked(ImGuiMouseButton_Left) ||
+                  ImGui::GetIO().KeyShift;
+    moveTo(posAt(line, row, mouse.x - origin.x), select);
+  }
+};
+
+// Search and Replace window. Searches run as a SearchJob over a snapshot of
+// the document and restart whenever the query or the document changes;
+// matches are highlighted in the editor as they come in.
+class SearchPanel {
+public:
+  void show(bool replace) {
+    visible = true;
+    replacing = replace;
+    focusQuery = true;
+  }
+
+  // Selects the next match after the cursor, wrapping around at the end.
+  // If the search hasn't got that far yet, that happens once it has.
+  void findNext() {
+    if (query.empty())
+      show(replacing);
+    else
+      pendingNext = true;
+  }
+
+  // Keeps the search current and feeds its matches to the editor; meant to
+  // be called once per frame, before the editor is drawn
+  void update(TextEditor &editor) {
+    if ((visible || pendingNext) &&
+        (!searched || query != searchedQuery || matchCase != searchedCase ||
+         regex != searchedRegex ||
+         editor.buffer.version() != searchedVersion))
+      restart(editor);
+    if (job)
+      job->poll();
+    if (visible && job)
+      editor.highlights = job->matches();
+    else
+      editor.highlights = {};
+    if (pendingNext)
+      selectNext(editor);
+  }
+
+  void draw(TextEditor &editor) {
+    if (!visible)
+      return;
+    ImGui::SetNextWindowSize(ImVec2(560, 0), ImGuiCond_FirstUseEver);
+    if (ImGui::Begin(replacing ? "Replace###search" : "Search###search",
+                     &visible, ImGuiWindowFlags_NoCollapse)) {
+      if (focusQuery) {
+        ImGui::SetKeyboardFocusHere();
+        focusQuery = false;
+      }
+      bool submit = InputTextString("Find", &query,
+                                    ImGuiInputTextFlags_EnterReturnsTrue);
+      if (replacing)
+        InputTextString("Replace with", &replacement);
+      ImGui::Checkbox("Match case", &matchCase);
+      ImGui::SameLine();
+      ImGui::Checkbox("Regular expression", &regex);
+
+      if (ImGui::Button("Find next") || submit)
+        findNext();
+      if (replacing) {
+        ImGui::SameLine();
+        if (ImGui::Button("Replace"))
+          replace(editor);
+        ImGui::SameLine();
+        // Only whole, current results can be replaced in one go
+        ImGui::BeginDisabled(!job || !job->done() ||
+                             editor.buffer.version() != searchedVersion);
+        if (ImGui::Button("Replace all"))
+          editor.replaceAll(job->matches(), replacement);
+        ImGui::EndDisabled();
+      }
+
+      if (!error.empty())
+        ImGui::TextDisabled("%s", error.c_str());
+      else if (job && job->done())
+        ImGui::Text("%zu matches", job->matches().size());
+      else if (job)
+        ImGui::Text("%zu matches so far, %d%%", job->matches().size(),
+                    (int)(job->progress() * 100));
+    }
+    ImGui::End();
+  }
+
+private:
+  bool visible = false;
+  bool replacing = false; // shows the Replace fields
+  bool focusQuery = false;
+  bool pendingNext = false;
+  std::string query;
+  std::string replacement;
+  bool matchCase = false;
+  bool regex = false;
+
+  std::unique_ptr<SearchJob> job; // null if there is nothing to search for
+  std::string error;              // why query didn't compile
+  // What job searches for
+  bool searched = false;
+  std::string searchedQuery;
+  bool searchedCase = false, searchedRegex = false;
+  uint64_t searchedVersion = 0;
+
+  void restart(TextEditor &editor) {
+    job.reset(); // stops the previous search
+    error.clear();
+    searched = true;
+    searchedQuery = query;
+    searchedCase = matchCase;
+    searchedRegex = regex;
+    searchedVersion = editor.buffer.version();
+    if (query.empty())
+      return;
+    std::shared_ptr<SearchPattern> pattern =
+        SearchPattern::compile(query, regex, matchCase, error);
+    if (pattern)
+      job = std::make_unique<SearchJob>(std::move(pattern),
+                                        editor.buffer.snapshot());
+  }
+
+  void selectNext(TextEditor &editor) {
+    if (!job) {
+      pendingNext = false;
+      return;
+    }
+    const std::vector<TextRange> &matches = job->matches();
+    size_t from = editor.selectionEnd();
+    auto next = std::partition_point(
+        matches.begin(), matches.end(),
+        [from](const TextRange &match) { return match.begin < from; });
+    if (next != matches.end()) {
+      editor.select(next->begin, next->end);
+      pendingNext = false;
+    } else if (job->done()) {
+      if (!matches.empty())
+        editor.select(matches.front().begin, matches.front().end);
+      pendingNext = false;
+    }
+  }
+
+  // Replaces the selection if it is a match, then moves on to the next one
+  void replace(TextEditor &editor) {
+    if (job && editor.buffer.version() == searchedVersion) {
+      const std::vector<TextRange> &matches = job->matches();
+      size_t start = editor.selectionStart();
+      auto match = std::partition_point(
+          matches.begin(), matches.end(),
+          [start](const TextRange &range) { return range.begin < start; });
+      if (match != matches.end() && match->begin == start &&
+          match->end == editor.selectionEnd())
+        editor.insert(replacement);
+    }
+    findNext();
+  }
+};
+
+// Runs WriteFileAtomically on its own thread, so saving a large document
+// doesn't stall the UI. It works from a PieceSnapshot, so the editor keeps
+// taking edits meanwhile; those just aren't part of the file being written.
+class BackgroundSaver {
+public:
+  // Starts saving snapshot to path in encoding; false if a save is still
+  // running
+  bool start(PieceSnapshot snapshot, std::string path, Encoding encoding) {
+    if (busy())
+      return false;
+    worker = {}; // joins the finished previous save, if any
+    target = std::move(path);
+    error.clear();
+    total = snapshot.size;
+    written = 0;
+    finished = false;
+    worker = std::jthread([this, snapshot = std::move(snapshot), encoding] {
+      // Plain UTF-8 is written straight from the pieces
+      OutputConverter convert;
+      if (encoding != ENCODING_UTF8)
+        convert = [encoder = Encoder(encoding)](std::string_view piece,
+                                                std::string &out) mutable {
+          if (piece.empty())
+            encoder.finish(out);
+          else
+            encoder.write(piece, out);
+        };
+      WriteFileAtomically(target, snapshot, written, error, convert);
+      finished.store(true, std::memory_order_release);
+    });
+    return true;
+  }
+
+  bool busy() const {
+    return worker.joinable() && !finished.load(std::memory_order_acquire);
+  }
+
+  float progress() const {
+    size_t done = written.load(std::memory_order_relaxed);
+    return total > 0 ? (float)done / total : 1.0f;
+  }
+
+  // Returns true once per save, when it has finished; failure is then the
+  // reason it failed, or empty if the file was saved
+  bool poll(std::string &failure) {
+    if (!worker.joinable() || !finished.load(std::memory_order_acquire))
+      return false;
+    worker.join();
+    failure = error;
+    return true;
+  }
+
+  const std::string &path() const { return target; }
+
+private:
+  std::string target;
+  std::string error; // written by the worker, read after finished
+  size_t total = 0;
+  std::atomic<size_t> written = 0;
+  std::atomic<bool> finished = false;
+  std::jthread worker; // last, so it is joined before the rest goes away
+};
+
+// Self-test: a long random editing session on a PieceTable with its undo
+// journal, mirrored in a std::string. Each step is a run of keystrokes
+// (merged into one entry), a paste over a selection or a replace-all, and
+// must undo back to the text before it and redo forward again; wandering
+// through the history must only ever give back earlier texts. The small
+// limit keeps the arena growing, moving payloads and trimming throughout.
+static bool CheckJournal(uint64_t seed, int steps) {
+  constexpr size_t LIMIT = 16 << 10;
+
+  std::mt19937_64 rng(seed);
+  auto random = [&rng](size_t n) { return n > 0 ? (size_t)(rng() % n) : 0; };
+  PieceTable table;
+  EditJournal journal(LIMIT);
+  std::string doc;
+  std::hash<std::string> hash;
+  std::unordered_set<size_t> seen{hash(doc)}; // every text between steps
+  auto edit = [&](size_t pos, size_t count, std::string_view text) {
+    journal.record(table, pos, count, text);
+    table.erase(pos, count);
+    table.insert(pos, text);
+    doc.replace(pos, count, text);
+  };
+  auto fail = [seed](int step, const char *what) {
+    std::cerr << "journal (seed " << seed << ") step " << step << ": " << what
+              << "\n";
+    return false;
+  };
+
+  for (int step = 0; step < steps; ++step) {
+    std::string before = doc;
+    size_t action = random(10);
+    journal.seal(); // so each step is one entry
+    if (action < 4) { // typing, Backspace or Delete
+      size_t pos = random(doc.size() + 1), kind = random(3);
+      for (size_t keys = 1 + random(40); keys > 0; --keys) {
+        if (kind == 0) {
+          char c = "abc \t"[random(5)];
+          edit(pos++, 0, std::string_view(&c, 1));
+        } else if (kind == 1 && pos > 0) {
+          edit(--pos, 1, {});
+        } else if (kind == 2 && pos < doc.size()) {
+          edit(pos, 1, {});
+        }
+      }
+    } else if (action < 6) { // paste over a selection
+      size_t pos = random(doc.size() + 1);
+      size_t count = random(std::min<size_t>(doc.size() - pos, 64) + 1);
+      std::string text(random(200), 'x');
+      for (char &c : text)
+        c = "xyz\n"[random(4)];
+      edit(pos, count, text);
+    } else if (action < 7) { // replace all
+      char from = "abc"[random(3)];
+      std::string to(random(3), 'y');
+      std::vector<TextRange> ranges;
+      for (size_t at = doc.find(from); at != doc.npos;
+           at = doc.find(from, at + 1))
+        ranges.push_back({at, at + 1});
+      journal.recordAll(table, ranges, to);
+      table.replaceAll(ranges, to);
+      for (size_t r = ranges.size(); r-- > 0;)
+        doc.replace(ranges[r].begin, 1, to);
+    } else { // undo or redo a few entries
+      bool back = random(2) == 0;
+      for (size_t moves = 1 + random(5); moves > 0; --moves) {
+        TextRange changed;
+        if (!(back ? journal.undo(table, changed)
+                   : journal.redo(table, changed)))
+          break;
+        doc = table.text(0, table.size());
+        if (!seen.count(hash(doc)))
+          return fail(step, "history gave a text never seen");
+        if (changed.begin > changed.end || changed.end > doc.size())
+          return fail(step, "changed range outside the document");
+      }
+      before = doc;
+    }
+
+    if (table.text(0, table.size()) != doc)
+      return fail(step, "document differs from the reference");
+    if (doc != before) {
+      std::string after = doc;
+      TextRange changed;
+      if (!journal.undo(table, changed) ||
+          table.text(0, table.size()) != before)
+        return fail(step, "undo did not restore the text");
+      if (!journal.redo(table, changed) ||
+          table.text(0, table.size()) != after)
+        return fail(step, "redo did not reapply the edit");
+    }
+    seen.insert(hash(doc));
+    if (doc.size() > 2048) { // keeps comparing the texts cheap
+      edit(0, doc.size() - 1024, {});
+      seen.insert(hash(doc));
+    }
+    if (journal.memoryUsed() > LIMIT)
+      return fail(step, "history over its memory limit");
+  }
+  return true;
+}
+
+// Self-test: random edits to a C++ document, each followed by lexing up to
+// a random line, as scrolling around while editing does. Every state the
+// highlighter reports as exact must match lexing the text from the top.
+static bool CheckHighlighter(uint64_t seed, int trials) {
+  constexpr int EDITS = 30;
+  constexpr const char *PIECES[] = {"/*", "*/", "\"", "\\", "//", "R\"(",
+                                    ")\"", "x", " ", "\n", "\n", "\n"};
+
+  std::mt19937_64 rng(seed);
+  auto random = [&rng](size_t n) { return n > 0 ? (size_t)(rng() % n) : 0; };
+  auto text = [&random, &PIECES](size_t pieces) {
+    std::string out;
+    while (pieces-- > 0)
+      out += PIECES[random(std::size(PIECES))];
+    return out;
+  };
+
+  for (int trial = 0; trial < trials; ++trial) {
+    PieceTable table;
+    table.assign(text(200));
+    Highlighter highlighter;
+    highlighter.setLanguage(LANGUAGE_CPP);
+    for (int step = 0; step < EDITS; ++step) {
+      size_t pos = random(table.size() + 1);
+      size_t count = random(std::min<size_t>(table.size() - pos, 8) + 1);
+      std::string inserted = text(random(4));
+      size_t lines = table.lineCount();
+      table.erase(pos, count);
+      table.insert(pos, inserted);
+      highlighter.edited(table.lineOf(pos),
+                         table.lineOf(pos + inserted.size()), lines,
+                         table.lineCount());
+      size_t lastLine = random(table.lineCount());
+      highlighter.update(table, lastLine, std::chrono::seconds(1));
+
+      LexState state = 0;
+      for (size_t line = 0; line <= lastLine; ++line) {
+        if (highlighter.stateAt(line) != state) {
+          std::cerr << "highlighter (seed " << seed << ") trial " << trial
+                    << " step " << step << ": wrong state at line " << line
+                    << "\n";
+          return false;
+        }
+        std::string block =
+            table.text(table.lineStart(line), Highlighter::MAX_LINE);
+        std::string_view rest(block.data(),
+                              std::min(block.find('\n'), block.size()));
+        if (!rest.empty() && rest.back() == '\r')
+          rest.remove_suffix(1);
+        state = LexLine(LANGUAGE_CPP, state, rest, nullptr);
+      }
+    }
+  }
+  return true;
+}
+
+// notepad --selftest: headless checks of the editing machinery
+static int RunSelfTest() {
+  constexpr int JOURNAL_STEPS = 200000;
+  constexpr int HIGHLIGHTER_TRIALS = 3000;
+
+  bool journal = CheckJournal(1, JOURNAL_STEPS);
+  std::cerr << "journal: " << (journal ? "ok" : "FAILED") << "\n";
+  bool highlighter = CheckHighlighter(1, HIGHLIGHTER_TRIALS);
+  std::cerr << "highlighter: " << (highlighter ? "ok" : "FAILED") << "\n";
+  return journal && highlighter ? 0 : 1;
+}
+
+// A document of about size bytes of numbered lines, cut into many pieces
+// by scattered edits the way a long editing session leaves it
+static void FillBenchDocument(PieceTable &table, size_t size,
+                              std::mt19937_64 &rng) {
+  constexpr size_t EDITS = 10000;
+
+  std::string text;
+  text.reserve(size + 64);
+  for (size_t line = 1; text.size() < size; ++line)
+    text += "Line " + std::to_string(line) +
+            ": the quick brown fox jumps over the lazy dog\n";
+  table.assign(std::move(text));
+  for (size_t i = 0; i < EDITS; ++i)
+    table.insert(rng() % table.size(), "edit");
+}
+
+// Saves a 128 MiB document in pieces through BackgroundSaver, as UTF-8 and
+// as UTF-16, while the document keeps being edited about once a
+// millisecond, and checks the UTF-8 file against the text
+static bool BenchSave(std::mt19937_64 &rng) {
+  constexpr size_t SIZE = 128 << 20;
+  constexpr Encoding ENCODINGS[] = {ENCODING_UTF8, ENCODING_UTF16LE};
+
+  PieceTable table;
+  FillBenchDocument(table, SIZE, rng);
+  std::string path =
+      (std::filesystem::temp_directory_path() / "notepad-bench.txt").string();
+  bool ok = true;
+  for (Encoding encoding : ENCODINGS) {
+    std::string expected = table.text(0, table.size());
+    BackgroundSaver saver;
+    auto start = std::chrono::steady_clock::now();
+    saver.start(table.snapshot(), path, encoding);
+    size_t edits = 0;
+    std::string failure;
+    while (!saver.poll(failure)) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      table.insert(rng() % table.size(), "x");
+      ++edits;
+    }
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    std::string error;
+    auto file = MappedFile::open(path.c_str(), error);
+    // The UTF-16 file is a byte order mark and two bytes per ASCII byte
+    std::string_view saved = file ? std::string_view(file->data(),
+                                                     file->size())
+                                  : std::string_view();
+    bool matches = file && (encoding == ENCODING_UTF8
+                                ? saved == expected
+                                : saved.size() == 2 + 2 * expected.size());
+    ok = ok && failure.empty() && matches;
+    std::cerr << "save " << EncodingNames[encoding] << ": "
+              << expected.size() / seconds / 1e6 << " MB/s of text, "
+              << edits << " edits meanwhile"
+              << (!failure.empty() ? ", FAILED: " + failure
+                  : matches        ? ""
+                                   : ", FAILED: file differs")
+              << "\n";
+  }
+  std::filesystem::remove(path);
+  return ok;
+}
+
+// Replays a synthetic editing trace on a 512 MiB document: runs of typing
+// and Backspace at a cursor that mostly stays put and sometimes jumps,
+// with Enter, pastes and deleted selections mixed in. Each edit is timed
+// together with finding the cursor's line and where it starts, as drawing
+// the next frame does; one insert into the middle of a std::string of the
+// same size is timed for comparison.
+static void BenchEdits(std::mt19937_64 &rng) {
+  constexpr size_t SIZE = 512 << 20;
+  constexpr int EDITS = 200000;
+
+  PieceTable table;
+  FillBenchDocument(table, SIZE, rng);
+  std::vector<double> times(EDITS);
+  size_t cursor = table.size() / 2, lines = 0;
+  for (double &time : times) {
+    size_t action = rng() % 100;
+    auto start = std::chrono::steady_clock::now();
+    if (action < 70) {
+      table.insert(cursor++, "a");
+    } else if (action < 80) {
+      if (cursor > 0)
+        table.erase(--cursor, 1);
+    } else if (action < 85) {
+      table.insert(cursor++, "\n");
+    } else if (action < 90) {
+      std::string_view paste = "a pasted line of text\n";
+      table.insert(cursor, paste);
+      cursor += paste.size();
+    } else if (action < 95) {
+      table.erase(cursor, 1 + rng() % 200);
+    } else if (action < 99) { // clicking nearby
+      size_t jump = rng() % 4096;
+      cursor = jump < 2048 ? cursor - std::min(cursor, jump)
+                           : std::min(table.size(), cursor + jump - 2048);
+    } else {
+      cursor = rng() % table.size();
+    }
+    size_t line = table.lineOf(cursor);
+    lines += table.lineStart(line) <= cursor;
+    time = std::chrono::duration<double, std::micro>(
+               std::chrono::steady_clock::now() - start)
+               .count();
+  }
+  std::sort(times.begin(), times.end());
+
+  std::string flat = table.text(0, table.size());
+  flat.reserve(flat.size() + 1); // times moving the text, not growing it
+  auto start = std::chrono::steady_clock::now();
+  flat.insert(flat.size() / 2, "a");
+  double flatTime = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+  std::cerr << "edits on " << (SIZE >> 20) << " MiB: p50 "
+            << times[EDITS / 2] << " us, p99 " << times[EDITS * 99 / 100]
+            << " us, max " << times.back() << " us per edit and line lookup ("
+            << table.pieceCount() << " pieces, " << lines << " lookups)\n"
+            << "one insert into a std::string: " << flatTime << " ms\n";
+}
+
+// notepad --bench: times the editing machinery on large documents
+static int RunBench() {
+  std::mt19937_64 rng(1);
+  BenchEdits(rng);
+  return BenchSave(rng) ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1 && strcmp(argv[1], "--selftest") == 0)
+    return RunSelfTest();
+  if (argc > 1 && strcmp(argv[1], "--bench") == 0)
+    return RunBench();
+
   SetConfigFlags(FLAG_WINDOW_RESIZABLE);
   InitWindow(800, 600, "Untitled - Notepad");
   SetWindowMinSize(640, 480);
@@ -38,8 +1325,58 @@ int main() {
 
   ImGui::GetStyle().FontScaleMain = 2;
 
-  std::string text;
+  TextEditor editor;
   bool show_status = true;
+  std::string path;       // file being edited, empty if untitled
+  Encoding encoding = ENCODING_UTF8; // of the file, and to save in
+  std::string open_path;  // contents of the Open dialog
+  std::string open_error; // why the last open failed
+  bool show_open = false;
+  int goto_line = 1; // contents of the Go To dialog, 1-based
+  bool show_goto = false;
+  SearchPanel search;
+  BackgroundSaver saver;
+  std::string save_path;  // contents of the Save as dialog
+  std::string save_error; // why the last save failed
+  bool show_save = false;
+  uint64_t saved_version = editor.buffer.version(); // unmodified if equal
+  uint64_t saving_version = 0; // version being written by saver
+  std::string title = "Untitled - Notepad";
+
+  auto open = [&editor, &path, &encoding,
+               &saved_version](const std::string &file_path,
+                               std::string &error) {
+    std::shared_ptr<MappedFile> file =
+        MappedFile::open(file_path.c_str(), error);
+    if (!file)
+      return false;
+    // UTF-8 is edited straight from the mapping, the rest is converted
+    size_t bom;
+    encoding = DetectEncoding(file->data(), file->size(), bom);
+    if (encoding == ENCODING_UTF8 || encoding == ENCODING_UTF8_BOM)
+      editor.open(std::move(file), bom);
+    else
+      editor.decode(*file, bom, encoding);
+    editor.setLanguage(LanguageOf(file_path));
+    path = file_path;
+    saved_version = editor.buffer.version();
+    return true;
+  };
+
+  // Saving happens in the background; the result is picked up by poll().
+  // False if the previous save is still running.
+  auto save = [&editor, &saver, &encoding,
+               &saving_version](const std::string &file_path) {
+    if (saver.busy())
+      return false;
+    saving_version = editor.buffer.version();
+    return saver.start(editor.buffer.snapshot(), file_path, encoding);
+  };
+
+  if (argc > 1 && !open(argv[1], open_error)) {
+    open_path = argv[1];
+    show_open = true;
+  }
 
   while (!WindowShouldClose()) {
     BeginDrawing();
@@ -47,6 +1384,29 @@ int main() {
 
     rlImGuiBegin();
 
+    std::string failure;
+    if (saver.poll(failure)) {
+      if (failure.empty()) {
+        if (saver.path() != path) // saved under a new name
+          editor.setLanguage(LanguageOf(saver.path()));
+        path = saver.path();
+        saved_version = saving_version;
+      } else {
+        save_path = saver.path();
+        save_error = failure;
+        show_save = true;
+      }
+    }
+
+    std::string new_title =
+        (path.empty() ? std::string("Untitled")
+                      : std::filesystem::path(path).filename().string()) +
+        (editor.buffer.version() != saved_version ? "*" : "") + " - Notepad";
+    if (new_title != title) {
+      title = std::move(new_title);
+      SetWindowTitle(title.c_str());
+    }
+
     if (IsWindowResized()) {
       ImGui::SetNextWindowPos(ImVec2(0, 20));
       ImGui::SetNextWindowSize(
@@ -55,17 +1415,36 @@ int main() {
     if (ImGui::Begin("##empty", nullptr, ImGuiWindowFlags_MenuBar)) {
       if (ImGui::BeginMenuBar()) {
         if (ImGui::BeginMenu("File")) {
-          if (ImGui::MenuItem("New", "Ctrl+N")) {
-            // TODO
+          // The document can't be swapped out or saved again mid-save
+          bool idle = !saver.busy();
+          if (ImGui::MenuItem("New", "Ctrl+N", false, idle)) {
+            // TODO: check if file is saved
+            editor.setText("");
+            editor.setLanguage(LANGUAGE_NONE);
+            path.clear();
+            encoding = ENCODING_UTF8;
+            saved_version = editor.buffer.version();
           }
-          if (ImGui::MenuItem("Open...", "Ctrl+O")) {
-            // TODO
+          if (ImGui::MenuItem("Open...", "Ctrl+O", false, idle)) {
+            open_path = path;
+            open_error.clear();
+            show_open = true;
           }
-          if (ImGui::MenuItem("Save", "Ctrl+S")) {
-            // TODO
+          if (ImGui::MenuItem("Save", "Ctrl+S", false, idle)) {
+            if (path.empty())
+              show_save = true;
+            else
+              save(path);
           }
-          if (ImGui::MenuItem("Save as...", "Ctrl+Shift+S")) {
-            // TODO
+          if (ImGui::MenuItem("Save as...", "Ctrl+Shift+S", false, idle))
+            show_save = true;
+          // What the next save writes
+          if (ImGui::BeginMenu("Encoding")) {
+            for (int i = 0; i < ENCODING_COUNT; ++i) {
+              if (ImGui::MenuItem(EncodingNames[i], nullptr, encoding == i))
+                encoding = (Encoding)i;
+            }
+            ImGui::EndMenu();
           }
           ImGui::Separator();
           if (ImGui::MenuItem("Print...", "Ctrl+P")) {
@@ -85,32 +1464,38 @@ int main() {
           ImGui::EndMenu();
         }
         if (ImGui::BeginMenu("Edit")) {
-          if (ImGui::MenuItem("Undo", "Ctrl+Z")) {
-            // nop
+          if (ImGui::MenuItem("Undo", "Ctrl+Z", false,
+                              editor.journal.canUndo())) {
+            editor.undo();
+          }
+          if (ImGui::MenuItem("Redo", "Ctrl+Y", false,
+                              editor.journal.canRedo())) {
+            editor.redo();
           }
           ImGui::Separator();
           if (ImGui::MenuItem("Cut", "Ctrl+X")) {
-            // nop
+            editor.cut();
           }
           if (ImGui::MenuItem("Copy", "Ctrl+C")) {
-            // nop
+            editor.copy();
           }
           if (ImGui::MenuItem("Paste", "Ctrl+V")) {
-            // nop
+            editor.paste();
           }
           if (ImGui::MenuItem("Delete", "Del")) {
-            // nop
+            editor.eraseSelection();
           }
           ImGui::Separator();
           if (ImGui::MenuItem("Select all", "Ctrl+A")) {
-            // nop
+            editor.selectAll();
           }
           if (ImGui::MenuItem("Time/Date")) {
-            text += GetCurrentDateTime();
+            editor.insert(GetCurrentDateTime());
           }
           ImGui::Separator();
-          if (ImGui::MenuItem("Wrap long lines")) {
-            // nop
+          if (ImGui::MenuItem("Wrap long lines", nullptr,
+                              editor.wrapping())) {
+            editor.setWrapping(!editor.wrapping());
           }
           if (ImGui::MenuItem("Font...")) {
             // nop
@@ -119,16 +1504,16 @@ int main() {
         }
         if (ImGui::BeginMenu("Search")) {
           if (ImGui::MenuItem("Search...", "Ctrl+F")) {
-            // TODO
+            search.show(false);
           }
           if (ImGui::MenuItem("Search next", "F3")) {
-            // TODO
+            search.findNext();
           }
           if (ImGui::MenuItem("Replace...", "Ctrl+H")) {
-            // TODO
+            search.show(true);
           }
           if (ImGui::MenuItem("Go To...", "Ctrl+G")) {
-            // TODO
+            show_goto = true;
           }
           ImGui::EndMenu();
         }
@@ -136,6 +1521,14 @@ int main() {
           if (ImGui::MenuItem("Status Bar", nullptr, show_status)) {
             show_status = !show_status;
           }
+          if (ImGui::BeginMenu("Syntax")) {
+            for (int i = 0; i < LANGUAGE_COUNT; ++i) {
+              if (ImGui::MenuItem(LanguageNames[i], nullptr,
+                                  editor.language() == i))
+                editor.setLanguage((Language)i);
+            }
+            ImGui::EndMenu();
+          }
           ImGui::EndMenu();
         }
         if (ImGui::BeginMenu("Help")) {
@@ -150,22 +1543,127 @@ int main() {
         ImGui::EndMenuBar();
       }
 
+      if (ImGui::IsKeyChordPressed(ImGuiMod_Ctrl | ImGuiKey_G))
+        show_goto = true;
+      if (ImGui::IsKeyChordPressed(ImGuiMod_Ctrl | ImGuiKey_F))
+        search.show(false);
+      if (ImGui::IsKeyChordPressed(ImGuiMod_Ctrl | ImGuiKey_H))
+        search.show(true);
+      if (ImGui::IsKeyPressed(ImGuiKey_F3, false))
+        search.findNext();
+      if (!saver.busy()) {
+        if (ImGui::IsKeyChordPressed(ImGuiMod_Ctrl | ImGuiKey_S)) {
+          if (path.empty())
+            show_save = true;
+          else
+            save(path);
+        }
+        if (ImGui::IsKeyChordPressed(ImGuiMod_Ctrl | ImGuiMod_Shift |
+                                     ImGuiKey_S))
+          show_save = true;
+      }
+      if (show_goto) {
+        ImGui::OpenPopup("Go To Line");
+        goto_line = (int)editor.cursorLine() + 1;
+        show_goto = false;
+      }
+      if (ImGui::BeginPopupModal("Go To Line", nullptr,
+                                 ImGuiWindowFlags_AlwaysAutoResize)) {
+        if (ImGui::IsWindowAppearing())
+          ImGui::SetKeyboardFocusHere();
+        bool submit = ImGui::InputInt("Line number", &goto_line, 1, 100,
+                                      ImGuiInputTextFlags_EnterReturnsTrue);
+        size_t lines = editor.buffer.lineCount();
+        if (editor.buffer.indexing())
+          ImGui::TextDisabled("Still counting lines, %zu found so far", lines);
+        if (ImGui::Button("Go To") || submit) {
+          editor.goToLine((size_t)std::max(goto_line, 1) - 1);
+          ImGui::CloseCurrentPopup();
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Cancel"))
+          ImGui::CloseCurrentPopup();
+        ImGui::EndPopup();
+      }
+
+      if (show_open) {
+        ImGui::OpenPopup("Open");
+        show_open = false;
+      }
+      if (ImGui::BeginPopupModal("Open", nullptr,
+                                 ImGuiWindowFlags_AlwaysAutoResize)) {
+        if (ImGui::IsWindowAppearing())
+          ImGui::SetKeyboardFocusHere();
+        bool submit = InputTextString("Path", &open_path,
+                                      ImGuiInputTextFlags_EnterReturnsTrue);
+        if (!open_error.empty())
+          ImGui::TextDisabled("%s", open_error.c_str());
+        if (ImGui::Button("Open") || submit) {
+          open_error.clear();
+          if (open(open_path, open_error))
+            ImGui::CloseCurrentPopup();
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Cancel"))
+          ImGui::CloseCurrentPopup();
+        ImGui::EndPopup();
+      }
+
+      if (show_save) {
+        ImGui::OpenPopup("Save as");
+        if (save_path.empty())
+          save_path = path;
+        show_save = false;
+      }
+      if (ImGui::BeginPopupModal("Save as", nullptr,
+                                 ImGuiWindowFlags_AlwaysAutoResize)) {
+        if (ImGui::IsWindowAppearing())
+          ImGui::SetKeyboardFocusHere();
+        bool submit = InputTextString("Path", &save_path,
+                                      ImGuiInputTextFlags_EnterReturnsTrue);
+        if (!save_error.empty())
+          ImGui::TextDisabled("%s", save_error.c_str());
+        if ((ImGui::Button("Save") || submit) && !save_path.empty() &&
+            save(save_path)) {
+          save_path.clear();
+          save_error.clear();
+          ImGui::CloseCurrentPopup();
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Cancel")) {
+          save_path.clear();
+          save_error.clear();
+          ImGui::CloseCurrentPopup();
+        }
+        ImGui::EndPopup();
+      }
+
       ImVec2 avail = ImGui::GetContentRegionAvail();
       avail.y -= show_status ? 30 : 0;
-      InputTextMultilineString("##empty", &text, avail);
+      search.update(editor);
+      editor.draw("##editor", avail);
 
       if (show_status) {
         ImGui::BeginChild("##status", ImVec2(0, 30), false,
                           ImGuiWindowFlags_NoScrollbar |
                               ImGuiWindowFlags_NoSavedSettings |
                               ImGuiWindowFlags_NoTitleBar);
-        long lines = std::count(text.begin(), text.end(), '\n') + 1;
-        ImGui::Text("%ld lines, %ld characters", lines,
-                    text.size() - lines + 1);
+        size_t lines = editor.buffer.lineCount();
+        if (saver.busy())
+          ImGui::Text("Saving... %d%%", (int)(saver.progress() * 100));
+        else if (editor.buffer.indexing())
+          ImGui::Text("Counting lines... %d%%",
+                      (int)(editor.buffer.indexProgress() * 100));
+        else
+          ImGui::Text("Ln %zu, Col %zu | %zu lines, %zu characters | %s",
+                      editor.cursorLine() + 1, editor.cursorColumn() + 1, lines,
+                      editor.buffer.charCount() - (lines - 1),
+                      EncodingNames[encoding]);
         ImGui::EndChild();
       }
     }
     ImGui::End();
+    search.draw(editor);
 
     rlImGuiEnd();
 
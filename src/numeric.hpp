@@ -0,0 +1,716 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+inline bool IsDigit(char c) { return c >= '0' && c <= '9'; }
+
+// A decimal literal split into its parts, delimited the same way
+// std::from_chars(chars_format::general) delimits it
+struct DecimalLiteral {
+  const char *int_first, *int_last;   // integer digits
+  const char *frac_first, *frac_last; // fraction digits
+  long long exponent;
+};
+
+inline std::from_chars_result ScanLiteral(const char *first, const char *last,
+                                          DecimalLiteral &literal) {
+  constexpr long long MAX_EXPONENT = 1000000000;
+
+  const char *p = first;
+  literal.int_first = p;
+  while (p < last && IsDigit(*p))
+    ++p;
+  literal.int_last = literal.frac_first = literal.frac_last = p;
+  if (p < last && *p == '.') {
+    literal.frac_first = ++p;
+    while (p < last && IsDigit(*p))
+      ++p;
+    literal.frac_last = p;
+  }
+  if (literal.int_first == literal.int_last &&
+      literal.frac_first == literal.frac_last)
+    return {first, std::errc::invalid_argument};
+
+  // An exponent without digits is not part of the literal
+  literal.exponent = 0;
+  if (p < last && (*p == 'e' || *p == 'E')) {
+    const char *q = p + 1;
+    bool negative = false;
+    if (q < last && (*q == '+' || *q == '-'))
+      negative = *q++ == '-';
+    if (q < last && IsDigit(*q)) {
+      long long exponent = 0;
+      for (; q < last && IsDigit(*q); ++q)
+        exponent = std::min(exponent * 10 + (*q - '0'), MAX_EXPONENT);
+      literal.exponent = negative ? -exponent : exponent;
+      p = q;
+    }
+  }
+  return {p, std::errc()};
+}
+
+// Signed fixed-point decimal with 18 fractional digits in a 128-bit integer
+// (about ±1.7e20). Addition and subtraction are exact, multiplication and
+// division round half away from zero at the last digit, and overflow throws
+// instead of silently dropping digits.
+class Decimal128 {
+  using u128 = unsigned __int128;
+
+  __int128 raw = 0; // value * SCALE
+
+public:
+  static constexpr int DIGITS = 18;
+  static constexpr uint64_t SCALE = 1000000000000000000ull;
+
+  Decimal128() = default;
+  Decimal128(long long integer) : raw((__int128)integer * SCALE) {}
+
+  friend std::from_chars_result ScanNumber(const char *first, const char *last,
+                                           Decimal128 &value) {
+    DecimalLiteral literal;
+    auto result = ScanLiteral(first, last, literal);
+    if (result.ec != std::errc())
+      return result;
+
+    // Weight (power of ten of a raw unit) of the digit being looked at
+    long long weight = (literal.int_last - literal.int_first) - 1 +
+                       literal.exponent + DIGITS;
+    u128 acc = 0;
+    bool round_up = false;
+    for (const char *p = literal.int_first; weight >= -1; ++p, --weight) {
+      if (p == literal.int_last)
+        p = literal.frac_first;
+      if (p == literal.frac_last)
+        break;
+      if (weight == -1) {
+        round_up = *p >= '5';
+        break;
+      }
+      if (!MulAdd(acc, 10, *p - '0'))
+        return {first, std::errc::result_out_of_range};
+    }
+    // Digits may run out above the units position (e.g. "12e5")
+    for (; acc != 0 && weight >= 0; --weight) {
+      if (!MulAdd(acc, 10, 0))
+        return {first, std::errc::result_out_of_range};
+    }
+    if (round_up && !MulAdd(acc, 1, 1))
+      return {first, std::errc::result_out_of_range};
+
+    value.raw = (__int128)acc;
+    return result;
+  }
+
+  std::string to_string() const {
+    u128 magnitude = raw < 0 ? -(u128)raw : (u128)raw;
+    std::string fraction = Digits(magnitude % SCALE);
+    fraction.insert(0, DIGITS - fraction.size(), '0');
+    fraction.erase(fraction.find_last_not_of('0') + 1);
+
+    std::string str = raw < 0 ? "-" : "";
+    str += Digits(magnitude / SCALE);
+    if (!fraction.empty())
+      str += "." + fraction;
+    return str;
+  }
+
+  Decimal128 &operator+=(const Decimal128 &other) {
+    if (__builtin_add_overflow(raw, other.raw, &raw))
+      throw std::overflow_error("Decimal overflow");
+    return *this;
+  }
+
+  Decimal128 &operator-=(const Decimal128 &other) {
+    if (__builtin_sub_overflow(raw, other.raw, &raw))
+      throw std::overflow_error("Decimal overflow");
+    return *this;
+  }
+
+  Decimal128 &operator*=(const Decimal128 &other) {
+    u128 hi, lo;
+    MulWide(Magnitude(raw), Magnitude(other.raw), hi, lo);
+
+    // (hi:lo) / SCALE, one 64-bit word at a time
+    uint64_t words[4] = {(uint64_t)(hi >> 64), (uint64_t)hi,
+                         (uint64_t)(lo >> 64), (uint64_t)lo};
+    u128 rem = 0;
+    for (uint64_t &word : words) {
+      u128 cur = (rem << 64) | word;
+      word = (uint64_t)(cur / SCALE);
+      rem = cur % SCALE;
+    }
+    if (words[0] || words[1])
+      throw std::overflow_error("Decimal overflow");
+    u128 quotient = ((u128)words[2] << 64) | words[3];
+    if (rem * 2 >= SCALE)
+      ++quotient;
+    return assign(quotient, (raw < 0) != (other.raw < 0));
+  }
+
+  Decimal128 &operator/=(const Decimal128 &other) {
+    if (other.raw == 0)
+      throw std::domain_error("Division by zero");
+
+    // (|raw| * SCALE) / |other.raw| by binary long division
+    u128 hi, lo;
+    MulWide(Magnitude(raw), SCALE, hi, lo);
+    u128 divisor = Magnitude(other.raw);
+    u128 quotient = 0, rem = 0;
+    for (int bit = 255; bit >= 0; --bit) {
+      u128 word = bit >= 128 ? hi : lo;
+      bool carry = rem >> 127;
+      rem = (rem << 1) | ((word >> (bit & 127)) & 1);
+      if (quotient >> 127)
+        throw std::overflow_error("Decimal overflow");
+      quotient <<= 1;
+      if (carry || rem >= divisor) {
+        rem -= divisor;
+        quotient |= 1;
+      }
+    }
+    if (rem >= divisor - rem)
+      ++quotient;
+    return assign(quotient, (raw < 0) != (other.raw < 0));
+  }
+
+private:
+  static u128 Magnitude(__int128 value) {
+    return value < 0 ? -(u128)value : (u128)value;
+  }
+
+  Decimal128 &assign(u128 magnitude, bool negative) {
+    if (magnitude > ((u128)1 << 127) - (negative ? 0 : 1))
+      throw std::overflow_error("Decimal overflow");
+    raw = (__int128)(negative ? -magnitude : magnitude);
+    return *this;
+  }
+
+  static bool MulAdd(u128 &acc, unsigned factor, unsigned addend) {
+    constexpr u128 MAX = ((u128)1 << 127) - 1;
+    if (acc > (MAX - addend) / factor)
+      return false;
+    acc = acc * factor + addend;
+    return true;
+  }
+
+  // Full 256-bit product of two 128-bit values
+  static void MulWide(u128 a, u128 b, u128 &hi, u128 &lo) {
+    u128 a0 = (uint64_t)a, a1 = a >> 64;
+    u128 b0 = (uint64_t)b, b1 = b >> 64;
+    u128 p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+    u128 middle = (p00 >> 64) + (uint64_t)p01 + (uint64_t)p10;
+    lo = (middle << 64) | (uint64_t)p00;
+    hi = p11 + (p01 >> 64) + (p10 >> 64) + (middle >> 64);
+  }
+
+  static std::string Digits(u128 value) {
+    std::string str;
+    do {
+      str += char('0' + value % 10);
+      value /= 10;
+    } while (value);
+    std::reverse(str.begin(), str.end());
+    return str;
+  }
+};
+
+// Limb arithmetic behind BigDecimal: magnitudes are base 1e9 limbs, least
+// significant first, with no leading zero limbs (zero is empty)
+namespace bignum {
+
+using Limbs = std::vector<uint32_t>;
+
+constexpr uint32_t BASE = 1000000000;
+constexpr size_t KARATSUBA_THRESHOLD = 32;
+constexpr size_t NTT_THRESHOLD = 4096;
+constexpr uint32_t POW10[] = {1,      10,      100,      1000,     10000,
+                              100000, 1000000, 10000000, 100000000};
+
+inline void Trim(Limbs &a) {
+  while (!a.empty() && a.back() == 0)
+    a.pop_back();
+}
+
+inline int Compare(const Limbs &a, const Limbs &b) {
+  if (a.size() != b.size())
+    return a.size() < b.size() ? -1 : 1;
+  for (size_t i = a.size(); i-- > 0;) {
+    if (a[i] != b[i])
+      return a[i] < b[i] ? -1 : 1;
+  }
+  return 0;
+}
+
+// a += b * BASE^shift
+inline void Add(Limbs &a, const uint32_t *b, size_t n, size_t shift = 0) {
+  if (a.size() < n + shift)
+    a.resize(n + shift, 0);
+  uint32_t carry = 0;
+  for (size_t i = 0; i < n; ++i) {
+    uint32_t sum = a[i + shift] + b[i] + carry;
+    carry = sum >= BASE;
+    a[i + shift] = carry ? sum - BASE : sum;
+  }
+  for (size_t i = n + shift; carry; ++i) {
+    if (i == a.size())
+      a.push_back(0);
+    uint32_t sum = a[i] + carry;
+    carry = sum >= BASE;
+    a[i] = carry ? sum - BASE : sum;
+  }
+}
+
+// a -= b, where a >= b
+inline void Sub(Limbs &a, const uint32_t *b, size_t n) {
+  uint32_t borrow = 0;
+  for (size_t i = 0; i < a.size() && (i < n || borrow); ++i) {
+    int64_t diff = (int64_t)a[i] - (i < n ? b[i] : 0) - borrow;
+    borrow = diff < 0;
+    a[i] = (uint32_t)(borrow ? diff + BASE : diff);
+  }
+  Trim(a);
+}
+
+inline void MulSmall(Limbs &a, uint32_t factor) {
+  uint64_t carry = 0;
+  for (uint32_t &limb : a) {
+    uint64_t cur = (uint64_t)limb * factor + carry;
+    limb = (uint32_t)(cur % BASE);
+    carry = cur / BASE;
+  }
+  while (carry) {
+    a.push_back((uint32_t)(carry % BASE));
+    carry /= BASE;
+  }
+  Trim(a);
+}
+
+// a /= divisor, returning the remainder
+inline uint32_t DivSmall(Limbs &a, uint32_t divisor) {
+  uint64_t rem = 0;
+  for (size_t i = a.size(); i-- > 0;) {
+    uint64_t cur = rem * BASE + a[i];
+    a[i] = (uint32_t)(cur / divisor);
+    rem = cur % divisor;
+  }
+  Trim(a);
+  return (uint32_t)rem;
+}
+
+inline void MulPow10(Limbs &a, size_t exponent) {
+  if (a.empty())
+    return;
+  a.insert(a.begin(), exponent / 9, 0);
+  if (exponent % 9)
+    MulSmall(a, POW10[exponent % 9]);
+}
+
+// Schoolbook product into r, which must hold n + m zeroed limbs. Columns are
+// accumulated in 64 bits and carried every CARRY_ROWS rows instead of after
+// every limb product (each product is below 1e18, so 16 of them plus a
+// carried column still fit).
+inline void MulSchoolbook(const uint32_t *a, size_t n, const uint32_t *b,
+                          size_t m, uint32_t *r) {
+  constexpr size_t CARRY_ROWS = 16;
+
+  std::vector<uint64_t> columns(n + m, 0);
+  auto carry_columns = [&columns]() {
+    uint64_t carry = 0;
+    for (uint64_t &column : columns) {
+      column += carry;
+      carry = column / BASE;
+      column %= BASE;
+    }
+  };
+  for (size_t i = 0; i < n; ++i) {
+    uint64_t *row = columns.data() + i;
+    for (size_t j = 0; j < m; ++j)
+      row[j] += (uint64_t)a[i] * b[j];
+    if (i % CARRY_ROWS == CARRY_ROWS - 1)
+      carry_columns();
+  }
+  carry_columns();
+  for (size_t i = 0; i < n + m; ++i)
+    r[i] = (uint32_t)columns[i];
+}
+
+// Number-theoretic transforms modulo three NTT-friendly primes (3 is a
+// primitive root of each). The convolution of base 1e9 limbs has columns
+// below min(n, m) * 1e18, which the three primes together recover exactly
+// by the Chinese remainder theorem while min(n, m) < 7e7.
+constexpr uint32_t NTT_PRIMES[] = {998244353, 167772161, 469762049};
+constexpr size_t NTT_MAX_SIZE = size_t(1) << 23;
+
+template <uint32_t MOD> constexpr uint32_t PowMod(uint64_t base, uint64_t exp) {
+  uint64_t result = 1;
+  for (base %= MOD; exp; exp >>= 1, base = base * base % MOD)
+    if (exp & 1)
+      result = result * base % MOD;
+  return (uint32_t)result;
+}
+
+// In-place iterative transform of a power-of-two sized array
+template <uint32_t MOD>
+inline void Ntt(uint32_t *a, size_t size, bool inverse) {
+  for (size_t i = 1, j = 0; i < size; ++i) {
+    size_t bit = size >> 1;
+    for (; j & bit; bit >>= 1)
+      j ^= bit;
+    j |= bit;
+    if (i < j)
+      std::swap(a[i], a[j]);
+  }
+  std::vector<uint32_t> twiddles(size / 2);
+  for (size_t len = 2; len <= size; len <<= 1) {
+    uint64_t root = PowMod<MOD>(3, (MOD - 1) / len);
+    if (inverse)
+      root = PowMod<MOD>(root, MOD - 2);
+    size_t half = len / 2;
+    twiddles[0] = 1;
+    for (size_t j = 1; j < half; ++j)
+      twiddles[j] = (uint32_t)(twiddles[j - 1] * root % MOD);
+    for (size_t i = 0; i < size; i += len) {
+      uint32_t *lo = a + i, *hi = a + i + half;
+      for (size_t j = 0; j < half; ++j) {
+        uint32_t u = lo[j];
+        uint32_t v = (uint32_t)((uint64_t)hi[j] * twiddles[j] % MOD);
+        lo[j] = u + v >= MOD ? u + v - MOD : u + v;
+        hi[j] = u >= v ? u - v : u + MOD - v;
+      }
+    }
+  }
+  if (inverse) {
+    uint64_t scale = PowMod<MOD>(size, MOD - 2);
+    for (size_t i = 0; i < size; ++i)
+      a[i] = (uint32_t)(a[i] * scale % MOD);
+  }
+}
+
+// Cyclic convolution of a and b modulo MOD, size a power of two >= n + m
+template <uint32_t MOD>
+inline std::vector<uint32_t> Convolve(const uint32_t *a, size_t n,
+                                      const uint32_t *b, size_t m,
+                                      size_t size) {
+  std::vector<uint32_t> fa(size, 0), fb(size, 0);
+  for (size_t i = 0; i < n; ++i)
+    fa[i] = a[i] % MOD;
+  for (size_t i = 0; i < m; ++i)
+    fb[i] = b[i] % MOD;
+  Ntt<MOD>(fa.data(), size, false);
+  Ntt<MOD>(fb.data(), size, false);
+  for (size_t i = 0; i < size; ++i)
+    fa[i] = (uint32_t)((uint64_t)fa[i] * fb[i] % MOD);
+  Ntt<MOD>(fa.data(), size, true);
+  return fa;
+}
+
+// Product into r, which must hold n + m limbs, with n + m <= NTT_MAX_SIZE
+inline void MulNtt(const uint32_t *a, size_t n, const uint32_t *b, size_t m,
+                   uint32_t *r) {
+  using u128 = unsigned __int128;
+  constexpr uint64_t P1 = NTT_PRIMES[0], P2 = NTT_PRIMES[1],
+                     P3 = NTT_PRIMES[2];
+  constexpr uint64_t INV_P1 = PowMod<P2>(P1, P2 - 2);
+  constexpr uint64_t INV_P1P2 = PowMod<P3>(P1 * P2 % P3, P3 - 2);
+
+  size_t size = 1;
+  while (size < n + m)
+    size <<= 1;
+  std::vector<uint32_t> r1 = Convolve<P1>(a, n, b, m, size);
+  std::vector<uint32_t> r2 = Convolve<P2>(a, n, b, m, size);
+  std::vector<uint32_t> r3 = Convolve<P3>(a, n, b, m, size);
+
+  // Garner's reconstruction, then carrying the columns into limbs
+  u128 carry = 0;
+  for (size_t i = 0; i < n + m; ++i) {
+    uint64_t x1 = r1[i];
+    uint64_t x2 = (r2[i] + P2 - x1 % P2) * INV_P1 % P2;
+    uint64_t x3 = (r3[i] + 2 * P3 - x1 % P3 - x2 * P1 % P3) % P3 *
+                  INV_P1P2 % P3;
+    carry += x1 + (u128)x2 * P1 + (u128)x3 * (P1 * P2);
+    uint64_t high = (uint64_t)(carry / BASE);
+    r[i] = (uint32_t)(carry - (u128)high * BASE);
+    carry = high;
+  }
+}
+
+// NTT above NTT_THRESHOLD limbs, Karatsuba above KARATSUBA_THRESHOLD limbs,
+// schoolbook below. Unbalanced operands are multiplied in slices of the
+// shorter one.
+inline Limbs Mul(const uint32_t *a, size_t n, const uint32_t *b, size_t m) {
+  if (n < m) {
+    std::swap(a, b);
+    std::swap(n, m);
+  }
+  if (m == 0)
+    return {};
+
+  Limbs r;
+  if (m < KARATSUBA_THRESHOLD) {
+    r.assign(n + m, 0);
+    MulSchoolbook(a, n, b, m, r.data());
+  } else if (m >= NTT_THRESHOLD && n + m <= NTT_MAX_SIZE) {
+    r.assign(n + m, 0);
+    MulNtt(a, n, b, m, r.data());
+  } else if (2 * m <= n) {
+    for (size_t i = 0; i < n; i += m) {
+      Limbs part = Mul(a + i, std::min(m, n - i), b, m);
+      Add(r, part.data(), part.size(), i);
+    }
+  } else {
+    // a = a1 * BASE^h + a0, b = b1 * BASE^h + b0
+    size_t h = n / 2;
+    Limbs z0 = Mul(a, h, b, h);
+    Limbs z2 = Mul(a + h, n - h, b + h, m - h);
+    Limbs sa(a, a + h), sb(b, b + h);
+    Add(sa, a + h, n - h);
+    Add(sb, b + h, m - h);
+    Limbs z1 = Mul(sa.data(), sa.size(), sb.data(), sb.size());
+    Trim(z1);
+    Sub(z1, z0.data(), z0.size());
+    Sub(z1, z2.data(), z2.size());
+
+    r = std::move(z0);
+    Add(r, z1.data(), z1.size(), h);
+    Add(r, z2.data(), z2.size(), 2 * h);
+  }
+  Trim(r);
+  return r;
+}
+
+// q = a / b and r = a % b (b nonzero), Knuth's algorithm D on base 1e9 limbs
+inline void DivMod(const Limbs &a, const Limbs &b, Limbs &q, Limbs &r) {
+  if (Compare(a, b) < 0) {
+    q.clear();
+    r = a;
+    return;
+  }
+  if (b.size() == 1) {
+    q = a;
+    uint32_t rem = DivSmall(q, b[0]);
+    r.clear();
+    if (rem)
+      r.push_back(rem);
+    return;
+  }
+
+  // Scale so the top limb of the divisor is at least BASE / 2
+  uint32_t d = BASE / (b.back() + 1);
+  Limbs u = a, v = b;
+  MulSmall(u, d);
+  MulSmall(v, d);
+  u.resize(a.size() + 1, 0);
+
+  size_t n = v.size(), m = u.size() - n - 1;
+  uint64_t top = v[n - 1], second = v[n - 2];
+  q.assign(m + 1, 0);
+  for (size_t j = m + 1; j-- > 0;) {
+    uint64_t num = (uint64_t)u[j + n] * BASE + u[j + n - 1];
+    uint64_t qhat = num / top, rhat = num % top;
+    while (qhat >= BASE || qhat * second > rhat * BASE + u[j + n - 2]) {
+      --qhat;
+      rhat += top;
+      if (rhat >= BASE)
+        break;
+    }
+
+    // u[j..j+n] -= qhat * v
+    uint64_t carry = 0;
+    int64_t borrow = 0;
+    for (size_t i = 0; i < n; ++i) {
+      uint64_t product = qhat * v[i] + carry;
+      carry = product / BASE;
+      int64_t diff = (int64_t)u[i + j] - (int64_t)(product % BASE) - borrow;
+      borrow = diff < 0;
+      u[i + j] = (uint32_t)(borrow ? diff + BASE : diff);
+    }
+    int64_t diff = (int64_t)u[j + n] - (int64_t)carry - borrow;
+    if (diff < 0) {
+      // qhat was one too large: add v back
+      --qhat;
+      uint32_t add_carry = 0;
+      for (size_t i = 0; i < n; ++i) {
+        uint32_t sum = u[i + j] + v[i] + add_carry;
+        add_carry = sum >= BASE;
+        u[i + j] = add_carry ? sum - BASE : sum;
+      }
+      diff = (diff + BASE + add_carry) % BASE;
+    }
+    u[j + n] = (uint32_t)diff;
+    q[j] = (uint32_t)qhat;
+  }
+  Trim(q);
+
+  r.assign(u.begin(), u.begin() + n);
+  Trim(r);
+  DivSmall(r, d);
+}
+
+} // namespace bignum
+
+// Arbitrary-precision decimal: (-1)^negative * mag * 10^-scale. Addition,
+// subtraction and multiplication are exact; division keeps
+// `division_digits` fractional digits, rounded half away from zero.
+class BigDecimal {
+  bignum::Limbs mag;
+  bool negative = false;
+  size_t scale = 0;
+
+public:
+  static constexpr size_t MAX_DIGITS = 1000000;
+  static inline size_t division_digits = 50;
+
+  BigDecimal() = default;
+  BigDecimal(long long integer) : negative(integer < 0) {
+    unsigned long long magnitude =
+        negative ? 0ull - (unsigned long long)integer : integer;
+    for (; magnitude; magnitude /= bignum::BASE)
+      mag.push_back((uint32_t)(magnitude % bignum::BASE));
+  }
+
+  size_t memory() const { return mag.capacity() * sizeof(uint32_t); }
+
+  friend std::from_chars_result ScanNumber(const char *first, const char *last,
+                                           BigDecimal &value) {
+    DecimalLiteral literal;
+    auto result = ScanLiteral(first, last, literal);
+    if (result.ec != std::errc())
+      return result;
+
+    std::string digits(literal.int_first, literal.int_last);
+    digits.append(literal.frac_first, literal.frac_last);
+    long long scale =
+        (long long)(literal.frac_last - literal.frac_first) - literal.exponent;
+    if (digits.size() + std::max(0ll, -scale) > MAX_DIGITS ||
+        scale > (long long)MAX_DIGITS)
+      return {first, std::errc::result_out_of_range};
+
+    value = BigDecimal();
+    for (size_t end = digits.size(); end > 0; end -= std::min<size_t>(end, 9)) {
+      size_t begin = end - std::min<size_t>(end, 9);
+      uint32_t limb = 0;
+      for (size_t i = begin; i < end; ++i)
+        limb = limb * 10 + (digits[i] - '0');
+      value.mag.push_back(limb);
+    }
+    bignum::Trim(value.mag);
+    if (scale < 0)
+      bignum::MulPow10(value.mag, -scale);
+    value.scale = std::max(0ll, scale);
+    value.normalize();
+    return result;
+  }
+
+  std::string to_string() const {
+    if (mag.empty())
+      return "0";
+
+    std::string digits = std::to_string(mag.back());
+    for (size_t i = mag.size() - 1; i-- > 0;) {
+      std::string limb = std::to_string(mag[i]);
+      digits.append(9 - limb.size(), '0');
+      digits += limb;
+    }
+    if (scale > 0) {
+      if (digits.size() <= scale)
+        digits.insert(0, scale - digits.size() + 1, '0');
+      digits.insert(digits.size() - scale, 1, '.');
+    }
+    return negative ? "-" + digits : digits;
+  }
+
+  BigDecimal &operator+=(const BigDecimal &other) {
+    return add(other, other.negative);
+  }
+
+  BigDecimal &operator-=(const BigDecimal &other) {
+    return add(other, !other.negative);
+  }
+
+  BigDecimal &operator*=(const BigDecimal &other) {
+    mag = bignum::Mul(mag.data(), mag.size(), other.mag.data(),
+                      other.mag.size());
+    scale += other.scale;
+    negative = negative != other.negative;
+    normalize();
+    return *this;
+  }
+
+  BigDecimal &operator/=(const BigDecimal &other) {
+    if (other.mag.empty())
+      throw std::domain_error("Division by zero");
+
+    // mag * 10^shift / other.mag has exactly division_digits fraction digits
+    long long shift = (long long)other.scale + (long long)division_digits -
+                      (long long)scale;
+    bignum::Limbs numerator = mag, denominator = other.mag, rem;
+    if (shift >= 0)
+      bignum::MulPow10(numerator, shift);
+    else
+      bignum::MulPow10(denominator, -shift);
+    bignum::DivMod(numerator, denominator, mag, rem);
+
+    // Round half away from zero: 2 * rem >= denominator
+    bignum::MulSmall(rem, 2);
+    if (bignum::Compare(rem, denominator) >= 0) {
+      const uint32_t one = 1;
+      bignum::Add(mag, &one, 1);
+    }
+
+    scale = division_digits;
+    negative = negative != other.negative;
+    normalize();
+    return *this;
+  }
+
+private:
+  BigDecimal &add(const BigDecimal &other, bool other_negative) {
+    bignum::Limbs rhs = other.mag;
+    if (scale < other.scale) {
+      bignum::MulPow10(mag, other.scale - scale);
+      scale = other.scale;
+    } else {
+      bignum::MulPow10(rhs, scale - other.scale);
+    }
+
+    if (negative == other_negative) {
+      bignum::Add(mag, rhs.data(), rhs.size());
+    } else if (bignum::Compare(mag, rhs) >= 0) {
+      bignum::Sub(mag, rhs.data(), rhs.size());
+    } else {
+      bignum::Sub(rhs, mag.data(), mag.size());
+      mag = std::move(rhs);
+      negative = other_negative;
+    }
+    normalize();
+    return *this;
+  }
+
+  // Drops trailing fractional zeros so equal values have one representation
+  void normalize() {
+    if (mag.empty()) {
+      negative = false;
+      scale = 0;
+      return;
+    }
+
+    size_t zeros = 0;
+    while (zeros / 9 < mag.size() && mag[zeros / 9] == 0)
+      zeros += 9;
+    for (uint32_t limb = mag[zeros / 9]; limb % 10 == 0; limb /= 10)
+      ++zeros;
+    zeros = std::min(zeros, scale);
+    if (zeros == 0)
+      return;
+
+    mag.erase(mag.begin(), mag.begin() + zeros / 9);
+    if (zeros % 9)
+      bignum::DivSmall(mag, bignum::POW10[zeros % 9]);
+    scale -= zeros;
+  }
+};
@@ -0,0 +1,953 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <span>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+// Newline scanning kernels: 16 or 32 bytes are compared against '\n' at once
+// and the match mask is popcounted, so counting runs at memory speed
+inline size_t CountNewlinesScalar(const char *data, size_t size) {
+  size_t count = 0;
+  const char *end = data + size;
+  while ((data = (const char *)memchr(data, '\n', end - data))) {
+    ++count;
+    ++data;
+  }
+  return count;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2,popcnt"))) inline size_t
+CountNewlinesSSE2(const char *data, size_t size) {
+  const __m128i newline = _mm_set1_epi8('\n');
+  size_t count = 0, i = 0;
+  for (; i + 16 <= size; i += 16) {
+    __m128i bytes = _mm_loadu_si128((const __m128i *)(data + i));
+    count += __builtin_popcount(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline)));
+  }
+  return count + CountNewlinesScalar(data + i, size - i);
+}
+
+__attribute__((target("avx2,popcnt"))) inline size_t
+CountNewlinesAVX2(const char *data, size_t size) {
+  const __m256i newline = _mm256_set1_epi8('\n');
+  size_t count = 0, i = 0;
+  for (; i + 64 <= size; i += 64) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(data + i));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(data + i + 32));
+    uint64_t mask =
+        (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, newline)) |
+        (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(b, newline))
+            << 32;
+    count += __builtin_popcountll(mask);
+  }
+  return count + CountNewlinesScalar(data + i, size - i);
+}
+#endif
+
+using CountNewlinesKernel = size_t (*)(const char *, size_t);
+
+// Picks the widest kernel the running CPU supports
+inline CountNewlinesKernel SelectCountNewlines() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+    return CountNewlinesAVX2;
+  if (__builtin_cpu_supports("sse2") && __builtin_cpu_supports("popcnt"))
+    return CountNewlinesSSE2;
+#endif
+  return CountNewlinesScalar;
+}
+
+// Counts '\n' in [data, data + size)
+inline size_t CountNewlines(const char *data, size_t size) {
+  static const CountNewlinesKernel kernel = SelectCountNewlines();
+  return kernel(data, size);
+}
+
+// Code point counting kernels: a UTF-8 character has one byte that isn't a
+// continuation byte (10xxxxxx), so counting those counts characters. As
+// signed bytes, continuation bytes are the ones below -64.
+inline size_t CountCodePointsScalar(const char *data, size_t size) {
+  size_t count = 0;
+  for (size_t i = 0; i < size; ++i)
+    count += (signed char)data[i] >= -64;
+  return count;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2,popcnt"))) inline size_t
+CountCodePointsSSE2(const char *data, size_t size) {
+  const __m128i limit = _mm_set1_epi8(-65);
+  size_t count = 0, i = 0;
+  for (; i + 16 <= size; i += 16) {
+    __m128i bytes = _mm_loadu_si128((const __m128i *)(data + i));
+    count += __builtin_popcount(
+        _mm_movemask_epi8(_mm_cmpgt_epi8(bytes, limit)));
+  }
+  return count + CountCodePointsScalar(data + i, size - i);
+}
+
+__attribute__((target("avx2,popcnt"))) inline size_t
+CountCodePointsAVX2(const char *data, size_t size) {
+  const __m256i limit = _mm256_set1_epi8(-65);
+  size_t count = 0, i = 0;
+  for (; i + 32 <= size; i += 32) {
+    __m256i bytes = _mm256_loadu_si256((const __m256i *)(data + i));
+    count += __builtin_popcount(
+        (uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(bytes, limit)));
+  }
+  return count + CountCodePointsScalar(data + i, size - i);
+}
+#endif
+
+inline CountNewlinesKernel SelectCountCodePoints() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+    return CountCodePointsAVX2;
+  if (__builtin_cpu_supports("sse2") && __builtin_cpu_supports("popcnt"))
+    return CountCodePointsSSE2;
+#endif
+  return CountCodePointsScalar;
+}
+
+// Counts the UTF-8 characters starting in [data, data + size)
+inline size_t CountCodePoints(const char *data, size_t size) {
+  static const CountNewlinesKernel kernel = SelectCountCodePoints();
+  return kernel(data, size);
+}
+
+// Returns the n-th (1-based) '\n' in [data, data + size), or nullptr. Whole
+// 4 KiB blocks are skipped by count before the final memchr walk.
+inline const char *FindNewline(const char *data, size_t size, size_t n) {
+  constexpr size_t BLOCK = 4096;
+  const char *end = data + size;
+  while ((size_t)(end - data) > BLOCK) {
+    size_t count = CountNewlines(data, BLOCK);
+    if (count >= n)
+      break;
+    n -= count;
+    data += BLOCK;
+  }
+  while ((data = (const char *)memchr(data, '\n', end - data))) {
+    if (--n == 0)
+      return data;
+    ++data;
+  }
+  return nullptr;
+}
+
+// Read-only view of a whole file. On POSIX the file is mapped, so opening is
+// instant and only the pages that are actually touched get loaded (the file
+// must not be truncated by someone else while it is open). Elsewhere it is
+// read into memory.
+class MappedFile {
+public:
+  // Returns nullptr and sets error on failure
+  static std::shared_ptr<MappedFile> open(const char *path,
+                                          std::string &error) {
+    std::shared_ptr<MappedFile> file(new MappedFile());
+#ifndef _WIN32
+    int fd = ::open(path, O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0) {
+      error = std::string("Could not open ") + path + ": " + strerror(errno);
+      if (fd >= 0)
+        close(fd);
+      return nullptr;
+    }
+    file->length = info.st_size;
+    if (file->length > 0) {
+      void *mapped =
+          mmap(nullptr, file->length, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mapped == MAP_FAILED) {
+        error = std::string("Could not map ") + path + ": " + strerror(errno);
+        close(fd);
+        return nullptr;
+      }
+      file->bytes = (const char *)mapped;
+    }
+    close(fd);
+#else
+    FILE *in = fopen(path, "rb");
+    if (!in) {
+      error = std::string("Could not open ") + path;
+      return nullptr;
+    }
+    std::string contents;
+    char chunk[1 << 16];
+    size_t read;
+    while ((read = fread(chunk, 1, sizeof(chunk), in)) > 0)
+      contents.append(chunk, read);
+    fclose(in);
+    file->copy = std::make_unique<std::string>(std::move(contents));
+    file->bytes = file->copy->data();
+    file->length = file->copy->size();
+#endif
+    return file;
+  }
+
+  ~MappedFile() {
+#ifndef _WIN32
+    if (bytes)
+      munmap((void *)bytes, length);
+#endif
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  const char *data() const { return bytes; }
+  size_t size() const { return length; }
+
+  // Tells the OS the range won't be needed soon, so a full pass over a huge
+  // file doesn't keep it all resident
+  void release(size_t offset, size_t count) const {
+#ifndef _WIN32
+    if (bytes && count > 0)
+      madvise((void *)(bytes + offset), count, MADV_DONTNEED);
+#else
+    (void)offset;
+    (void)count;
+#endif
+  }
+
+private:
+  MappedFile() = default;
+
+  const char *bytes = nullptr;
+  size_t length = 0;
+#ifdef _WIN32
+  std::unique_ptr<std::string> copy;
+#endif
+};
+
+// Byte range [begin, end) of a document
+struct TextRange {
+  size_t begin, end;
+};
+
+// The piece list of a PieceTable at one point in time. It keeps the text the
+// pieces point into alive, so it stays valid while the table is edited or
+// even replaced, e.g. for saving on another thread.
+struct PieceSnapshot {
+  std::vector<std::string_view> pieces;
+  size_t size = 0;
+  std::shared_ptr<const void> original;
+  std::vector<std::shared_ptr<char[]>> blocks;
+};
+
+// Converts the text of a save on its way out: called with each piece in
+// order, then once with an empty one at the end, appending what to write
+using OutputConverter =
+    std::function<void(std::string_view piece, std::string &out)>;
+
+// Saves snapshot to path without ever leaving a half-written file behind: the
+// text is written to a temporary file in the same directory, flushed to disk
+// and then renamed over path. Without convert, the pieces are written as
+// they are; with it, they are converted and written a buffer at a time.
+// written is advanced as the snapshot's bytes go out, for progress
+// reporting. Returns false and sets error on failure.
+inline bool WriteFileAtomically(const std::string &path,
+                                const PieceSnapshot &snapshot,
+                                std::atomic<size_t> &written,
+                                std::string &error,
+                                const OutputConverter &convert = {}) {
+  // Converted output is written once this much has piled up
+  constexpr size_t CONVERTED_BATCH = 1 << 20;
+#ifndef _WIN32
+  std::string temp = path + ".save-" + std::to_string(getpid());
+  auto fail = [&](const char *what) {
+    error = std::string(what) + " " + temp + ": " + strerror(errno);
+    unlink(temp.c_str());
+    return false;
+  };
+  // Created with the default permissions of a new file (0666 less umask),
+  // then given the permissions of the file being replaced, if any
+  int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0666);
+  if (fd < 0) {
+    error = "Could not create " + temp + ": " + strerror(errno);
+    return false;
+  }
+  struct stat info;
+  if (stat(path.c_str(), &info) == 0)
+    fchmod(fd, info.st_mode & 07777);
+
+  if (convert) {
+    std::string out;
+    for (size_t next = 0; next <= snapshot.pieces.size(); ++next) {
+      bool last = next == snapshot.pieces.size();
+      std::string_view piece = last ? "" : snapshot.pieces[next];
+      convert(piece, out);
+      written.fetch_add(piece.size(), std::memory_order_relaxed);
+      if (out.size() < CONVERTED_BATCH && !last)
+        continue;
+      for (size_t done = 0; done < out.size();) {
+        ssize_t count = ::write(fd, out.data() + done, out.size() - done);
+        if (count < 0) {
+          if (errno == EINTR)
+            continue;
+          close(fd);
+          return fail("Could not write");
+        }
+        done += count;
+      }
+      out.clear();
+    }
+  }
+
+  // Pieces go out IOV_MAX at a time; a short write resumes mid-piece
+  std::vector<iovec> batch;
+  for (size_t next = 0; !convert && next < snapshot.pieces.size();) {
+    batch.clear();
+    for (; next < snapshot.pieces.size() && batch.size() < IOV_MAX; ++next)
+      batch.push_back({(void *)snapshot.pieces[next].data(),
+                       snapshot.pieces[next].size()});
+    iovec *first = batch.data();
+    int count = (int)batch.size();
+    while (count > 0) {
+      ssize_t done = writev(fd, first, count);
+      if (done < 0) {
+        if (errno == EINTR)
+          continue;
+        close(fd);
+        return fail("Could not write");
+      }
+      written.fetch_add(done, std::memory_order_relaxed);
+      for (; count > 0 && (size_t)done >= first->iov_len; ++first, --count)
+        done -= first->iov_len;
+      if (count > 0) {
+        first->iov_base = (char *)first->iov_base + done;
+        first->iov_len -= done;
+      }
+    }
+  }
+  if (fsync(fd) != 0) {
+    close(fd);
+    return fail("Could not flush");
+  }
+  if (close(fd) != 0)
+    return fail("Could not write");
+  if (rename(temp.c_str(), path.c_str()) != 0)
+    return fail("Could not rename");
+
+  // The rename itself is only durable once the directory is flushed
+  std::string dir = std::filesystem::path(path).parent_path().string();
+  int dir_fd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY);
+  if (dir_fd >= 0) {
+    fsync(dir_fd);
+    close(dir_fd);
+  }
+  return true;
+#else
+  std::string temp = path + ".save";
+  FILE *out = fopen(temp.c_str(), "wb");
+  if (!out) {
+    error = "Could not create " + temp;
+    return false;
+  }
+  std::string converted;
+  for (size_t next = 0; next <= snapshot.pieces.size(); ++next) {
+    bool last = next == snapshot.pieces.size();
+    std::string_view piece = last ? "" : snapshot.pieces[next];
+    std::string_view bytes = piece;
+    if (convert) {
+      converted.clear();
+      convert(piece, converted);
+      bytes = converted;
+    }
+    if (fwrite(bytes.data(), 1, bytes.size(), out) != bytes.size()) {
+      fclose(out);
+      remove(temp.c_str());
+      error = "Could not write " + temp;
+      return false;
+    }
+    written.fetch_add(piece.size(), std::memory_order_relaxed);
+  }
+  if (fflush(out) != 0 || fclose(out) != 0) {
+    remove(temp.c_str());
+    error = "Could not write " + temp;
+    return false;
+  }
+  std::error_code failure;
+  std::filesystem::rename(temp, path, failure); // replaces path
+  if (failure) {
+    remove(temp.c_str());
+    error = "Could not rename " + temp + ": " + failure.message();
+    return false;
+  }
+  return true;
+#endif
+}
+
+// Text buffer stored as a piece table: the document is a sequence of pieces,
+// each a view into either the original text or an append-only add buffer.
+// Pieces live in an implicit treap ordered by document position and every
+// node caches the byte and newline totals of its subtree, so inserts, erases
+// and offset <-> line lookups are O(log pieces) and no edit moves text.
+class PieceTable {
+public:
+  // Longest piece; bounds the scan needed to split a piece or find a line
+  static constexpr size_t MAX_PIECE = 64 * 1024;
+
+  PieceTable() { nodes.emplace_back(); } // node 0 is the empty tree
+
+  size_t size() const { return nodes[root].size; }
+  // Changes on every edit, for telling whether the document was modified
+  uint64_t version() const { return edits; }
+  // Exact once indexing() is false; until then newlines in the part of an
+  // opened file that hasn't been scanned yet are not counted
+  size_t lineCount() const { return nodes[root].newlines + 1; }
+  // UTF-8 characters (code points); exact once indexing() is false
+  size_t charCount() const { return nodes[root].chars; }
+  size_t pieceCount() const { return nodes.size() - 1 - freeNodes.size(); }
+
+  void clear() {
+    indexer.reset(); // stops and joins the indexing thread
+    chunkNodes.clear();
+    nodes.resize(1);
+    freeNodes.clear();
+    root = 0;
+    original.reset();
+    blocks.clear();
+    blockUsed = blockSize = 0;
+  }
+
+  // Replaces the document with text, which the table takes ownership of
+  void assign(std::string text) {
+    clear();
+    auto owned = std::make_shared<std::string>(std::move(text));
+    original = owned;
+    for (size_t pos = 0; pos < owned->size(); pos += MAX_PIECE)
+      root = merge(root, makeNode(owned->data() + pos,
+                                  std::min(MAX_PIECE, owned->size() - pos)));
+  }
+
+  // Replaces the document with a file, less its first skip bytes (e.g. a
+  // byte order mark), without reading it: one uncounted piece is created per
+  // MAX_PIECE chunk and a background thread counts their newlines and
+  // characters, which updateIndex() folds into the tree
+  void assign(std::shared_ptr<const MappedFile> file, size_t skip = 0) {
+    clear();
+    original = file;
+    skip = std::min(skip, file->size());
+    size_t chunks = (file->size() - skip + MAX_PIECE - 1) / MAX_PIECE;
+    chunkNodes.resize(chunks);
+    for (size_t i = 0; i < chunks; ++i) {
+      size_t pos = skip + i * MAX_PIECE;
+      uint32_t node = makeNode(file->data() + pos,
+                               std::min(MAX_PIECE, file->size() - pos), 0, 0);
+      nodes[node].counted = false;
+      nodes[node].chunk = (uint32_t)i;
+      update(node);
+      chunkNodes[i] = node;
+      root = merge(root, node);
+    }
+    if (chunks > 0)
+      indexer = std::make_unique<Indexer>(std::move(file), skip, chunks);
+  }
+
+  bool indexing() const { return indexer != nullptr; }
+
+  // Fraction of the opened file scanned so far
+  double indexProgress() const {
+    return indexer ? (double)applied / chunkNodes.size() : 1.0;
+  }
+
+  // Applies newline counts the indexing thread produced since the last call;
+  // meant to be called once per frame
+  void updateIndex() {
+    if (!indexer)
+      return;
+    size_t done = indexer->done.load(std::memory_order_acquire);
+    if (done == applied)
+      return;
+    for (; applied < done; ++applied) {
+      uint32_t node = chunkNodes[applied];
+      if (node) { // not split or erased by an edit in the meantime
+        nodes[node].pieceNewlines = indexer->counts[applied].newlines;
+        nodes[node].pieceChars = indexer->counts[applied].chars;
+        nodes[node].counted = true;
+        nodes[node].chunk = NO_CHUNK;
+      }
+    }
+    recount(root);
+    if (applied == chunkNodes.size()) {
+      indexer.reset();
+      chunkNodes.clear();
+      applied = 0;
+    }
+  }
+
+  void insert(size_t pos, std::string_view text) {
+    if (text.empty())
+      return;
+    ++edits;
+    pos = std::min(pos, size());
+    uint32_t left, right;
+    split(root, pos, left, right);
+
+    // Typing appends to the add buffer right after the previous keystroke,
+    // so the piece before the cursor usually just grows
+    const char *stored = append(text);
+    uint32_t last = rightmost(left);
+    if (last && nodes[last].data + nodes[last].length == stored &&
+        nodes[last].length + text.size() <= MAX_PIECE) {
+      grow(left, text.size(), CountNewlines(stored, text.size()),
+           CountCodePoints(stored, text.size()));
+    } else {
+      for (size_t i = 0; i < text.size(); i += MAX_PIECE)
+        left = merge(left, makeNode(stored + i,
+                                    std::min(MAX_PIECE, text.size() - i)));
+    }
+    root = merge(left, right);
+  }
+
+  void erase(size_t pos, size_t count) {
+    if (pos >= size() || count == 0)
+      return;
+    ++edits;
+    uint32_t left, middle, right;
+    split(root, pos, left, middle);
+    split(middle, count, middle, right);
+    release(middle);
+    root = merge(left, right);
+  }
+
+  // Replaces each of ranges (sorted, not overlapping) with replacement. The
+  // tree is rebuilt once from the pieces between the ranges instead of
+  // editing it per range: O(pieces + ranges), no document text is copied
+  // and the replacement is stored once for all the ranges.
+  void replaceAll(std::span<const TextRange> ranges,
+                  std::string_view replacement) {
+    const char *stored = replacement.empty() ? nullptr : append(replacement);
+    rebuild(ranges, [&](size_t) {
+      return std::string_view(stored, replacement.size());
+    });
+  }
+
+  // Same as replaceAll() with texts[i] replacing ranges[i]
+  void replaceEach(std::span<const TextRange> ranges,
+                   std::span<const std::string_view> texts) {
+    rebuild(ranges, [&](size_t i) {
+      return std::string_view(append(texts[i]), texts[i].size());
+    });
+  }
+
+  char at(size_t pos) const {
+    uint32_t node = root;
+    while (node) {
+      const Node &n = nodes[node];
+      size_t leftSize = nodes[n.left].size;
+      if (pos < leftSize) {
+        node = n.left;
+      } else if (pos < leftSize + n.length) {
+        return n.data[pos - leftSize];
+      } else {
+        pos -= leftSize + n.length;
+        node = n.right;
+      }
+    }
+    return '\0';
+  }
+
+  // Calls fn(const char *data, size_t length) for the pieces of
+  // [pos, pos + count) in document order
+  template <typename F>
+  void forEachChunk(size_t pos, size_t count, F &&fn) const {
+    count = std::min(count, size() - std::min(pos, size()));
+    if (count > 0)
+      visit(root, pos, pos + count, fn);
+  }
+
+  std::string text(size_t pos, size_t count) const {
+    std::string out;
+    out.reserve(std::min(count, size()));
+    forEachChunk(pos, count, [&out](const char *data, size_t length) {
+      out.append(data, length);
+    });
+    return out;
+  }
+
+  // O(pieces); no text is copied
+  PieceSnapshot snapshot() const {
+    PieceSnapshot snapshot;
+    snapshot.pieces.reserve(pieceCount());
+    forEachChunk(0, size(), [&snapshot](const char *data, size_t length) {
+      snapshot.pieces.emplace_back(data, length);
+    });
+    snapshot.size = size();
+    snapshot.original = original;
+    snapshot.blocks = blocks;
+    return snapshot;
+  }
+
+  // Offset of the first byte of line (0-based); size() past the last line
+  size_t lineStart(size_t line) const {
+    if (line == 0)
+      return 0;
+    if (line > nodes[root].newlines)
+      return size();
+    // Find the line-th newline, the line starts right after it
+    size_t base = 0;
+    uint32_t node = root;
+    while (true) {
+      const Node &n = nodes[node];
+      if (line <= nodes[n.left].newlines) {
+        node = n.left;
+        continue;
+      }
+      line -= nodes[n.left].newlines;
+      base += nodes[n.left].size;
+      if (line <= n.pieceNewlines)
+        return base + (FindNewline(n.data, n.length, line) - n.data) + 1;
+      line -= n.pieceNewlines;
+      base += n.length;
+      node = n.right;
+    }
+  }
+
+  // Offset of the newline ending line, or size() for the last line
+  size_t lineEnd(size_t line) const {
+    size_t next = lineStart(line + 1);
+    return line + 1 < lineCount() ? next - 1 : size();
+  }
+
+  // Line (0-based) containing the byte at pos
+  size_t lineOf(size_t pos) const {
+    size_t line = 0;
+    uint32_t node = root;
+    while (node) {
+      const Node &n = nodes[node];
+      size_t leftSize = nodes[n.left].size;
+      if (pos < leftSize) {
+        node = n.left;
+        continue;
+      }
+      line += nodes[n.left].newlines;
+      pos -= leftSize;
+      if (pos < n.length)
+        return line + CountNewlines(n.data, pos);
+      line += n.pieceNewlines;
+      pos -= n.length;
+      node = n.right;
+    }
+    return line;
+  }
+
+private:
+  static constexpr uint32_t NO_CHUNK = UINT32_MAX;
+
+  struct Node {
+    const char *data = nullptr;
+    size_t length = 0;
+    size_t pieceNewlines = 0;
+    size_t pieceChars = 0;
+    uint32_t priority = 0;
+    uint32_t left = 0, right = 0;
+    size_t size = 0;     // bytes in subtree
+    size_t newlines = 0; // newlines in subtree
+    size_t chars = 0;    // UTF-8 characters in subtree
+    bool counted = true; // false until the indexer has scanned the piece
+    uint32_t chunk = NO_CHUNK; // file chunk of an uncounted piece
+  };
+
+  struct ChunkCounts {
+    size_t newlines = 0, chars = 0;
+  };
+
+  // Counts the newlines and characters of every chunk of an opened file
+  // (from its start offset on), in order, and publishes them through done
+  struct Indexer {
+    std::shared_ptr<const MappedFile> file;
+    size_t start;
+    std::vector<ChunkCounts> counts;
+    std::atomic<size_t> done{0};
+    std::jthread thread;
+
+    Indexer(std::shared_ptr<const MappedFile> mapped, size_t start,
+            size_t chunks)
+        : file(std::move(mapped)), start(start), counts(chunks) {
+      thread = std::jthread([this](std::stop_token stop) { run(stop); });
+    }
+
+    void run(std::stop_token stop) {
+      constexpr size_t RELEASE_CHUNKS = 1024; // 64 MiB
+      for (size_t i = 0; i < counts.size() && !stop.stop_requested(); ++i) {
+        size_t pos = start + i * MAX_PIECE;
+        size_t length = std::min(MAX_PIECE, file->size() - pos);
+        counts[i] = {CountNewlines(file->data() + pos, length),
+                     CountCodePoints(file->data() + pos, length)};
+        done.store(i + 1, std::memory_order_release);
+        if ((i + 1) % RELEASE_CHUNKS == 0)
+          file->release(start + (i + 1 - RELEASE_CHUNKS) * MAX_PIECE,
+                        RELEASE_CHUNKS * MAX_PIECE);
+      }
+    }
+  };
+
+  std::vector<Node> nodes;
+  std::vector<uint32_t> freeNodes;
+  uint32_t root = 0;
+  uint32_t seed = 2463534242u;
+  uint64_t edits = 0;
+
+  std::unique_ptr<Indexer> indexer;
+  std::vector<uint32_t> chunkNodes; // uncounted node of each chunk, or 0
+  size_t applied = 0;               // chunks folded in by updateIndex()
+
+  // The std::string or MappedFile behind the original pieces
+  std::shared_ptr<const void> original;
+  // Add buffer: typed and pasted text, appended to fixed blocks that never
+  // move, so pieces can keep raw pointers into them
+  static constexpr size_t BLOCK_SIZE = 1 << 20;
+  std::vector<std::shared_ptr<char[]>> blocks; // shared with snapshots
+  size_t blockUsed = 0;
+  size_t blockSize = 0;
+
+  const char *append(std::string_view text) {
+    if (blocks.empty() || blockUsed + text.size() > blockSize) {
+      blockSize = std::max(BLOCK_SIZE, text.size());
+      blocks.emplace_back(new char[blockSize]);
+      blockUsed = 0;
+    }
+    char *stored = blocks.back().get() + blockUsed;
+    memcpy(stored, text.data(), text.size());
+    blockUsed += text.size();
+    return stored;
+  }
+
+  uint32_t makeNode(const char *data, size_t length) {
+    return makeNode(data, length, CountNewlines(data, length),
+                    CountCodePoints(data, length));
+  }
+
+  uint32_t makeNode(const char *data, size_t length, size_t newlines,
+                    size_t chars) {
+    uint32_t id;
+    if (!freeNodes.empty()) {
+      id = freeNodes.back();
+      freeNodes.pop_back();
+    } else {
+      id = (uint32_t)nodes.size();
+      nodes.emplace_back();
+    }
+    // xorshift32
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    nodes[id] = {data, length, newlines, chars, seed, 0, 0, length, newlines,
+                 chars};
+    return id;
+  }
+
+  void release(uint32_t node) {
+    if (!node)
+      return;
+    release(nodes[node].left);
+    release(nodes[node].right);
+    forgetChunk(node);
+    freeNodes.push_back(node);
+  }
+
+  // Detaches an uncounted piece from the indexer before an edit changes it
+  void forgetChunk(uint32_t node) {
+    Node &n = nodes[node];
+    if (n.chunk != NO_CHUNK) {
+      chunkNodes[n.chunk] = 0;
+      n.chunk = NO_CHUNK;
+    }
+  }
+
+  void update(uint32_t node) {
+    Node &n = nodes[node];
+    n.size = nodes[n.left].size + n.length + nodes[n.right].size;
+    n.newlines =
+        nodes[n.left].newlines + n.pieceNewlines + nodes[n.right].newlines;
+    n.chars = nodes[n.left].chars + n.pieceChars + nodes[n.right].chars;
+  }
+
+  void recount(uint32_t node) {
+    if (!node)
+      return;
+    recount(nodes[node].left);
+    recount(nodes[node].right);
+    update(node);
+  }
+
+  uint32_t rightmost(uint32_t node) const {
+    while (node && nodes[node].right)
+      node = nodes[node].right;
+    return node;
+  }
+
+  // Extends the last piece of the subtree by length bytes
+  void grow(uint32_t node, size_t length, size_t newlines, size_t chars) {
+    for (; node; node = nodes[node].right) {
+      Node &n = nodes[node];
+      n.size += length;
+      n.newlines += newlines;
+      n.chars += chars;
+      if (!n.right) {
+        n.length += length;
+        n.pieceNewlines += newlines;
+        n.pieceChars += chars;
+      }
+    }
+  }
+
+  // Splits node into the first pos bytes and the rest, cutting a piece in
+  // two when pos falls inside it
+  void split(uint32_t node, size_t pos, uint32_t &left, uint32_t &right) {
+    if (!node) {
+      left = right = 0;
+      return;
+    }
+    Node &n = nodes[node];
+    size_t leftSize = nodes[n.left].size;
+    // Children are split into locals: cutting a piece adds a node, which may
+    // reallocate the node array under any reference into it
+    uint32_t child;
+    if (pos <= leftSize) {
+      split(n.left, pos, left, child);
+      nodes[node].left = child;
+      right = node;
+    } else if (pos >= leftSize + n.length) {
+      split(n.right, pos - leftSize - n.length, child, right);
+      nodes[node].right = child;
+      left = node;
+    } else {
+      size_t offset = pos - leftSize;
+      size_t headNewlines = CountNewlines(n.data, offset);
+      size_t headChars = CountCodePoints(n.data, offset);
+      if (!n.counted) { // count it now rather than wait for the indexer
+        forgetChunk(node);
+        n.counted = true;
+        n.pieceNewlines = headNewlines + CountNewlines(n.data + offset,
+                                                       n.length - offset);
+        n.pieceChars =
+            headChars + CountCodePoints(n.data + offset, n.length - offset);
+      }
+      uint32_t tail = makeNode(nodes[node].data + offset,
+                               nodes[node].length - offset,
+                               nodes[node].pieceNewlines - headNewlines,
+                               nodes[node].pieceChars - headChars);
+      Node &head = nodes[node]; // makeNode may have reallocated nodes
+      head.length = offset;
+      head.pieceNewlines = headNewlines;
+      head.pieceChars = headChars;
+      right = merge(tail, head.right);
+      nodes[node].right = 0;
+      left = node;
+    }
+    update(node);
+  }
+
+  uint32_t merge(uint32_t left, uint32_t right) {
+    if (!left || !right)
+      return left ? left : right;
+    if (nodes[left].priority > nodes[right].priority) {
+      nodes[left].right = merge(nodes[left].right, right);
+      update(left);
+      return left;
+    }
+    nodes[right].left = merge(left, nodes[right].left);
+    update(right);
+    return right;
+  }
+
+  // replaceAll() and replaceEach(): textFor(i) stores the text for ranges[i]
+  // in the add buffer and returns it
+  template <typename F>
+  void rebuild(std::span<const TextRange> ranges, F &&textFor) {
+    if (ranges.empty())
+      return;
+    ++edits;
+    std::vector<std::string_view> pieces;
+    pieces.reserve(pieceCount() + 2 * ranges.size());
+    auto keep = [&pieces](const char *data, size_t length) {
+      pieces.emplace_back(data, length);
+    };
+    size_t pos = 0;
+    for (size_t r = 0; r < ranges.size(); ++r) {
+      forEachChunk(pos, ranges[r].begin - pos, keep);
+      std::string_view text = textFor(r);
+      for (size_t i = 0; i < text.size(); i += MAX_PIECE)
+        pieces.push_back(text.substr(i, MAX_PIECE));
+      pos = ranges[r].end;
+    }
+    forEachChunk(pos, size() - pos, keep);
+
+    // Every piece is counted below, so indexing is moot
+    indexer.reset();
+    chunkNodes.clear();
+    applied = 0;
+    nodes.resize(1);
+    freeNodes.clear();
+
+    // Treap built left to right on a stack holding its right spine
+    std::vector<uint32_t> spine;
+    for (std::string_view piece : pieces) {
+      uint32_t node = makeNode(piece.data(), piece.size());
+      uint32_t left = 0;
+      while (!spine.empty() &&
+             nodes[spine.back()].priority < nodes[node].priority) {
+        left = spine.back();
+        spine.pop_back();
+      }
+      nodes[node].left = left;
+      if (!spine.empty())
+        nodes[spine.back()].right = node;
+      spine.push_back(node);
+    }
+    root = spine.empty() ? 0 : spine.front();
+    recount(root);
+  }
+
+  template <typename F>
+  void visit(uint32_t node, size_t begin, size_t end, F &fn) const {
+    if (!node || begin >= end)
+      return;
+    const Node &n = nodes[node];
+    size_t leftSize = nodes[n.left].size;
+    if (begin < leftSize)
+      visit(n.left, begin, std::min(end, leftSize), fn);
+    size_t pieceBegin = std::max(begin, leftSize);
+    size_t pieceEnd = std::min(end, leftSize + n.length);
+    if (pieceBegin < pieceEnd)
+      fn(n.data + (pieceBegin - leftSize), pieceEnd - pieceBegin);
+    size_t rightBase = leftSize + n.length;
+    if (end > rightBase)
+      visit(n.right, begin > rightBase ? begin - rightBase : 0,
+            end - rightBase, fn);
+  }
+};
@@ -0,0 +1,788 @@
+#pragma once
+
+#include "piece_table.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+inline char FoldCase(char c) { return c >= 'A' && c <= 'Z' ? c | 0x20 : c; }
+
+inline bool IsAsciiLetter(char c) {
+  return (c | 0x20) >= 'a' && (c | 0x20) <= 'z';
+}
+
+// needle is already folded when fold is set
+inline bool EqualsAt(const char *text, std::string_view needle, bool fold) {
+  if (!fold)
+    return memcmp(text, needle.data(), needle.size()) == 0;
+  for (size_t i = 0; i < needle.size(); ++i)
+    if (FoldCase(text[i]) != needle[i])
+      return false;
+  return true;
+}
+
+// Literal search kernels. Each returns the first position >= from where
+// needle (non-empty, folded to lower case if fold is set) occurs in
+// [text, text + size), or size if there is none.
+inline size_t FindLiteralScalar(const char *text, size_t size, size_t from,
+                                std::string_view needle, bool fold) {
+  if (!fold)
+    return std::min(std::string_view(text, size).find(needle, from), size);
+  for (size_t i = from; i + needle.size() <= size; ++i)
+    if (EqualsAt(text + i, needle, true))
+      return i;
+  return size;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// The SIMD kernels compare the first and the last byte of the needle against
+// 16 or 32 candidate positions at once and only verify the positions where
+// both agree. Folding ORs 0x20 into the text, which maps upper case letters
+// (and some punctuation, weeded out by the verification) to lower case.
+__attribute__((target("sse2"))) inline size_t
+FindLiteralSSE2(const char *text, size_t size, size_t from,
+                std::string_view needle, bool fold) {
+  size_t last = needle.size() - 1;
+  const __m128i first = _mm_set1_epi8(needle[0]);
+  const __m128i final = _mm_set1_epi8(needle[last]);
+  const __m128i firstFold =
+      _mm_set1_epi8(fold && IsAsciiLetter(needle[0]) ? 0x20 : 0);
+  const __m128i finalFold =
+      _mm_set1_epi8(fold && IsAsciiLetter(needle[last]) ? 0x20 : 0);
+  size_t i = from;
+  for (; i + last + 16 <= size; i += 16) {
+    __m128i a = _mm_or_si128(_mm_loadu_si128((const __m128i *)(text + i)),
+                             firstFold);
+    __m128i b = _mm_or_si128(
+        _mm_loadu_si128((const __m128i *)(text + i + last)), finalFold);
+    unsigned mask = _mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, final)));
+    for (; mask; mask &= mask - 1) {
+      size_t pos = i + __builtin_ctz(mask);
+      if (EqualsAt(text + pos, needle, fold))
+        return pos;
+    }
+  }
+  return FindLiteralScalar(text, size, i, needle, fold);
+}
+
+__attribute__((target("avx2"))) inline size_t
+FindLiteralAVX2(const char *text, size_t size, size_t from,
+                std::string_view needle, bool fold) {
+  size_t last = needle.size() - 1;
+  const __m256i first = _mm256_set1_epi8(needle[0]);
+  const __m256i final = _mm256_set1_epi8(needle[last]);
+  const __m256i firstFold =
+      _mm256_set1_epi8(fold && IsAsciiLetter(needle[0]) ? 0x20 : 0);
+  const __m256i finalFold =
+      _mm256_set1_epi8(fold && IsAsciiLetter(needle[last]) ? 0x20 : 0);
+  size_t i = from;
+  for (; i + last + 32 <= size; i += 32) {
+    __m256i a = _mm256_or_si256(
+        _mm256_loadu_si256((const __m256i *)(text + i)), firstFold);
+    __m256i b = _mm256_or_si256(
+        _mm256_loadu_si256((const __m256i *)(text + i + last)), finalFold);
+    unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(
+        _mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, final)));
+    for (; mask; mask &= mask - 1) {
+      size_t pos = i + __builtin_ctz(mask);
+      if (EqualsAt(text + pos, needle, fold))
+        return pos;
+    }
+  }
+  return FindLiteralScalar(text, size, i, needle, fold);
+}
+#endif
+
+using FindLiteralKernel = size_t (*)(const char *, size_t, size_t,
+                                     std::string_view, bool);
+
+// Picks the widest kernel the running CPU supports
+inline FindLiteralKernel SelectFindLiteral() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return FindLiteralAVX2;
+  if (__builtin_cpu_supports("sse2"))
+    return FindLiteralSSE2;
+#endif
+  return FindLiteralScalar;
+}
+
+inline size_t FindLiteral(const char *text, size_t size, size_t from,
+                          std::string_view needle, bool fold) {
+  static const FindLiteralKernel kernel = SelectFindLiteral();
+  if (needle.empty() || from >= size || size - from < needle.size())
+    return size;
+  return kernel(text, size, from, needle, fold);
+}
+
+// A compiled search: either a literal string or a regular expression, which
+// is turned into a DFA up front. Supported syntax: | * + ? ( ) . [] [^] and
+// the escapes \d \w \s \D \W \S \n \r \t; ^ and $ (line start and end) only
+// at the ends of the pattern. '.' matches one UTF-8 character but no line
+// break, same for negated sets, which only list ASCII characters.
+//
+// Matches are leftmost-longest, never empty and at most MAX_MATCH bytes
+// long, so a match starting in one chunk of a document can be completed
+// from a bounded overlap with the next.
+class SearchPattern {
+public:
+  static constexpr size_t MAX_MATCH = 64 * 1024;
+  // Patterns whose DFA grows beyond this are rejected as too complex
+  static constexpr size_t MAX_STATES = 4096;
+
+  // Returns nullptr and sets error on failure
+  static std::shared_ptr<SearchPattern> compile(std::string_view text,
+                                                bool regex, bool matchCase,
+                                                std::string &error) {
+    std::shared_ptr<SearchPattern> pattern(new SearchPattern());
+    if (text.empty()) {
+      error = "Nothing to search for";
+      return nullptr;
+    }
+    pattern->fold = !matchCase;
+    if (!regex) {
+      pattern->literal = true;
+      pattern->needle = text;
+      if (pattern->fold)
+        for (char &c : pattern->needle)
+          c = FoldCase(c);
+      return pattern;
+    }
+    if (text.front() == '^') {
+      pattern->lineStart = true;
+      text.remove_prefix(1);
+    }
+    if (text.size() >= 2 && text.back() == '$' &&
+        text[text.size() - 2] != '\\') {
+      pattern->lineEnd = true;
+      text.remove_suffix(1);
+    } else if (text == "$") {
+      pattern->lineEnd = true;
+      text = {};
+    }
+    Compiler compiler(text, pattern->fold);
+    if (!compiler.compile(error) || !pattern->build(compiler.nfa, error))
+      return nullptr;
+    return pattern;
+  }
+
+  // Bytes past the end of a chunk needed to complete any match starting in
+  // it
+  size_t overlap() const { return literal ? needle.size() - 1 : MAX_MATCH; }
+
+  // Finds the first match starting at or after from in [text, text + size).
+  // text[from - 1] must be the preceding byte of the document unless from
+  // is 0 and text is its start; atEnd tells whether size is the end of the
+  // document rather than of a window into it.
+  bool find(const char *text, size_t size, size_t from, bool atEnd,
+            TextRange &match) const {
+    if (literal) {
+      size_t pos = FindLiteral(text, size, from, needle, fold);
+      if (pos == size)
+        return false;
+      match = {pos, pos + needle.size()};
+      return true;
+    }
+    if (lineStart) {
+      for (size_t pos = from; pos < size;) {
+        if ((pos == 0 || text[pos - 1] == '\n') &&
+            matchAt(text, size, pos, atEnd, match))
+          return true;
+        const char *next = (const char *)memchr(text + pos, '\n', size - pos);
+        if (!next)
+          break;
+        pos = next - text + 1;
+      }
+      return false;
+    }
+    // The unanchored DFA finds where the earliest match ends, then the
+    // starts up to there are tried in order with the anchored one
+    size_t tried = from;
+    uint32_t state = searchStart;
+    for (size_t i = from; i < size; ++i) {
+      // Nothing under way: jump to where the pattern can start
+      if (state == DEAD && !firstByte.empty()) {
+        i = FindLiteral(text, size, i, firstByte, fold);
+        if (i == size)
+          break;
+      }
+      state = search[state * classes + byteClass[(unsigned char)text[i]]];
+      if (!searchAccepts[state])
+        continue;
+      for (; tried <= i; ++tried)
+        if (matchAt(text, size, tried, atEnd, match))
+          return true;
+    }
+    return false;
+  }
+
+private:
+  SearchPattern() = default;
+
+  bool literal = false;
+  bool fold = false;
+  std::string needle; // literal patterns
+  bool lineStart = false, lineEnd = false;
+
+  // Thompson NFA: BYTE states consume one byte from a set, SPLIT states
+  // branch without consuming (next only, when alt is NONE)
+  struct Nfa {
+    static constexpr uint32_t NONE = UINT32_MAX;
+    enum Kind : uint8_t { BYTE, SPLIT, MATCH };
+    struct State {
+      Kind kind;
+      uint32_t set; // index into sets for BYTE states
+      uint32_t next, alt;
+    };
+    std::vector<State> states;
+    std::vector<std::bitset<256>> sets;
+    uint32_t start = NONE;
+  };
+
+  // Recursive descent parser emitting NFA fragments
+  struct Compiler {
+    std::string_view text;
+    bool fold;
+    size_t pos = 0;
+    std::string error;
+    Nfa nfa;
+
+    Compiler(std::string_view pattern, bool foldCase)
+        : text(pattern), fold(foldCase) {}
+
+    // A fragment's dangling exits are (state, is alt) pairs
+    struct Fragment {
+      uint32_t start;
+      std::vector<std::pair<uint32_t, bool>> exits;
+    };
+
+    bool compile(std::string &failure) {
+      Fragment body = alternation();
+      if (error.empty() && pos < text.size())
+        error = "Unmatched )";
+      if (!error.empty()) {
+        failure = error;
+        return false;
+      }
+      uint32_t match = add(Nfa::MATCH);
+      patch(body, match);
+      nfa.start = body.start;
+      return true;
+    }
+
+    uint32_t add(Nfa::Kind kind, uint32_t set = 0,
+                 uint32_t next = Nfa::NONE, uint32_t alt = Nfa::NONE) {
+      nfa.states.push_back({kind, set, next, alt});
+      return (uint32_t)nfa.states.size() - 1;
+    }
+
+    void patch(const Fragment &fragment, uint32_t target) {
+      for (auto [state, alt] : fragment.exits)
+        (alt ? nfa.states[state].alt : nfa.states[state].next) = target;
+    }
+
+    Fragment empty() {
+      uint32_t state = add(Nfa::SPLIT);
+      return {state, {{state, false}}};
+    }
+
+    Fragment byteSet(std::bitset<256> set) {
+      if (fold)
+        for (int c = 'a'; c <= 'z'; ++c)
+          if (set[c] || set[c - 0x20])
+            set[c] = set[c - 0x20] = true;
+      nfa.sets.push_back(set);
+      uint32_t state = add(Nfa::BYTE, (uint32_t)nfa.sets.size() - 1);
+      return {state, {{state, false}}};
+    }
+
+    Fragment byteRange(int lo, int hi) {
+      std::bitset<256> set;
+      for (int c = lo; c <= hi; ++c)
+        set[c] = true;
+      return byteSet(set);
+    }
+
+    Fragment concat(Fragment a, const Fragment &b) {
+      patch(a, b.start);
+      a.exits = b.exits;
+      return a;
+    }
+
+    Fragment either(Fragment a, const Fragment &b) {
+      uint32_t split = add(Nfa::SPLIT, 0, a.start, b.start);
+      a.start = split;
+      a.exits.insert(a.exits.end(), b.exits.begin(), b.exits.end());
+      return a;
+    }
+
+    // A single UTF-8 character of two to four bytes
+    Fragment multibyte() {
+      Fragment two = concat(byteRange(0xC2, 0xDF), byteRange(0x80, 0xBF));
+      Fragment three =
+          concat(byteRange(0xE0, 0xEF),
+                 concat(byteRange(0x80, 0xBF), byteRange(0x80, 0xBF)));
+      Fragment four = concat(
+          byteRange(0xF0, 0xF4),
+          concat(byteRange(0x80, 0xBF),
+                 concat(byteRange(0x80, 0xBF), byteRange(0x80, 0xBF))));
+      return either(either(two, three), four);
+    }
+
+    // ASCII bytes of set plus any non-ASCII character, for '.' and negations
+    Fragment anyCharacterIn(std::bitset<256> set) {
+      for (int c = 0x80; c < 256; ++c)
+        set[c] = false;
+      set['\n'] = false;
+      if (set.none())
+        return multibyte();
+      return either(byteSet(set), multibyte());
+    }
+
+    bool at(char c) const { return pos < text.size() && text[pos] == c; }
+
+    Fragment alternation() {
+      Fragment result = sequence();
+      while (error.empty() && at('|')) {
+        ++pos;
+        result = either(std::move(result), sequence());
+      }
+      return result;
+    }
+
+    Fragment sequence() {
+      Fragment result = empty();
+      while (error.empty() && pos < text.size() && !at('|') && !at(')'))
+        result = concat(std::move(result), repeat());
+      return result;
+    }
+
+    Fragment repeat() {
+      Fragment result = atom();
+      while (error.empty() && (at('*') || at('+') || at('?'))) {
+        char op = text[pos++];
+        uint32_t split = add(Nfa::SPLIT, 0, result.start);
+        if (op == '?') {
+          result.start = split;
+          result.exits.push_back({split, true});
+        } else {
+          patch(result, split);
+          if (op == '*')
+            result.start = split;
+          result.exits = {{split, true}};
+        }
+      }
+      return result;
+    }
+
+    // The byte set of an escape like \d, with its negation flag
+    static bool escapeSet(char c, std::bitset<256> &set, bool &negated) {
+      negated = c >= 'A' && c <= 'Z';
+      switch (c | 0x20) {
+      case 'd':
+        for (int b = '0'; b <= '9'; ++b)
+          set[b] = true;
+        return true;
+      case 'w':
+        for (int b = 0; b < 128; ++b)
+          set[b] = isalnum(b) || b == '_';
+        return true;
+      case 's':
+        for (char b : {' ', '\t', '\n', '\r', '\f', '\v'})
+          set[(unsigned char)b] = true;
+        return true;
+      }
+      return false;
+    }
+
+    static char escapeChar(char c) {
+      switch (c) {
+      case 'n':
+        return '\n';
+      case 'r':
+        return '\r';
+      case 't':
+        return '\t';
+      }
+      return c;
+    }
+
+    Fragment atom() {
+      char c = text[pos++];
+      switch (c) {
+      case '(': {
+        Fragment inner = alternation();
+        if (error.empty() && !at(')'))
+          error = "Missing )";
+        ++pos;
+        return inner;
+      }
+      case '[':
+        return characterClass();
+      case '.':
+        return anyCharacterIn(std::bitset<256>().set());
+      case '*':
+      case '+':
+      case '?':
+        error = std::string("Nothing to repeat before ") + c;
+        return empty();
+      case '^':
+      case '$':
+        error = "^ and $ are only supported at the ends of the pattern";
+        return empty();
+      case '\\': {
+        if (pos == text.size()) {
+          error = "Trailing \\";
+          return empty();
+        }
+        std::bitset<256> set;
+        bool negated;
+        if (escapeSet(text[pos], set, negated)) {
+          ++pos;
+          return negated ? anyCharacterIn(~set) : byteSet(set);
+        }
+        c = escapeChar(text[pos++]);
+        break;
+      }
+      }
+      std::bitset<256> set;
+      set[(unsigned char)c] = true;
+      return byteSet(set);
+    }
+
+    Fragment characterClass() {
+      bool negated = at('^');
+      pos += negated;
+      std::bitset<256> set;
+      bool first = true;
+      while (pos < text.size() && (first || !at(']'))) {
+        first = false;
+        char lo = text[pos++];
+        if (lo == '\\' && pos < text.size()) {
+          bool escapeNegated;
+          std::bitset<256> escape;
+          if (escapeSet(text[pos], escape, escapeNegated)) {
+            ++pos;
+            set |= escapeNegated ? ~escape : escape;
+            continue;
+          }
+          lo = escapeChar(text[pos++]);
+        }
+        char hi = lo;
+        if (at('-') && pos + 1 < text.size() && text[pos + 1] != ']') {
+          hi = text[pos + 1];
+          pos += 2;
+          if (hi == '\\' && pos < text.size())
+            hi = escapeChar(text[pos++]);
+          if ((unsigned char)hi < (unsigned char)lo) {
+            error = "Invalid range in []";
+            return empty();
+          }
+        }
+        for (int b = (unsigned char)lo; b <= (unsigned char)hi; ++b)
+          set[b] = true;
+      }
+      if (!at(']')) {
+        error = "Missing ]";
+        return empty();
+      }
+      ++pos;
+      if (negated) {
+        // Fold before negating so [^a] excludes 'A' too
+        if (fold)
+          for (int b = 'a'; b <= 'z'; ++b)
+            if (set[b] || set[b - 0x20])
+              set[b] = set[b - 0x20] = true;
+        return anyCharacterIn(~set);
+      }
+      return byteSet(set);
+    }
+  };
+
+  // DFAs over byte classes (bytes no set tells apart share a class): an
+  // anchored one that matches from a given start and an unanchored one that
+  // restarts the pattern at every byte
+  uint8_t byteClass[256] = {};
+  size_t classes = 0;
+  std::vector<uint32_t> anchored, search; // states * classes transitions
+  std::vector<uint8_t> anchoredAccepts, searchAccepts;
+  uint32_t anchoredStart = 0, searchStart = 0;
+  static constexpr uint32_t DEAD = 0; // the empty state set, interned first
+  // The only byte (up to case) a match can start with, if there is one
+  std::string firstByte;
+
+  bool build(const Nfa &nfa, std::string &error) {
+    std::map<std::vector<bool>, uint8_t> signatures;
+    for (int b = 0; b < 256; ++b) {
+      std::vector<bool> signature(nfa.sets.size());
+      for (size_t s = 0; s < nfa.sets.size(); ++s)
+        signature[s] = nfa.sets[s][b];
+      auto [it, added] =
+          signatures.emplace(std::move(signature), (uint8_t)signatures.size());
+      byteClass[b] = it->second;
+    }
+    classes = signatures.size();
+
+    std::vector<uint32_t> start = closure(nfa, {nfa.start});
+    std::bitset<256> first;
+    for (uint32_t state : start)
+      if (nfa.states[state].kind == Nfa::BYTE)
+        first |= nfa.sets[nfa.states[state].set];
+    for (int b = 0; b < 256 && first.count() <= 2; ++b) {
+      if (!first[b])
+        continue;
+      if (first.count() == 1)
+        firstByte = std::string(1, (char)b);
+      else if (fold && IsAsciiLetter((char)b) && first[b | 0x20])
+        firstByte = std::string(1, (char)(b | 0x20));
+      break;
+    }
+    return determinize(nfa, start, false, anchored, anchoredAccepts,
+                       anchoredStart, error) &&
+           determinize(nfa, start, true, search, searchAccepts, searchStart,
+                       error);
+  }
+
+  // Follows SPLIT states; the result holds BYTE and MATCH states, sorted
+  static std::vector<uint32_t> closure(const Nfa &nfa,
+                                       std::vector<uint32_t> states) {
+    std::vector<bool> visited(nfa.states.size());
+    std::vector<uint32_t> result;
+    while (!states.empty()) {
+      uint32_t state = states.back();
+      states.pop_back();
+      if (state == Nfa::NONE || visited[state])
+        continue;
+      visited[state] = true;
+      const Nfa::State &s = nfa.states[state];
+      if (s.kind == Nfa::SPLIT) {
+        states.push_back(s.next);
+        states.push_back(s.alt);
+      } else {
+        result.push_back(state);
+      }
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+  }
+
+  // Subset construction. With restart the start states are added back
+  // before every byte, so a match may begin anywhere.
+  bool determinize(const Nfa &nfa, const std::vector<uint32_t> &start,
+                   bool restart, std::vector<uint32_t> &table,
+                   std::vector<uint8_t> &accepts, uint32_t &initial,
+                   std::string &error) {
+    std::map<std::vector<uint32_t>, uint32_t> ids;
+    std::vector<std::vector<uint32_t>> sets;
+    auto intern = [&](std::vector<uint32_t> set) {
+      auto [it, added] = ids.emplace(set, (uint32_t)sets.size());
+      if (added) {
+        bool match = false;
+        for (uint32_t state : set)
+          match |= nfa.states[state].kind == Nfa::MATCH;
+        accepts.push_back(match);
+        sets.push_back(std::move(set));
+      }
+      return it->second;
+    };
+    intern({}); // DEAD
+    initial = restart ? DEAD : intern(start);
+
+    std::vector<int> representative(classes, -1);
+    for (int b = 255; b >= 0; --b)
+      representative[byteClass[b]] = b;
+    for (uint32_t id = 0; id < sets.size(); ++id) {
+      if (sets.size() > MAX_STATES) {
+        error = "Pattern is too complex";
+        return false;
+      }
+      std::vector<uint32_t> current = sets[id];
+      if (restart)
+        current.insert(current.end(), start.begin(), start.end());
+      table.resize(sets.size() * classes);
+      for (size_t c = 0; c < classes; ++c) {
+        std::vector<uint32_t> next;
+        for (uint32_t state : current) {
+          const Nfa::State &s = nfa.states[state];
+          if (s.kind == Nfa::BYTE && nfa.sets[s.set][representative[c]])
+            next.push_back(s.next);
+        }
+        uint32_t target = intern(closure(nfa, std::move(next)));
+        table.resize(sets.size() * classes);
+        table[id * classes + c] = target;
+      }
+    }
+    return true;
+  }
+
+  // Longest match starting exactly at start
+  bool matchAt(const char *text, size_t size, size_t start, bool atEnd,
+               TextRange &match) const {
+    size_t end = 0;
+    size_t limit = std::min(size, start + MAX_MATCH);
+    uint32_t state = anchoredStart;
+    for (size_t i = start; i < limit; ++i) {
+      state = anchored[state * classes + byteClass[(unsigned char)text[i]]];
+      if (state == DEAD)
+        break;
+      if (anchoredAccepts[state] && (!lineEnd || atLineEnd(text, size, i + 1,
+                                                           atEnd)))
+        end = i + 1;
+    }
+    if (end == 0)
+      return false;
+    match = {start, end};
+    return true;
+  }
+
+  static bool atLineEnd(const char *text, size_t size, size_t pos,
+                        bool atEnd) {
+    if (pos == size)
+      return atEnd;
+    return text[pos] == '\n' || text[pos] == '\r';
+  }
+};
+
+// Searches a snapshot of a document on all cores. The document is cut into
+// CHUNK-sized ranges that workers claim in any order and search
+// independently, each reading a little past its end to complete matches that
+// start inside it. poll() then stitches finished chunks together in document
+// order, so the results grow front to back while the search runs.
+class SearchJob {
+public:
+  static constexpr size_t CHUNK = 1 << 20;
+
+  SearchJob(std::shared_ptr<const SearchPattern> searched,
+            PieceSnapshot snapshot)
+      : pattern(std::move(searched)), text(std::move(snapshot)),
+        chunks((text.size + CHUNK - 1) / CHUNK), found(chunks),
+        ready(new std::atomic<bool>[chunks]) {
+    starts.reserve(text.pieces.size());
+    size_t pos = 0;
+    for (std::string_view piece : text.pieces) {
+      starts.push_back(pos);
+      pos += piece.size();
+    }
+    for (size_t i = 0; i < chunks; ++i)
+      ready[i] = false;
+    size_t threads = std::clamp<size_t>(std::thread::hardware_concurrency(),
+                                        1, std::max<size_t>(chunks, 1));
+    for (size_t i = 0; i < threads && chunks > 0; ++i)
+      workers.emplace_back([this](std::stop_token stop) { run(stop); });
+  }
+
+  // Appends the matches of the chunks finished since the last call to
+  // matches(); meant to be called once per frame
+  void poll() {
+    std::string window;
+    for (; stitched < chunks && ready[stitched].load(std::memory_order_acquire);
+         ++stitched) {
+      std::vector<TextRange> chunk = std::move(found[stitched]);
+      size_t next = 0;
+      // The chunk was searched as if no match ran into it. If the last one
+      // so far does, search again from its end until both agree.
+      if (!results.empty() && !chunk.empty() &&
+          chunk[0].begin < results.back().end) {
+        size_t begin = results.back().end - 1; // keeps a byte of context
+        size_t end = std::min(text.size, (stitched + 1) * CHUNK +
+                                             pattern->overlap());
+        size_t chunkEnd = std::min(text.size, (stitched + 1) * CHUNK);
+        copy(begin, end - begin, window);
+        while (true) {
+          size_t from = results.back().end;
+          while (next < chunk.size() && chunk[next].begin < from)
+            ++next;
+          TextRange match;
+          if (!pattern->find(window.data(), window.size(), from - begin,
+                             end == text.size, match) ||
+              match.begin + begin >= chunkEnd) {
+            next = chunk.size();
+            break;
+          }
+          if (next < chunk.size() && match.begin + begin == chunk[next].begin)
+            break; // back in step, the rest of chunk is right
+          results.push_back({match.begin + begin, match.end + begin});
+        }
+      }
+      results.insert(results.end(), chunk.begin() + next, chunk.end());
+    }
+  }
+
+  // Sorted, non-overlapping matches found so far
+  const std::vector<TextRange> &matches() const { return results; }
+
+  bool done() const { return stitched == chunks; }
+
+  float progress() const {
+    return chunks > 0 ? (float)stitched / chunks : 1.0f;
+  }
+
+private:
+  std::shared_ptr<const SearchPattern> pattern;
+  PieceSnapshot text;
+  std::vector<size_t> starts; // document offset of each piece
+  size_t chunks;
+  std::vector<std::vector<TextRange>> found; // per chunk, by the workers
+  std::unique_ptr<std::atomic<bool>[]> ready;
+  std::atomic<size_t> claimed{0};
+  size_t stitched = 0;
+  std::vector<TextRange> results;
+  std::vector<std::jthread> workers; // last, so they stop before the rest
+
+  // Copies [pos, pos + count) of the snapshot into out
+  void copy(size_t pos, size_t count, std::string &out) const {
+    out.resize(count);
+    size_t piece = std::upper_bound(starts.begin(), starts.end(), pos) -
+                   starts.begin() - 1;
+    for (size_t done = 0; done < count; ++piece) {
+      size_t offset = pos + done - starts[piece];
+      size_t length = std::min(text.pieces[piece].size() - offset,
+                               count - done);
+      memcpy(out.data() + done, text.pieces[piece].data() + offset, length);
+      done += length;
+    }
+  }
+
+  void run(std::stop_token stop) {
+    std::string window;
+    size_t chunk;
+    while (!stop.stop_requested() &&
+           (chunk = claimed.fetch_add(1, std::memory_order_relaxed)) <
+               chunks) {
+      size_t begin = chunk * CHUNK;
+      size_t end = std::min(text.size, begin + CHUNK);
+      size_t windowBegin = begin > 0 ? begin - 1 : 0;
+      size_t windowEnd = std::min(text.size, end + pattern->overlap());
+      copy(windowBegin, windowEnd - windowBegin, window);
+
+      std::vector<TextRange> &out = found[chunk];
+      TextRange match;
+      size_t from = begin - windowBegin;
+      while (pattern->find(window.data(), window.size(), from,
+                           windowEnd == text.size, match) &&
+             match.begin + windowBegin < end) {
+        out.push_back({match.begin + windowBegin, match.end + windowBegin});
+        from = match.end;
+      }
+      ready[chunk].store(true, std::memory_order_release);
+    }
+  }
+};
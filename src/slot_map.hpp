@@ -0,0 +1,217 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+
+// Reference to a SlotMap element. It stays valid whatever else is added or
+// erased, and once its element is erased it is recognized as stale instead
+// of reaching whatever took the slot over.
+struct SlotHandle {
+  uint32_t index = UINT32_MAX;
+  uint32_t generation = 0;
+
+  bool valid() const { return index != UINT32_MAX; }
+  bool operator==(const SlotHandle &) const = default;
+};
+
+// Elements kept densely packed for iteration, reached through handles:
+// insert, erase and lookup are O(1). Erasing moves the last element into the
+// hole, so the dense order isn't stable; keep a SlotOrder for that.
+template <typename T> class SlotMap {
+public:
+  size_t size() const { return values.size(); }
+  bool empty() const { return values.empty(); }
+
+  // The elements in no particular order; handleAt(i) is the handle of the
+  // i-th one
+  std::span<T> items() { return values; }
+  std::span<const T> items() const { return values; }
+  SlotHandle handleAt(size_t i) const {
+    return {owners[i], slots[owners[i]].generation};
+  }
+
+  void reserve(size_t count) {
+    values.reserve(count);
+    owners.reserve(count);
+    slots.reserve(count);
+  }
+
+  void clear() {
+    // Generations carry on, so handles from before stay stale
+    for (uint32_t owner : owners)
+      free(owner);
+    values.clear();
+    owners.clear();
+  }
+
+  SlotHandle insert(T value) {
+    uint32_t index;
+    if (freeHead != NONE) {
+      index = freeHead;
+      freeHead = slots[index].link;
+    } else {
+      index = (uint32_t)slots.size();
+      slots.emplace_back();
+    }
+    slots[index].link = (uint32_t)values.size();
+    values.push_back(std::move(value));
+    owners.push_back(index);
+    return {index, slots[index].generation};
+  }
+
+  // False if handle was already stale
+  bool erase(SlotHandle handle) {
+    if (!contains(handle))
+      return false;
+    uint32_t hole = slots[handle.index].link;
+    if (hole + 1 != values.size()) {
+      values[hole] = std::move(values.back());
+      owners[hole] = owners.back();
+      slots[owners[hole]].link = hole;
+    }
+    values.pop_back();
+    owners.pop_back();
+    free(handle.index);
+    return true;
+  }
+
+  bool contains(SlotHandle handle) const {
+    return handle.index < slots.size() &&
+           slots[handle.index].generation == handle.generation;
+  }
+
+  // nullptr if handle is stale
+  T *get(SlotHandle handle) {
+    return contains(handle) ? &values[slots[handle.index].link] : nullptr;
+  }
+  const T *get(SlotHandle handle) const {
+    return contains(handle) ? &values[slots[handle.index].link] : nullptr;
+  }
+
+private:
+  static constexpr uint32_t NONE = UINT32_MAX;
+
+  // A slot's generation changes when its element is erased, so only handles
+  // to the current element match it
+  struct Slot {
+    uint32_t generation = 0;
+    uint32_t link = NONE; // index into values, or the next free slot
+  };
+
+  std::vector<T> values;
+  std::vector<uint32_t> owners; // slot of each of values
+  std::vector<Slot> slots;
+  uint32_t freeHead = NONE;
+
+  void free(uint32_t index) {
+    ++slots[index].generation;
+    slots[index].link = freeHead;
+    freeHead = index;
+  }
+};
+
+// An order over SlotMap handles, e.g. the order elements were added in.
+// Finding the k-th handle and erasing one are O(log n): erased entries leave
+// holes, and a Fenwick tree over the entries counts the ones still there.
+// Holes are squeezed out once they outnumber the entries.
+class SlotOrder {
+public:
+  size_t size() const { return live; }
+
+  void reserve(size_t count) {
+    entries.reserve(count);
+    tree.reserve(count);
+    positions.reserve(count);
+  }
+
+  void clear() {
+    entries.clear();
+    tree.clear();
+    positions.clear();
+    live = 0;
+  }
+
+  void push_back(SlotHandle handle) {
+    if (handle.index >= positions.size())
+      positions.resize(handle.index + 1, NONE);
+    positions[handle.index] = entries.size();
+    entries.push_back(handle);
+    // The new node covers (i - lowbit(i), i]: itself plus the nodes that
+    // cover the rest of that range
+    size_t i = entries.size();
+    size_t count = 1;
+    for (size_t j = i - 1; j > i - (i & -i); j -= j & -j)
+      count += tree[j - 1];
+    tree.push_back(count);
+    ++live;
+  }
+
+  // False if handle isn't in the order
+  bool erase(SlotHandle handle) {
+    if (handle.index >= positions.size() ||
+        positions[handle.index] == NONE ||
+        entries[positions[handle.index]] != handle)
+      return false;
+    size_t position = positions[handle.index];
+    positions[handle.index] = NONE;
+    entries[position] = {};
+    for (size_t i = position + 1; i <= tree.size(); i += i & -i)
+      --tree[i - 1];
+    --live;
+    if (entries.size() > 2 * live + COMPACT_SLACK)
+      compact();
+    return true;
+  }
+
+  // Calls fn(SlotHandle) for every handle, in order
+  template <typename F> void forEach(F &&fn) const {
+    for (SlotHandle handle : entries)
+      if (handle.valid())
+        fn(handle);
+  }
+
+  // k-th handle (0-based), k < size()
+  SlotHandle nth(size_t k) const {
+    size_t position = 0, step = 1;
+    while (step * 2 <= tree.size())
+      step *= 2;
+    // Largest position whose prefix holds at most k entries
+    for (; step > 0; step /= 2) {
+      if (position + step <= tree.size() && tree[position + step - 1] <= k) {
+        position += step;
+        k -= tree[position - 1];
+      }
+    }
+    return entries[position];
+  }
+
+private:
+  static constexpr size_t NONE = SIZE_MAX;
+  static constexpr size_t COMPACT_SLACK = 64;
+
+  std::vector<SlotHandle> entries; // invalid where erased
+  std::vector<size_t> tree;        // 1-based Fenwick tree, stored from 0
+  std::vector<size_t> positions;   // entry of each slot index, or NONE
+  size_t live = 0;
+
+  void compact() {
+    std::vector<SlotHandle> kept;
+    kept.reserve(live);
+    for (SlotHandle handle : entries)
+      if (handle.valid())
+        kept.push_back(handle);
+    entries = std::move(kept);
+    // Every entry counts 1; each node passes its total up to its parent
+    tree.assign(entries.size(), 1);
+    for (size_t i = 1; i <= tree.size(); ++i) {
+      size_t parent = i + (i & -i);
+      if (parent <= tree.size())
+        tree[parent - 1] += tree[i - 1];
+    }
+    for (size_t i = 0; i < entries.size(); ++i)
+      positions[entries[i].index] = i;
+  }
+};
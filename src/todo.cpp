@@ -1,15 +1,90 @@
 #include "imgui.h"
 #include "raylib.h"
 #include "rlImGui.h"
+#include "slot_map.hpp"
+#include "todo_index.hpp"
+#include "todo_store.hpp"
 #include "utils.hpp"
-#include <vector>
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
 
-typedef struct Todo {
-  std::string text;
-  bool completed;
-} Todo;
+// todo --bench: times the work a frame does for the rows in view, headless,
+// with 100 and with 1,000,000 todos (a third of them deleted again, so the
+// slot map and order have holes). A frame looks up a window of rows the
+// size the list clipper submits, at a random scroll position, either
+// through the order or through the search results; a keystroke frame also
+// runs a new search.
+static void RunBench() {
+  constexpr size_t SIZES[] = {100, 1000000};
+  constexpr int FRAMES = 20000;
+  constexpr int ROWS = 30; // about what fits in the window
+  constexpr const char *QUERIES[] = {"todo 1", "todo 12", "todo 123", "todo"};
+
+  for (size_t size : SIZES) {
+    SlotMap<Todo> todos;
+    SlotOrder order;
+    TodoIndex index;
+    todos.reserve(size + size / 2);
+    for (size_t i = 0; i < size + size / 2; ++i) {
+      Todo todo{.text = "Todo " + std::to_string(i + 1),
+                .completed = i % 3 == 0};
+      order.push_back(todos.insert(std::move(todo)));
+    }
+    std::mt19937_64 rng(1);
+    while (order.size() > size) {
+      SlotHandle handle = order.nth(rng() % order.size());
+      order.erase(handle);
+      todos.erase(handle);
+    }
+    do
+      index.build(todos, order, std::chrono::seconds(1));
+    while (index.progress() < 1);
+
+    size_t bytes = 0; // printed, so the lookups aren't optimized away
+    auto rows = [&](bool filtering) {
+      size_t count = filtering ? index.count() : order.size();
+      size_t first = count > ROWS ? rng() % (count - ROWS) : 0;
+      for (size_t row = first; row < std::min(count, first + ROWS); ++row) {
+        SlotHandle handle = filtering ? index.match(row)
+                                      : order.nth(order.size() - 1 - row);
+        bytes += todos.get(handle)->text.size();
+      }
+    };
+    auto time = [&](auto &&frame) {
+      auto start = std::chrono::steady_clock::now();
+      for (int i = 0; i < FRAMES; ++i)
+        frame(i);
+      return std::chrono::duration<double, std::micro>(
+                 std::chrono::steady_clock::now() - start)
+                 .count() /
+             FRAMES;
+    };
+    double list = time([&](int) { rows(false); });
+    double filtered = time([&](int) {
+      index.search(QUERIES[0], TODO_FILTER_ACTIVE);
+      rows(true);
+    });
+    double typing = time([&](int i) {
+      index.search(QUERIES[i % std::size(QUERIES)], TODO_FILTER_ALL);
+      rows(true);
+    });
+    printf("%7zu todos: list %.2f us, filtered %.2f us, keystroke %.2f us "
+           "per frame (%zu bytes of text read)\n",
+           size, list, filtered, typing, bytes);
+  }
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+    RunBench();
+    return 0;
+  }
 
-int main() {
   SetConfigFlags(FLAG_WINDOW_RESIZABLE);
   InitWindow(800, 600, "TODO");
   SetWindowMinSize(640, 480);
@@ -22,37 +97,64 @@ int main() {
   ImGui::GetStyle().FontScaleMain = 2;
 
   std::string input;
-  std::vector<Todo> todos;
-  int editing_idx = -1;
-  auto submit = [&todos, &input, &editing_idx]() {
+  // Todos are referred to by handle, which deleting others never shifts;
+  // order keeps them in the order they were added
+  SlotMap<Todo> todos;
+  SlotOrder order;
+  SlotHandle editing; // todo being edited, if valid
+  // Every change is logged to todos.snapshot and todos.log in the working
+  // directory, and the todos are loaded back from them
+  TodoStore store;
+  store.open("todos", todos, order);
+  // The search box and filter show the todos index finds instead of all of
+  // them; the todos there at startup are indexed a slice per frame
+  TodoIndex index;
+  const std::chrono::microseconds index_budget{8000};
+  std::string search;
+  TodoFilter filter = TODO_FILTER_ALL;
+  // --fill N adds N placeholder todos, e.g. to check that frame time and
+  // loading time don't grow with the list
+  if (argc > 2 && strcmp(argv[1], "--fill") == 0) {
+    int count = std::max(0, atoi(argv[2]));
+    todos.reserve(todos.size() + count);
+    for (int i = 0; i < count; ++i) {
+      Todo todo{.text = TextFormat("Todo %d", i + 1), .completed = i % 3 == 0};
+      store.add(todo);
+      order.push_back(todos.insert(std::move(todo)));
+    }
+  }
+  auto submit = [&todos, &order, &input, &editing, &store, &index]() {
     if (input.empty())
       return;
-    if (editing_idx >= 0) {
-      assert(editing_idx < (int)todos.size() &&
-             "Tried to apply edit with invalid i");
-      todos[editing_idx].text = input;
+    if (editing.valid()) {
+      // The todo may have been deleted while it was being edited
+      if (Todo *todo = todos.get(editing)) {
+        index.edit(editing, todo->text, input);
+        todo->text = input;
+        store.edit(*todo);
+      }
       input.clear();
-      editing_idx = -1;
+      editing = {};
       return;
     }
-    todos.push_back(Todo{.text = input, .completed = false});
+    Todo todo{.text = input, .completed = false};
+    store.add(todo);
+    SlotHandle handle = todos.insert(std::move(todo));
+    order.push_back(handle);
+    index.add(handle, *todos.get(handle));
     input.clear();
   };
-  auto edit = [&editing_idx, &input, &todos](size_t i) {
-    if (editing_idx >= 0) {
-      assert(editing_idx < (int)todos.size() &&
-             "Tried to cancel with invalid i");
-      if (editing_idx != (int)i) {
-        goto start_edit;
-      }
+  // Starts editing handle, or cancels if it is already being edited
+  auto edit = [&editing, &input, &todos](SlotHandle handle) {
+    if (editing == handle) {
       input.clear();
-      editing_idx = -1;
+      editing = {};
       return;
     }
-  start_edit:
-    editing_idx = i;
-    assert(editing_idx < (int)todos.size() && "Tried to edit with invalid i");
-    input = todos[editing_idx].text;
+    const Todo *todo = todos.get(handle);
+    assert(todo && "Tried to edit a deleted todo");
+    editing = handle;
+    input = todo->text;
   };
 
   while (!WindowShouldClose()) {
@@ -75,36 +177,84 @@ int main() {
         ImGui::SetKeyboardFocusHere(-1);
       }
       ImGui::SameLine();
-      if (ImGui::Button(editing_idx >= 0 ? "Confirm" : "Add")) {
+      if (ImGui::Button(editing.valid() ? "Confirm" : "Add")) {
         submit();
       }
 
+      std::string store_error = store.failure();
+      if (!store_error.empty())
+        ImGui::TextDisabled("Changes are not being saved: %s",
+                            store_error.c_str());
+
+      index.build(todos, order, index_budget);
+      float filter_width = ImGui::CalcTextSize("Completed").x * 1.5f;
+      ImGui::SetNextItemWidth(avail.x - filter_width -
+                              ImGui::GetStyle().ItemSpacing.x);
+      InputTextWithHintString("##search", "Search", &search);
+      ImGui::SameLine();
+      ImGui::SetNextItemWidth(filter_width);
+      if (ImGui::BeginCombo("##filter", TodoFilterNames[filter])) {
+        for (int i = 0; i < TODO_FILTER_COUNT; ++i) {
+          bool isSelected = (filter == i);
+          if (ImGui::Selectable(TodoFilterNames[i], isSelected))
+            filter = (TodoFilter)i;
+          if (isSelected)
+            ImGui::SetItemDefaultFocus();
+        }
+        ImGui::EndCombo();
+      }
+      bool filtering = !search.empty() || filter != TODO_FILTER_ALL;
+      if (filtering) {
+        index.search(search, filter);
+        if (index.progress() < 1)
+          ImGui::TextDisabled("Indexing... %d%%",
+                              (int)(index.progress() * 100));
+      }
+
       avail = ImGui::GetContentRegionAvail();
       ImGui::SetNextItemWidth(avail.x);
-      if (ImGui::BeginListBox("##empty")) {
-        for (int i = (int)todos.size() - 1; i >= 0; --i) {
-          Todo *todo = &todos[i];
-          ImGui::LabelText(TextFormat("##empty##foo%d", i), "%s",
-                           todo->text.c_str());
-          ImGui::SameLine();
-          ImGui::Checkbox(TextFormat("##empty##foo%d", i), &todo->completed);
-          ImGui::SameLine();
-          if (ImGui::Button(TextFormat("Delete##foo%d", i))) {
-            if (editing_idx == i) {
-              editing_idx = -1;
-              input.clear();
+      if (ImGui::BeginListBox("##empty", ImVec2(0, avail.y))) {
+        // Only the rows in view are submitted, newest first; a row's widgets
+        // get their IDs from its todo's slot rather than a formatted label
+        SlotHandle deleted;
+        size_t rows = filtering ? index.count() : order.size();
+        ImGuiListClipper clipper;
+        clipper.Begin((int)rows);
+        while (clipper.Step()) {
+          for (int row = clipper.DisplayStart; row < clipper.DisplayEnd;
+               ++row) {
+            SlotHandle handle = filtering ? index.match(row)
+                                          : order.nth(order.size() - 1 - row);
+            Todo *todo = todos.get(handle);
+            ImGui::PushID((int)handle.index);
+            ImGui::LabelText("##text", "%s", todo->text.c_str());
+            ImGui::SameLine();
+            if (ImGui::Checkbox("##completed", &todo->completed)) {
+              store.toggle(*todo);
+              index.toggle(handle, todo->completed);
             }
-            todos.erase(todos.begin() + i);
-            --i;
+            ImGui::SameLine();
+            if (ImGui::Button("Delete"))
+              deleted = handle;
+            ImGui::SameLine();
+            if (ImGui::Button(editing == handle ? "Cancel" : "Edit"))
+              edit(handle);
+            ImGui::PopID();
           }
-          ImGui::SameLine();
-          if (ImGui::Button(TextFormat(
-                  "%s##foo%d", editing_idx == i ? "Cancel" : "Edit", i))) {
-            edit(i);
+        }
+        // Erased after the loop so the rows being drawn don't shift
+        if (deleted.valid()) {
+          if (editing == deleted) {
+            editing = {};
+            input.clear();
           }
+          store.remove(*todos.get(deleted));
+          index.remove(deleted, *todos.get(deleted));
+          order.erase(deleted);
+          todos.erase(deleted);
         }
+        ImGui::EndListBox();
       }
-      ImGui::EndListBox();
     }
     ImGui::End();
 
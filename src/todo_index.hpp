@@ -0,0 +1,399 @@
+#pragma once
+
+#include "slot_map.hpp"
+#include "todo_store.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+typedef enum TodoFilter {
+  TODO_FILTER_ALL,
+  TODO_FILTER_ACTIVE,
+  TODO_FILTER_COMPLETED,
+  TODO_FILTER_COUNT,
+} TodoFilter;
+
+inline const char *TodoFilterNames[] = {"All", "Active", "Completed"};
+
+// Splits text into words: runs of ASCII letters and digits or of non-ASCII
+// bytes (so UTF-8 characters stay whole), with ASCII letters lowercased.
+// words are set to the distinct ones, sorted, pointing into buffer.
+inline void SplitWords(std::string_view text, std::string &buffer,
+                       std::vector<std::string_view> &words) {
+  buffer.resize(text.size());
+  words.clear();
+  size_t start = SIZE_MAX;
+  for (size_t i = 0; i <= text.size(); ++i) {
+    unsigned char c = i < text.size() ? text[i] : ' ';
+    bool inWord = (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') ||
+                  (c >= 'A' && c <= 'Z') || c >= 0x80;
+    if (i < text.size())
+      buffer[i] = c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+    if (inWord && start == SIZE_MAX) {
+      start = i;
+    } else if (!inWord && start != SIZE_MAX) {
+      words.emplace_back(buffer.data() + start, i - start);
+      start = SIZE_MAX;
+    }
+  }
+  std::sort(words.begin(), words.end());
+  words.erase(std::unique(words.begin(), words.end()), words.end());
+}
+
+// Inverted index over the text of todos, for search as you type: a todo
+// matches a query if every word of the query starts one of its words.
+// Todos are numbered in the order they were added, and each word of 3 or
+// more bytes, and each 1- and 2-byte word start, has a posting list of the
+// numbers of the todos it occurs in; a query word of 3 or more bytes looks
+// up the words it starts. Lists that cover a good part of the todos turn
+// into bitsets, and queries are answered as bitsets too, together with the
+// completed and active bitsets, so even a query matching a million todos
+// costs a few passes over 16K words.
+//
+// Changes are applied as they happen. Existing todos are indexed a slice
+// at a time by build(), and over again once deletions have left too many
+// numbers unused.
+class TodoIndex {
+public:
+  // Indexes todos not indexed yet until they all are or budget runs out;
+  // meant to be called once per frame. todos and order must hold every todo
+  // passed to the other methods, and no others.
+  void build(const SlotMap<Todo> &todos, const SlotOrder &order,
+             std::chrono::microseconds budget) {
+    if (stale)
+      reset(todos, order);
+    auto deadline = std::chrono::steady_clock::now() + budget;
+    for (size_t count = 0; built < handles.size(); ++count) {
+      if (count % 64 == 0 && std::chrono::steady_clock::now() > deadline)
+        break;
+      if (const Todo *todo = todos.get(handles[built]))
+        insertWords((uint32_t)built, todo->text);
+      ++built;
+      changed = true;
+    }
+  }
+
+  // Share of the todos indexed so far; queries with words only match those
+  float progress() const {
+    return handles.empty() ? 1.0f : (float)built / handles.size();
+  }
+
+  // todo was just added, as handle
+  void add(SlotHandle handle, const Todo &todo) {
+    if (stale)
+      return;
+    uint32_t seq = (uint32_t)handles.size();
+    handles.push_back(handle);
+    if (handle.index >= seqs.size())
+      seqs.resize(handle.index + 1, NONE);
+    seqs[handle.index] = seq;
+    SetBit(live, seq);
+    if (todo.completed)
+      SetBit(completed, seq);
+    ++liveCount;
+    // Left to build() if it hasn't got this far yet
+    if (built == seq) {
+      insertWords(seq, todo.text);
+      ++built;
+    }
+    changed = true;
+  }
+
+  // The text of handle is about to change from oldText to newText
+  void edit(SlotHandle handle, std::string_view oldText,
+            std::string_view newText) {
+    uint32_t seq = seqOf(handle);
+    if (seq == NONE)
+      return;
+    if (seq < built) {
+      eraseWords(seq, oldText);
+      insertWords(seq, newText);
+    }
+    changed = true;
+  }
+
+  // handle was marked completed or not
+  void toggle(SlotHandle handle, bool isCompleted) {
+    uint32_t seq = seqOf(handle);
+    if (seq == NONE)
+      return;
+    if (isCompleted)
+      SetBit(completed, seq);
+    else
+      ClearBit(completed, seq);
+    changed = true;
+  }
+
+  // todo, handle, is about to be deleted
+  void remove(SlotHandle handle, const Todo &todo) {
+    uint32_t seq = seqOf(handle);
+    if (seq == NONE)
+      return;
+    if (seq < built)
+      eraseWords(seq, todo.text);
+    ClearBit(live, seq);
+    ClearBit(completed, seq);
+    handles[seq] = {};
+    seqs[handle.index] = NONE;
+    --liveCount;
+    changed = true;
+    // Bitsets are as long as todos were ever numbered; renumber once most
+    // numbers are unused
+    if (handles.size() > 2 * liveCount + RENUMBER_SLACK)
+      stale = true;
+  }
+
+  // Finds the todos matching query that pass filter; count() and match()
+  // then give them. Cheap when nothing changed since the last call.
+  void search(std::string_view query, TodoFilter filter) {
+    if (!changed && query == lastQuery && filter == lastFilter)
+      return;
+    changed = false;
+    lastQuery = query;
+    lastFilter = filter;
+    // Until build() numbers the todos again, nothing matches
+    size_t size = stale ? 0 : (handles.size() + 63) / 64;
+    matches = live;
+    matches.resize(size, 0);
+    SplitWords(query, queryBuffer, terms);
+    for (std::string_view term : terms) {
+      scratch.assign(size, 0);
+      if (term.size() <= 2) {
+        if (uint32_t id = prefixes[PrefixKey(term)]; id != NONE)
+          postings[id].orInto(scratch);
+      } else {
+        for (auto word = sortedWords.lower_bound(term);
+             word != sortedWords.end() && word->first.starts_with(term);
+             ++word)
+          postings[word->second].orInto(scratch);
+      }
+      for (size_t i = 0; i < size; ++i)
+        matches[i] &= scratch[i];
+    }
+    if (filter != TODO_FILTER_ALL) {
+      bool wanted = filter == TODO_FILTER_COMPLETED;
+      for (size_t i = 0; i < size; ++i) {
+        uint64_t done = i < completed.size() ? completed[i] : 0;
+        matches[i] &= wanted ? done : ~done;
+      }
+    }
+    ranks.resize(size);
+    matchCount = 0;
+    for (size_t i = 0; i < size; ++i) {
+      ranks[i] = (uint32_t)matchCount;
+      matchCount += std::popcount(matches[i]);
+    }
+  }
+
+  // Todos found by the last search(), newest first
+  size_t count() const { return matchCount; }
+  SlotHandle match(size_t k) const {
+    size_t rank = matchCount - 1 - k; // counting from the oldest
+    size_t word =
+        std::upper_bound(ranks.begin(), ranks.end(), rank) - ranks.begin() - 1;
+    uint64_t bits = matches[word];
+    for (size_t skip = rank - ranks[word]; skip > 0; --skip)
+      bits &= bits - 1;
+    return handles[word * 64 + std::countr_zero(bits)];
+  }
+
+private:
+  static constexpr uint32_t NONE = UINT32_MAX;
+  static constexpr size_t RENUMBER_SLACK = 4096;
+  // A posting list turns into a bitset once it has this many numbers and
+  // the bitset would be smaller
+  static constexpr size_t DENSE_MIN = 1024;
+  // Postings of 1-byte word starts, then 2-byte ones
+  static constexpr size_t PREFIXES = 256 + 256 * 256;
+
+  // The todos a word, or word start, occurs in: sorted numbers while few,
+  // else a bitset
+  struct Posting {
+    std::vector<uint32_t> seqs;
+    std::vector<uint64_t> bits;
+    size_t count = 0;
+
+    void insert(uint32_t seq, size_t total) {
+      if (!bits.empty()) {
+        count += !TestBit(bits, seq);
+        SetBit(bits, seq);
+        return;
+      }
+      // Usually the newest todo, which goes last
+      auto at = seqs.empty() || seqs.back() < seq
+                    ? seqs.end()
+                    : std::lower_bound(seqs.begin(), seqs.end(), seq);
+      if (at != seqs.end() && *at == seq)
+        return;
+      seqs.insert(at, seq);
+      ++count;
+      if (count >= DENSE_MIN && count * 32 > total) {
+        for (uint32_t each : seqs)
+          SetBit(bits, each);
+        seqs = {};
+      }
+    }
+
+    void erase(uint32_t seq) {
+      if (!bits.empty()) {
+        count -= TestBit(bits, seq);
+        ClearBit(bits, seq);
+        return;
+      }
+      auto at = std::lower_bound(seqs.begin(), seqs.end(), seq);
+      if (at != seqs.end() && *at == seq) {
+        seqs.erase(at);
+        --count;
+      }
+    }
+
+    void orInto(std::vector<uint64_t> &out) const {
+      for (size_t i = 0; i < std::min(bits.size(), out.size()); ++i)
+        out[i] |= bits[i];
+      for (uint32_t seq : seqs)
+        out[seq / 64] |= uint64_t(1) << (seq % 64);
+    }
+  };
+
+  struct WordHash {
+    using is_transparent = void;
+    size_t operator()(std::string_view word) const {
+      return std::hash<std::string_view>{}(word);
+    }
+  };
+
+  std::vector<Posting> postings;
+  // Posting of each word start (see PrefixKey), and of each longer word;
+  // the words are also kept sorted, to find the ones a query word starts
+  std::vector<uint32_t> prefixes;
+  std::unordered_map<std::string, uint32_t, WordHash, std::equal_to<>> words;
+  std::map<std::string_view, uint32_t> sortedWords; // keys point into words
+  std::vector<SlotHandle> handles; // of each number, invalid once deleted
+  std::vector<uint32_t> seqs;      // number of each slot index, or NONE
+  std::vector<uint64_t> live, completed; // bitsets over numbers
+  size_t liveCount = 0;
+  size_t built = 0; // numbers below this are indexed
+  bool stale = true; // to be indexed from scratch
+
+  // Last search
+  std::string lastQuery;
+  TodoFilter lastFilter = TODO_FILTER_ALL;
+  bool changed = true;
+  std::vector<uint64_t> matches, scratch;
+  std::vector<uint32_t> ranks; // matches before each word of matches
+  size_t matchCount = 0;
+
+  // Scratch for splitting text
+  std::string textBuffer, queryBuffer;
+  std::vector<std::string_view> textWords, terms;
+
+  static bool TestBit(const std::vector<uint64_t> &bits, size_t i) {
+    return i / 64 < bits.size() && (bits[i / 64] >> (i % 64) & 1);
+  }
+  static void SetBit(std::vector<uint64_t> &bits, size_t i) {
+    if (i / 64 >= bits.size())
+      bits.resize(i / 64 + 1, 0);
+    bits[i / 64] |= uint64_t(1) << (i % 64);
+  }
+  static void ClearBit(std::vector<uint64_t> &bits, size_t i) {
+    if (i / 64 < bits.size())
+      bits[i / 64] &= ~(uint64_t(1) << (i % 64));
+  }
+
+  static size_t PrefixKey(std::string_view start) {
+    return start.size() == 1
+               ? (uint8_t)start[0]
+               : 256 + ((uint8_t)start[0] << 8 | (uint8_t)start[1]);
+  }
+
+  // Numbers the todos in order, to be indexed by build()
+  void reset(const SlotMap<Todo> &todos, const SlotOrder &order) {
+    postings.clear();
+    prefixes.assign(PREFIXES, NONE);
+    sortedWords.clear();
+    words.clear();
+    handles.clear();
+    handles.reserve(order.size());
+    seqs.clear();
+    live.assign((order.size() + 63) / 64, 0);
+    completed.assign(live.size(), 0);
+    order.forEach([&](SlotHandle handle) {
+      uint32_t seq = (uint32_t)handles.size();
+      handles.push_back(handle);
+      if (handle.index >= seqs.size())
+        seqs.resize(handle.index + 1, NONE);
+      seqs[handle.index] = seq;
+      SetBit(live, seq);
+      if (todos.get(handle)->completed)
+        SetBit(completed, seq);
+    });
+    liveCount = handles.size();
+    built = 0;
+    stale = false;
+    changed = true;
+  }
+
+  uint32_t seqOf(SlotHandle handle) const {
+    if (stale || handle.index >= seqs.size() || seqs[handle.index] == NONE ||
+        handles[seqs[handle.index]] != handle)
+      return NONE;
+    return seqs[handle.index];
+  }
+
+  // NONE if key has no posting list and create is false
+  uint32_t postingOf(std::string_view key, bool create) {
+    uint32_t id = NONE;
+    if (key.size() <= 2) {
+      id = prefixes[PrefixKey(key)];
+    } else if (auto word = words.find(key); word != words.end()) {
+      id = word->second;
+    }
+    if (id != NONE || !create)
+      return id;
+    id = (uint32_t)postings.size();
+    postings.emplace_back();
+    if (key.size() <= 2) {
+      prefixes[PrefixKey(key)] = id;
+    } else {
+      auto word = words.emplace(std::string(key), id).first;
+      sortedWords.emplace(word->first, id);
+    }
+    return id;
+  }
+
+  void insertWords(uint32_t seq, std::string_view text) {
+    SplitWords(text, textBuffer, textWords);
+    for (std::string_view word : textWords)
+      forEachKey(word, [&](std::string_view key) {
+        postings[postingOf(key, true)].insert(seq, handles.size());
+      });
+  }
+
+  void eraseWords(uint32_t seq, std::string_view text) {
+    SplitWords(text, textBuffer, textWords);
+    for (std::string_view word : textWords)
+      forEachKey(word, [&](std::string_view key) {
+        // Listed when the text was indexed
+        postings[postingOf(key, false)].erase(seq);
+      });
+  }
+
+  // The keys word is listed under: its 1- and 2-byte starts, and itself if
+  // it is longer
+  template <typename F> static void forEachKey(std::string_view word, F &&fn) {
+    fn(word.substr(0, 1));
+    if (word.size() >= 2)
+      fn(word.substr(0, 2));
+    if (word.size() >= 3)
+      fn(word);
+  }
+};
@@ -0,0 +1,536 @@
+#pragma once
+
+#include "piece_table.hpp"
+#include "slot_map.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#else
+#include <io.h>
+#endif
+
+typedef struct Todo {
+  std::string text;
+  bool completed;
+  uint64_t id = 0; // names the todo in the store, the same from run to run
+} Todo;
+
+// CRC-32C kernels. The store checks what it reads back against them, so a
+// write cut short by a crash is recognized.
+inline uint32_t Crc32cScalar(uint32_t crc, const char *data, size_t size) {
+  static constexpr std::array<uint32_t, 256> TABLE = [] {
+    std::array<uint32_t, 256> table{};
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t value = i;
+      for (int bit = 0; bit < 8; ++bit)
+        value = value & 1 ? (value >> 1) ^ 0x82F63B78 : value >> 1;
+      table[i] = value;
+    }
+    return table;
+  }();
+  for (size_t i = 0; i < size; ++i)
+    crc = TABLE[(crc ^ (uint8_t)data[i]) & 0xFF] ^ (crc >> 8);
+  return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) inline uint32_t
+Crc32cSSE42(uint32_t crc, const char *data, size_t size) {
+  uint64_t value = crc;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    memcpy(&word, data + i, 8);
+    value = _mm_crc32_u64(value, word);
+  }
+  crc = (uint32_t)value;
+  for (; i < size; ++i)
+    crc = _mm_crc32_u8(crc, (uint8_t)data[i]);
+  return crc;
+}
+#endif
+
+using Crc32cKernel = uint32_t (*)(uint32_t, const char *, size_t);
+
+inline Crc32cKernel SelectCrc32c() {
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse4.2"))
+    return Crc32cSSE42;
+#endif
+  return Crc32cScalar;
+}
+
+// CRC-32C (Castagnoli) of [data, data + size), continuing crc, the CRC of
+// the bytes before them
+inline uint32_t Crc32c(const char *data, size_t size, uint32_t crc = 0) {
+  static const Crc32cKernel kernel = SelectCrc32c();
+  return ~kernel(~crc, data, size);
+}
+
+// Keeps todos on disk as a snapshot plus a log of the changes made since:
+// one record per add, edit, toggle or delete. A background thread appends
+// whatever records have piled up in one write and one flush to disk, at
+// most every COMMIT_INTERVAL, so a crash loses at most the changes of the
+// last interval. Once the log grows past a fraction of the snapshot, the
+// background thread replays the snapshot and log it wrote into a new
+// snapshot and starts the log over, so replaying the log never takes long
+// next to loading the snapshot and the UI thread never waits for it.
+//
+// Both files are a header followed by frames (size, CRC-32C, records) in
+// the machine's byte order. A frame cut short or not matching its CRC ends
+// the log: it is a commit that a crash interrupted. The log header names the
+// snapshot it continues, so a log left from before the last snapshot is
+// recognized and ignored.
+class TodoStore {
+public:
+  // Records are committed together at most this often
+  static constexpr std::chrono::milliseconds COMMIT_INTERVAL{50};
+
+  TodoStore() = default;
+  TodoStore(const TodoStore &) = delete;
+  TodoStore &operator=(const TodoStore &) = delete;
+
+  ~TodoStore() {
+    // The writer commits what is still pending before it stops
+    if (writer.joinable()) {
+      writer.request_stop();
+      writer.join();
+    }
+    if (log)
+      fclose(log);
+  }
+
+  // Loads the todos stored at path (path.snapshot and path.log) into todos
+  // and order, which should be empty, and starts logging. Returns false if
+  // they couldn't be loaded or the log couldn't be opened; failure() says
+  // why, and nothing is logged then.
+  bool open(const std::string &path, SlotMap<Todo> &todos, SlotOrder &order) {
+    snapshotPath = path + ".snapshot";
+    logPath = path + ".log";
+    size_t end;
+    if (!load(todos, order, nextId, end, error))
+      return false;
+    std::error_code ec;
+    if (end != 0) {
+      // Appends go right after the last whole frame
+      std::filesystem::resize_file(logPath, end, ec);
+      if (ec)
+        return fail("Could not truncate " + logPath + ": " + ec.message());
+      if (!(log = fopen(logPath.c_str(), "ab")))
+        return fail("Could not open " + logPath + ": " + strerror(errno));
+    } else if (!startLog(generation, error)) {
+      return false;
+    }
+    writer = std::jthread([this](std::stop_token stop) { run(stop); });
+    return true;
+  }
+
+  // Gives todo a new id and logs it being added
+  void add(Todo &todo) {
+    todo.id = nextId++;
+    record(TODO_ADD, todo);
+  }
+  // Logs todo's new text
+  void edit(const Todo &todo) { record(TODO_EDIT, todo); }
+  // Logs todo's new completed state
+  void toggle(const Todo &todo) { record(TODO_TOGGLE, todo); }
+  // Logs todo being deleted
+  void remove(const Todo &todo) { record(TODO_DELETE, todo); }
+
+  // Why changes are no longer stored, or empty while they are
+  std::string failure() {
+    std::lock_guard lock(mutex);
+    return error;
+  }
+
+private:
+  // Compaction waits for the log to grow past this, however small the
+  // snapshot is
+  static constexpr size_t COMPACT_MIN = 4 << 20;
+  // or past this fraction of the snapshot. A log record lands on a random
+  // todo, so replaying one costs several times what loading a todo does.
+  static constexpr size_t COMPACT_RATIO = 8;
+  static constexpr char SNAPSHOT_MAGIC[] = "TODOSNP1";
+  static constexpr char LOG_MAGIC[] = "TODOLOG1";
+  // Magic, generation, count
+  static constexpr size_t SNAPSHOT_HEADER = 24;
+  // Magic, generation
+  static constexpr size_t LOG_HEADER = 16;
+  // Size of the records, their CRC
+  static constexpr size_t FRAME_HEADER = 12;
+  // Operation, id, completed state, text size
+  static constexpr size_t MIN_ADD_RECORD = 14;
+
+  // Each record is the operation and the todo's id, then the todo's
+  // completed state for an add or toggle and its text (size first) for an
+  // add or edit. Ids count up from 0 in the order todos were added and never
+  // change, so they index a table while loading; deleted todos leave gaps.
+  typedef enum TodoOp : uint8_t {
+    TODO_ADD = 1,
+    TODO_EDIT,
+    TODO_TOGGLE,
+    TODO_DELETE,
+  } TodoOp;
+
+  std::string snapshotPath, logPath;
+  uint64_t nextId = 0; // used by add() only
+  // Owned by the writer once open
+  uint64_t generation = 0; // of the snapshot, which the log continues
+  size_t snapshotBytes = 0, logged = 0; // records in the snapshot, the log
+  FILE *log = nullptr;
+
+  std::mutex mutex;
+  std::condition_variable_any wake;
+  std::string pending; // records waiting to be committed
+  std::string error;
+  std::jthread writer; // last, so it is joined before the rest goes away
+
+  static void AppendRecord(std::string &out, TodoOp op, const Todo &todo) {
+    out.push_back((char)op);
+    out.append((const char *)&todo.id, 8);
+    if (op == TODO_ADD || op == TODO_TOGGLE)
+      out.push_back((char)todo.completed);
+    if (op == TODO_ADD || op == TODO_EDIT) {
+      uint32_t size = (uint32_t)todo.text.size();
+      out.append((const char *)&size, 4);
+      out.append(todo.text);
+    }
+  }
+
+  static std::string Frame(std::string_view records) {
+    uint64_t size = records.size();
+    uint32_t crc = Crc32c(records.data(), records.size());
+    std::string header((const char *)&size, 8);
+    header.append((const char *)&crc, 4);
+    return header;
+  }
+
+  // Sets records to the frame at offset and moves offset past it; false if
+  // there is no whole, intact frame there. The CRC continues crc, the CRC
+  // of whatever else the frame covers.
+  static bool nextFrame(std::string_view data, size_t &offset,
+                        std::string_view &records, uint32_t crc = 0) {
+    uint64_t size;
+    uint32_t stored;
+    if (data.size() - offset < FRAME_HEADER)
+      return false;
+    memcpy(&size, data.data() + offset, 8);
+    memcpy(&stored, data.data() + offset + 8, 4);
+    if (data.size() - offset - FRAME_HEADER < size)
+      return false;
+    records = data.substr(offset + FRAME_HEADER, size);
+    if (Crc32c(records.data(), records.size(), crc) != stored)
+      return false;
+    offset += FRAME_HEADER + size;
+    return true;
+  }
+
+  // Applies records to todos and order, where handles[id] is the todo with
+  // that id, and moves nextId past the ids added; false if they are
+  // malformed
+  static bool replay(std::string_view records, SlotMap<Todo> &todos,
+                     SlotOrder &order, std::vector<SlotHandle> &handles,
+                     uint64_t &nextId) {
+    size_t at = 0;
+    auto take = [&](void *out, size_t size) {
+      if (records.size() - at < size)
+        return false;
+      memcpy(out, records.data() + at, size);
+      at += size;
+      return true;
+    };
+    while (at < records.size()) {
+      uint8_t op;
+      uint64_t id;
+      uint8_t completed = 0;
+      uint32_t size = 0;
+      if (!take(&op, 1) || op < TODO_ADD || op > TODO_DELETE ||
+          !take(&id, 8) ||
+          ((op == TODO_ADD || op == TODO_TOGGLE) && !take(&completed, 1)) ||
+          ((op == TODO_ADD || op == TODO_EDIT) &&
+           (!take(&size, 4) || records.size() - at < size)))
+        return false;
+      std::string_view text = records.substr(at, size);
+      at += size;
+      if (op == TODO_ADD) {
+        if (id < nextId)
+          return false; // ids are handed out in increasing order
+        nextId = id + 1;
+        handles.resize(nextId);
+        handles[id] = todos.insert(Todo{
+            .text = std::string(text), .completed = completed != 0, .id = id});
+        order.push_back(handles[id]);
+        continue;
+      }
+      Todo *todo = id < handles.size() ? todos.get(handles[id]) : nullptr;
+      if (!todo)
+        continue; // changed after it was deleted; nothing to do
+      if (op == TODO_EDIT) {
+        todo->text = text;
+      } else if (op == TODO_TOGGLE) {
+        todo->completed = completed != 0;
+      } else {
+        order.erase(handles[id]);
+        todos.erase(handles[id]);
+      }
+    }
+    return true;
+  }
+
+  bool fail(std::string why) {
+    error = std::move(why);
+    return false;
+  }
+
+  // Loads the snapshot and the log continuing it into todos and order and
+  // moves nextId past their ids. end is set to where the log's last whole
+  // frame ends, or 0 if no log continues the snapshot. Run by open() and
+  // then only by the writer, which owns the files from then on.
+  bool load(SlotMap<Todo> &todos, SlotOrder &order, uint64_t &nextId,
+            size_t &end, std::string &failed) {
+    std::vector<SlotHandle> handles; // of each id, invalid for gaps
+    std::error_code ec;
+    generation = 0;
+    snapshotBytes = logged = end = 0;
+    if (std::filesystem::exists(snapshotPath, ec)) {
+      auto file = MappedFile::open(snapshotPath.c_str(), failed);
+      if (!file)
+        return false;
+      std::string_view data(file->data(), file->size()), records;
+      uint64_t count;
+      size_t offset = SNAPSHOT_HEADER;
+      // The frame's CRC covers the header too
+      if (data.size() < SNAPSHOT_HEADER ||
+          memcmp(data.data(), SNAPSHOT_MAGIC, 8) != 0 ||
+          !nextFrame(data, offset, records,
+                     Crc32c(data.data(), SNAPSHOT_HEADER))) {
+        failed = snapshotPath + " is damaged";
+        return false;
+      }
+      memcpy(&generation, data.data() + 8, 8);
+      memcpy(&count, data.data() + 16, 8);
+      count = std::min<uint64_t>(count, records.size() / MIN_ADD_RECORD);
+      todos.reserve(count);
+      order.reserve(count);
+      if (!replay(records, todos, order, handles, nextId) ||
+          todos.size() != count) {
+        failed = snapshotPath + " is damaged";
+        return false;
+      }
+      snapshotBytes = records.size();
+    }
+
+    // Frames are replayed up to the first one a crash cut short
+    if (std::filesystem::exists(logPath, ec)) {
+      auto file = MappedFile::open(logPath.c_str(), failed);
+      if (!file)
+        return false;
+      std::string_view data(file->data(), file->size());
+      uint64_t logGeneration = generation + 1; // no match unless read
+      if (data.size() >= LOG_HEADER &&
+          memcmp(data.data(), LOG_MAGIC, 8) == 0)
+        memcpy(&logGeneration, data.data() + 8, 8);
+      if (logGeneration == generation) {
+        std::string_view records;
+        end = LOG_HEADER;
+        for (size_t offset = end; nextFrame(data, offset, records);
+             end = offset)
+          if (!replay(records, todos, order, handles, nextId))
+            break;
+        logged = end - LOG_HEADER;
+      }
+    }
+    return true;
+  }
+
+  void record(TodoOp op, const Todo &todo) {
+    if (!writer.joinable())
+      return;
+    std::lock_guard lock(mutex);
+    if (!error.empty())
+      return;
+    AppendRecord(pending, op, todo);
+    wake.notify_one();
+  }
+
+  // Flushes file's buffered writes all the way to disk
+  static bool SyncFile(FILE *file) {
+    if (fflush(file) != 0)
+      return false;
+#ifndef _WIN32
+    return fsync(fileno(file)) == 0;
+#else
+    return _commit(_fileno(file)) == 0;
+#endif
+  }
+
+  // Replaces path with contents: written to a temporary file, flushed to
+  // disk and renamed over it, so a crash leaves either the old file or the
+  // new one
+  static bool WriteDurably(const std::string &path, std::string_view contents,
+                           std::string &failed) {
+    std::string temp = path + ".tmp";
+    FILE *out = fopen(temp.c_str(), "wb");
+    if (!out) {
+      failed = "Could not create " + temp + ": " + strerror(errno);
+      return false;
+    }
+    bool written = fwrite(contents.data(), 1, contents.size(), out) ==
+                       contents.size() &&
+                   SyncFile(out);
+    if (fclose(out) != 0 || !written) {
+      failed = "Could not write " + temp + ": " + strerror(errno);
+      std::remove(temp.c_str());
+      return false;
+    }
+    std::error_code ec;
+    std::filesystem::rename(temp, path, ec);
+    if (ec) {
+      failed = "Could not rename " + temp + ": " + ec.message();
+      return false;
+    }
+#ifndef _WIN32
+    // The rename itself is only durable once the directory is flushed
+    std::string dir = std::filesystem::path(path).parent_path().string();
+    int dir_fd =
+        ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dir_fd >= 0) {
+      fsync(dir_fd);
+      close(dir_fd);
+    }
+#endif
+    return true;
+  }
+
+  // Replaces the log with an empty one continuing snapshot generation
+  bool startLog(uint64_t logGeneration, std::string &failed) {
+    if (log) {
+      fclose(log);
+      log = nullptr;
+    }
+    std::string header(LOG_MAGIC, 8);
+    header.append((const char *)&logGeneration, 8);
+    if (!WriteDurably(logPath, header, failed))
+      return false;
+    if (!(log = fopen(logPath.c_str(), "ab"))) {
+      failed = "Could not open " + logPath + ": " + strerror(errno);
+      return false;
+    }
+    return true;
+  }
+
+  // Appends records to the log as one frame and flushes it to disk
+  bool commit(std::string_view records, std::string &failed) {
+    if (records.empty())
+      return true;
+    std::string header = Frame(records);
+    if (fwrite(header.data(), 1, header.size(), log) != header.size() ||
+        fwrite(records.data(), 1, records.size(), log) != records.size() ||
+        !SyncFile(log)) {
+      failed = "Could not write " + logPath + ": " + strerror(errno);
+      return false;
+    }
+    logged += header.size() + records.size();
+    return true;
+  }
+
+  // Replays the snapshot and log on disk and writes the todos they hold, in
+  // order and with their ids, as the next snapshot. Records logged on the
+  // UI thread meanwhile wait in pending for the new log.
+  bool compact(std::string &failed) {
+    SlotMap<Todo> todos;
+    SlotOrder order;
+    uint64_t ids = 0;
+    size_t written = LOG_HEADER + logged, end;
+    if (!load(todos, order, ids, end, failed))
+      return false;
+    if (end != written) {
+      failed = "Could not read back " + logPath;
+      return false;
+    }
+    // Header and frame header first, filled in once the records are there
+    std::string contents(SNAPSHOT_HEADER + FRAME_HEADER, '\0');
+    contents.reserve(contents.size() + snapshotBytes + logged);
+    order.forEach([&](SlotHandle handle) {
+      AppendRecord(contents, TODO_ADD, *todos.get(handle));
+    });
+    uint64_t count = todos.size();
+    uint64_t size = contents.size() - SNAPSHOT_HEADER - FRAME_HEADER;
+    memcpy(contents.data(), SNAPSHOT_MAGIC, 8);
+    // The generation, at 8, and the CRC are filled in by writeSnapshot()
+    memcpy(contents.data() + 16, &count, 8);
+    memcpy(contents.data() + SNAPSHOT_HEADER, &size, 8);
+    if (!writeSnapshot(contents, failed))
+      return false;
+    snapshotBytes = size;
+    logged = 0;
+    return true;
+  }
+
+  // Writes a new snapshot, then starts a log continuing it. A crash before
+  // the new log is in place leaves the old one, which names the old snapshot
+  // and is ignored.
+  bool writeSnapshot(std::string &contents, std::string &failed) {
+    uint64_t next = generation + 1;
+    memcpy(contents.data() + 8, &next, 8);
+    uint32_t crc = Crc32c(contents.data(), SNAPSHOT_HEADER);
+    crc = Crc32c(contents.data() + SNAPSHOT_HEADER + FRAME_HEADER,
+                 contents.size() - SNAPSHOT_HEADER - FRAME_HEADER, crc);
+    memcpy(contents.data() + SNAPSHOT_HEADER + 8, &crc, 4);
+    if (!WriteDurably(snapshotPath, contents, failed) ||
+        !startLog(next, failed))
+      return false;
+    generation = next;
+    return true;
+  }
+
+  void run(std::stop_token stop) {
+    std::unique_lock lock(mutex);
+    // Once stopping, this runs until everything pending is committed
+    while (wake.wait(lock, stop, [this] { return !pending.empty(); })) {
+      std::string batch = std::move(pending);
+      pending.clear();
+      lock.unlock();
+
+      std::string failed;
+      bool ok = commit(batch, failed) &&
+                (logged <= std::max(COMPACT_MIN,
+                                    snapshotBytes / COMPACT_RATIO) ||
+                 compact(failed));
+
+      lock.lock();
+      if (!ok) {
+        error = std::move(failed);
+        pending.clear();
+        return;
+      }
+      // Changes made meanwhile pile up to be committed together
+      wake.wait_for(lock, stop, COMMIT_INTERVAL, [] { return false; });
+    }
+  }
+};
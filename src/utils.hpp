@@ -25,6 +25,15 @@ inline bool InputTextString(const char *label, std::string *str,
       str->capacity() + 1, flags, InputTextCallback, (void *)str);
 }
 
+inline bool InputTextWithHintString(const char *label, const char *hint,
+                                    std::string *str,
+                                    ImGuiInputTextFlags flags = 0) {
+  flags |= ImGuiInputTextFlags_CallbackResize;
+  return ImGui::InputTextWithHint(
+      label, hint, str->empty() ? (char *)"" : &(*str)[0],
+      str->capacity() + 1, flags, InputTextCallback, (void *)str);
+}
+
 inline bool InputTextMultilineString(const char *label, std::string *str,
                                      ImVec2 size = {0, 0},
                                      ImGuiInputTextFlags flags = 0) {